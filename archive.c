@@ -0,0 +1,611 @@
+/*
+ * Multi-filter archives. See archive.h for the layout.
+ *
+ * Released under GPLv2
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "encode.h"
+#include "archive.h"
+#include "pack.h"
+
+/* a directory entry before its name */
+#define ARCHIVE_ENTRY_SIZE 46
+
+
+static uint32_t
+archive_crc (const void *data, size_t len)
+{
+  uLong crc = crc32 (0, Z_NULL, 0);
+  const unsigned char *p = data;
+  size_t n;
+
+  /* crc32 takes a uInt length */
+  while (len) {
+    n = (len > (1u << 30)) ? (1u << 30) : len;
+    crc = crc32 (crc, p, n);
+    p += n;
+    len -= n;
+  }
+  return crc;
+}
+
+
+/*
+ * Parse 'count' directory entries from 'dir', checking that each one's
+ * bytes lie in the data area, before 'data_end'. The names point into
+ * 'dir'. Returns 0 if it's good, 1 on allocation failure and -1 if it
+ * isn't.
+ */
+static int
+parse_directory (const unsigned char *dir, size_t dir_len, uint64_t count,
+    uint64_t data_end, struct golomb_archive_entry **entries)
+{
+  struct golomb_archive_entry *e;
+  const unsigned char *p = dir, *end = dir + dir_len;
+  uint64_t k;
+
+  /* every entry takes at least its fixed part */
+  if (count > dir_len / ARCHIVE_ENTRY_SIZE) return -1;
+  if ( !(e = malloc (sizeof (*e) * (count ? count : 1))) ) {
+    perror ("archive: cannot malloc directory: ");
+    return 1;
+  }
+
+  for (k = 0; k < count; ++k) {
+    if (end - p < ARCHIVE_ENTRY_SIZE) goto bad_directory;
+    e[k].id = get_le64 (p);
+    e[k].offset = get_le64 (p + 8);
+    e[k].length = get_le64 (p + 16);
+    e[k].golomb_param = get_le64 (p + 24);
+    e[k].original_size = get_le64 (p + 32);
+    e[k].crc = get_le32 (p + 40);
+    e[k].name_len = p[44] | (p[45] << 8);
+    p += ARCHIVE_ENTRY_SIZE;
+
+    if ((size_t) (end - p) < e[k].name_len) goto bad_directory;
+    e[k].name = (const char*) p;
+    p += e[k].name_len;
+
+    if (e[k].offset < GOLOMB_ARCHIVE_HEADER_SIZE ||
+        e[k].offset > data_end || e[k].length > data_end - e[k].offset)
+      goto bad_directory;
+  }
+  if (p != end) goto bad_directory;
+
+  *entries = e;
+  return 0;
+
+bad_directory:
+  free (e);
+  return -1;
+}
+
+
+/*
+ * Check the header and trailer of a 'size' byte archive, and get the
+ * directory's offset and entry count from the trailer. Returns 0, or
+ * -1 if it isn't an archive.
+ */
+static int
+check_ends (const unsigned char *header, const unsigned char *t,
+    uint64_t size, uint64_t *dir_offset, uint64_t *count)
+{
+  if (size < GOLOMB_ARCHIVE_HEADER_SIZE + GOLOMB_ARCHIVE_TRAILER_SIZE ||
+      memcmp (header, GOLOMB_ARCHIVE_MAGIC, 4) ||
+      header[4] != GOLOMB_ARCHIVE_VERSION ||
+      memcmp (t + 28, GOLOMB_ARCHIVE_MAGIC, 4))
+    return -1;
+
+  *dir_offset = get_le64 (t);
+  *count = get_le64 (t + 8);
+  if (*dir_offset < GOLOMB_ARCHIVE_HEADER_SIZE ||
+      *dir_offset > size - GOLOMB_ARCHIVE_TRAILER_SIZE)
+    return -1;
+  return 0;
+}
+
+/*
+ * Find the trailer at the end of the 'size' byte archive 'base' and
+ * parse the directory. Returns as parse_directory does, the directory
+ * offset in '*dir_offset'.
+ */
+static int
+read_archive (const unsigned char *base, size_t size,
+    struct golomb_archive_entry **entries, size_t *n, uint64_t *dir_offset)
+{
+  const unsigned char *t;
+  uint64_t off, count;
+
+  if (size < GOLOMB_ARCHIVE_HEADER_SIZE + GOLOMB_ARCHIVE_TRAILER_SIZE)
+    return -1;
+  t = base + size - GOLOMB_ARCHIVE_TRAILER_SIZE;
+  if (check_ends (base, t, size, &off, &count) ||
+      archive_crc (base + off, t - (base + off)) != get_le32 (t + 16))
+    return -1;
+
+  *n = count;
+  *dir_offset = off;
+  return parse_directory (base + off, t - (base + off), count, off,
+      entries);
+}
+
+/* all 'len' bytes at 'offset' of 'fd'; returns 0 or 1 */
+static int
+read_at (int fd, void *buf, size_t len, uint64_t offset)
+{
+  unsigned char *p = buf;
+  ssize_t got;
+
+  while (len) {
+    if ((got = pread (fd, p, len, offset)) <= 0) {
+      if (got < 0)
+        perror ("archive: cannot read file: ");
+      else
+        fprintf (stderr, "archive: file shrank while being read\n");
+      return 1;
+    }
+    p += got;
+    offset += got;
+    len -= got;
+  }
+  return 0;
+}
+
+
+static int
+writer_setup (struct golomb_archive_writer *w, const char *path,
+    const char *mode)
+{
+  memset (w, 0, sizeof (*w));
+  if ( !(w->f = fopen (path, mode)) ) {
+    perror ("archive: cannot open file: ");
+    return 1;
+  }
+  return 0;
+}
+
+
+/*
+ * Start a new archive at 'path', replacing whatever is there. Returns
+ * 0 on success, 1 if the file couldn't be written and -1 on bad
+ * arguments.
+ */
+int
+golomb_archive_create (struct golomb_archive_writer *w, const char *path)
+{
+  unsigned char header[GOLOMB_ARCHIVE_HEADER_SIZE] = { 0 };
+
+  if (!w || !path) return -1;
+  if (writer_setup (w, path, "wb")) return 1;
+
+  memcpy (header, GOLOMB_ARCHIVE_MAGIC, 4);
+  header[4] = GOLOMB_ARCHIVE_VERSION;
+  if (fwrite (header, sizeof (header), 1, w->f) != 1) {
+    perror ("archive: cannot write header: ");
+    fclose (w->f);
+    w->f = NULL;
+    return 1;
+  }
+  w->offset = GOLOMB_ARCHIVE_HEADER_SIZE;
+  return 0;
+}
+
+
+/*
+ * Reopen the archive at 'path' to add more filters to it, keeping the
+ * ones it has. Only the header, the trailer and the directory are
+ * read, so this costs the same whatever size the filters add up to.
+ * Returns 0 on success, 1 if the file couldn't be read or
+ * on allocation failure and -1 on bad arguments or if it isn't an
+ * archive.
+ */
+int
+golomb_archive_append (struct golomb_archive_writer *w, const char *path)
+{
+  struct golomb_archive_entry *old = NULL;
+  unsigned char header[GOLOMB_ARCHIVE_HEADER_SIZE];
+  unsigned char trailer[GOLOMB_ARCHIVE_TRAILER_SIZE];
+  unsigned char *buf = NULL;
+  uint64_t dir_offset, count;
+  size_t dir_len, k, n = 0;
+  struct stat st;
+  int fd, ret;
+
+  if (!w || !path) return -1;
+  if (writer_setup (w, path, "r+b")) return 1;
+
+  fd = fileno (w->f);
+  if (fstat (fd, &st)) {
+    perror ("archive: cannot size file: ");
+    ret = 1;
+    goto append_error;
+  }
+  if ((uint64_t) st.st_size < 
+      GOLOMB_ARCHIVE_HEADER_SIZE + GOLOMB_ARCHIVE_TRAILER_SIZE) {
+    ret = -1;
+    goto append_error;
+  }
+  if (read_at (fd, header, sizeof (header), 0) ||
+      read_at (fd, trailer, sizeof (trailer), 
+        st.st_size - GOLOMB_ARCHIVE_TRAILER_SIZE)) {
+    ret = 1;
+    goto append_error;
+  }
+  if (check_ends (header, trailer, st.st_size, &dir_offset, &count)) {
+    ret = -1;
+    goto append_error;
+  }
+
+  /* then the directory alone */
+  dir_len = st.st_size - GOLOMB_ARCHIVE_TRAILER_SIZE - dir_offset;
+  if ( !(buf = malloc (dir_len ? dir_len : 1)) ) {
+    perror ("archive: cannot malloc directory: ");
+    ret = 1;
+    goto append_error;
+  }
+  if (read_at (fd, buf, dir_len, dir_offset)) {
+    ret = 1;
+    goto append_error;
+  }
+  if (archive_crc (buf, dir_len) != get_le32 (trailer + 16)) {
+    ret = -1;
+    goto append_error;
+  }
+  if ( (ret = parse_directory (buf, dir_len, count, dir_offset, &old)) )
+    goto append_error;
+  n = count;
+
+  /* the names point into 'buf', which is going */
+  if ( !(w->entries = calloc (n ? n : 1, sizeof (*w->entries))) ) {
+    perror ("archive: cannot malloc directory: ");
+    ret = 1;
+    goto append_error;
+  }
+  w->room = n ? n : 1;
+  for (k = 0; k < n; ++k) {
+    w->entries[k] = old[k];
+    if ( !(w->entries[k].name = malloc (old[k].name_len + 1)) ) {
+      perror ("archive: cannot malloc name: ");
+      ret = 1;
+      goto append_error;
+    }
+    memcpy ((char*) w->entries[k].name, old[k].name, old[k].name_len);
+    ((char*) w->entries[k].name)[old[k].name_len] = 0;
+    w->n++;
+  }
+
+  /* new filters go over the old directory */
+  if (fseeko (w->f, dir_offset, SEEK_SET)) {
+    perror ("archive: cannot seek: ");
+    ret = 1;
+    goto append_error;
+  }
+  w->offset = dir_offset;
+  free (old);
+  free (buf);
+  return 0;
+
+append_error:
+  for (k = 0; k < w->n; ++k)
+    free ((char*) w->entries[k].name);
+  free (w->entries);
+  free (old);
+  free (buf);
+  fclose (w->f);
+  memset (w, 0, sizeof (*w));
+  return ret;
+}
+
+
+/*
+ * Add a golomb_encode output, with the parameter and original size
+ * that came with it, under 'name' (at most GOLOMB_ARCHIVE_MAX_NAME
+ * bytes) and 'id'. Returns 0 on success, 1 if it couldn't be written
+ * or on allocation failure and -1 on bad arguments.
+ */
+int
+golomb_archive_add (struct golomb_archive_writer *w, const char *name,
+    uint64_t id, const void *encoded, size_t encoded_len,
+    uint64_t golomb_param, uint64_t original_size)
+{
+  struct golomb_archive_entry *e, *tmp;
+  size_t name_len;
+  char *copy;
+
+  if (!w || !w->f || !name || (!encoded && encoded_len)) return -1;
+  if ((name_len = strlen (name)) > GOLOMB_ARCHIVE_MAX_NAME) return -1;
+
+  if (w->n == w->room) {
+    if ( !(tmp = realloc (w->entries, sizeof (*tmp) *
+            (w->room ? w->room * 2 : 64))) ) {
+      perror ("archive: cannot malloc directory: ");
+      return 1;
+    }
+    w->entries = tmp;
+    w->room = w->room ? w->room * 2 : 64;
+  }
+  if ( !(copy = malloc (name_len + 1)) ) {
+    perror ("archive: cannot malloc name: ");
+    return 1;
+  }
+  memcpy (copy, name, name_len + 1);
+
+  if (encoded_len && fwrite (encoded, encoded_len, 1, w->f) != 1) {
+    perror ("archive: cannot write filter: ");
+    free (copy);
+    return 1;
+  }
+
+  e = &w->entries[w->n++];
+  e->id = id;
+  e->offset = w->offset;
+  e->length = encoded_len;
+  e->golomb_param = golomb_param;
+  e->original_size = original_size;
+  e->crc = archive_crc (encoded, encoded_len);
+  e->name = copy;
+  e->name_len = name_len;
+  w->offset += encoded_len;
+  return 0;
+}
+
+
+/*
+ * golomb_encode 'input' and add it; see golomb_archive_add.
+ */
+int
+golomb_archive_add_bitmap (struct golomb_archive_writer *w,
+    const char *name, uint64_t id, const void *input, size_t input_len)
+{
+  void *enc;
+  size_t enc_len;
+  uint64_t param;
+  int ret;
+
+  if (!w || !input) return -1;
+  if ( (ret = golomb_encode (input, input_len, &enc, &enc_len, &param)) )
+    return ret;
+
+  ret = golomb_archive_add (w, name, id, enc, enc_len, param, input_len);
+  free (enc);
+  return ret;
+}
+
+
+/*
+ * Write the directory and trailer and close the file; the writer is
+ * done with either way. Returns 0 on success, 1 if the file couldn't
+ * be written or on allocation failure and -1 on bad arguments.
+ */
+int
+golomb_archive_finish (struct golomb_archive_writer *w)
+{
+  unsigned char *dir = NULL, *p, trailer[GOLOMB_ARCHIVE_TRAILER_SIZE];
+  size_t dir_len = 0, k;
+  int ret = 0;
+
+  if (!w || !w->f) return -1;
+
+  for (k = 0; k < w->n; ++k)
+    dir_len += ARCHIVE_ENTRY_SIZE + w->entries[k].name_len;
+  if ( !(p = dir = malloc (dir_len ? dir_len : 1)) ) {
+    perror ("archive: cannot malloc directory: ");
+    ret = 1;
+    goto finish_done;
+  }
+  for (k = 0; k < w->n; ++k) {
+    put_le64 (p, w->entries[k].id);
+    put_le64 (p + 8, w->entries[k].offset);
+    put_le64 (p + 16, w->entries[k].length);
+    put_le64 (p + 24, w->entries[k].golomb_param);
+    put_le64 (p + 32, w->entries[k].original_size);
+    put_le32 (p + 40, w->entries[k].crc);
+    p[44] = w->entries[k].name_len;
+    p[45] = w->entries[k].name_len >> 8;
+    memcpy (p + ARCHIVE_ENTRY_SIZE, w->entries[k].name,
+        w->entries[k].name_len);
+    p += ARCHIVE_ENTRY_SIZE + w->entries[k].name_len;
+  }
+
+  memset (trailer, 0, sizeof (trailer));
+  put_le64 (trailer, w->offset);
+  put_le64 (trailer + 8, w->n);
+  put_le32 (trailer + 16, archive_crc (dir, dir_len));
+  memcpy (trailer + 28, GOLOMB_ARCHIVE_MAGIC, 4);
+
+  /* an append only ever grows the file, so nothing old is left past
+   * the new trailer */
+  if ((dir_len && fwrite (dir, dir_len, 1, w->f) != 1) ||
+      fwrite (trailer, sizeof (trailer), 1, w->f) != 1 || fflush (w->f)) {
+    perror ("archive: cannot write directory: ");
+    ret = 1;
+  }
+
+finish_done:
+  if (fclose (w->f) && !ret) {
+    perror ("archive: cannot close file: ");
+    ret = 1;
+  }
+  for (k = 0; k < w->n; ++k)
+    free ((char*) w->entries[k].name);
+  free (w->entries);
+  free (dir);
+  memset (w, 0, sizeof (*w));
+  return ret;
+}
+
+
+/* by name, and the newer of two with the same name first */
+static int
+compare_names (const void *a, const void *b)
+{
+  const struct golomb_archive_entry *x = *(struct golomb_archive_entry**) a;
+  const struct golomb_archive_entry *y = *(struct golomb_archive_entry**) b;
+  size_t n = (x->name_len < y->name_len) ? x->name_len : y->name_len;
+  int c;
+
+  if ( (c = memcmp (x->name, y->name, n)) ) return c;
+  if (x->name_len != y->name_len) return (x->name_len < y->name_len) ? -1 : 1;
+  return (x < y) ? 1 : (x > y) ? -1 : 0;
+}
+
+
+/*
+ * Map the archive at 'path' and read its directory. Returns 0 on
+ * success, 1 if it couldn't be mapped or on allocation failure and -1
+ * on bad arguments or if it isn't a good archive.
+ */
+int
+golomb_archive_open (struct golomb_archive *a, const char *path)
+{
+  struct stat st;
+  uint64_t dir_offset;
+  void *base;
+  size_t k;
+  int fd, ret;
+
+  if (!a || !path) return -1;
+  memset (a, 0, sizeof (*a));
+
+  if ((fd = open (path, O_RDONLY)) < 0) {
+    perror ("archive: cannot open file: ");
+    return 1;
+  }
+  if (fstat (fd, &st)) {
+    perror ("archive: cannot stat file: ");
+    close (fd);
+    return 1;
+  }
+  if ((size_t) st.st_size < GOLOMB_ARCHIVE_HEADER_SIZE +
+      GOLOMB_ARCHIVE_TRAILER_SIZE) {
+    close (fd);
+    return -1;
+  }
+  base = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (base == MAP_FAILED) {
+    perror ("archive: cannot mmap file: ");
+    return 1;
+  }
+  a->base = base;
+  a->size = st.st_size;
+
+  if ( (ret = read_archive (a->base, a->size, &a->entries, &a->n,
+          &dir_offset)) ) {
+    golomb_archive_close (a);
+    return ret;
+  }
+
+  if ( !(a->by_name = malloc (sizeof (*a->by_name) * (a->n ? a->n : 1))) ) {
+    perror ("archive: cannot malloc name index: ");
+    golomb_archive_close (a);
+    return 1;
+  }
+  for (k = 0; k < a->n; ++k)
+    a->by_name[k] = &a->entries[k];
+  qsort (a->by_name, a->n, sizeof (*a->by_name), compare_names);
+  return 0;
+}
+
+
+void
+golomb_archive_close (struct golomb_archive *a)
+{
+  if (!a) return;
+
+  if (a->base)
+    munmap ((void*) a->base, a->size);
+  free (a->entries);
+  free (a->by_name);
+  memset (a, 0, sizeof (*a));
+}
+
+
+/*
+ * The newest filter called 'name', or NULL if there's none; a binary
+ * search of the name index.
+ */
+const struct golomb_archive_entry *
+golomb_archive_find (const struct golomb_archive *a, const char *name)
+{
+  const struct golomb_archive_entry *e;
+  size_t lo, hi, mid, len, n;
+  int c;
+
+  if (!a || !name) return NULL;
+  len = strlen (name);
+
+  /* the first entry not before 'name' */
+  lo = 0; hi = a->n;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    e = a->by_name[mid];
+    n = (e->name_len < len) ? e->name_len : len;
+    if ( !(c = memcmp (e->name, name, n)) )
+      c = (e->name_len < len) ? -1 : (e->name_len > len);
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == a->n) return NULL;
+  e = a->by_name[lo];
+  return (e->name_len == len && !memcmp (e->name, name, len)) ? e : NULL;
+}
+
+
+/*
+ * The newest filter with id 'id', or NULL if there's none.
+ */
+const struct golomb_archive_entry *
+golomb_archive_find_id (const struct golomb_archive *a, uint64_t id)
+{
+  size_t k;
+
+  if (!a) return NULL;
+  for (k = a->n; k-- > 0; )
+    if (a->entries[k].id == id)
+      return &a->entries[k];
+  return NULL;
+}
+
+
+/*
+ * Check 'entry's checksum and decode it, reading no other filter.
+ * Returns 0 on success, 1 on allocation failure and -1 on bad
+ * arguments or if the filter is corrupt.
+ */
+int
+golomb_archive_decode (const struct golomb_archive *a,
+    const struct golomb_archive_entry *entry, void **out, size_t *outsize)
+{
+  const unsigned char *data;
+  int ret;
+
+  if (!a || !entry || !out || !outsize) return -1;
+
+  data = a->base + entry->offset;
+  if (archive_crc (data, entry->length) != entry->crc) return -1;
+
+  ret = golomb_decode_safe (data, entry->length, entry->golomb_param,
+      entry->original_size, out, outsize);
+  if (ret == GOLOMB_ERR_NOMEM) return 1;
+  if (ret) return -1;
+  if (*outsize != entry->original_size) {
+    free (*out);
+    return -1;
+  }
+  return 0;
+}
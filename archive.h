@@ -0,0 +1,100 @@
+/*
+ * Archives of many golomb_encode outputs in one file, with a directory
+ * at the end saying where each one is and what it takes to decode it,
+ * in place of a file per filter and a side-car for its parameter. The
+ * archive is opened by mapping it, so finding a filter is a lookup in
+ * the directory and decoding it touches only its own bytes.
+ *
+ * Layout (all integers little endian):
+ *
+ *   header     "GARC", version, 3 reserved bytes
+ *   data       the encoded filters, back to back
+ *   directory  per filter: id (8), offset (8), length (8),
+ *              golomb_param (8), original size (8), crc32 of the
+ *              encoded bytes (4), name length (2), name
+ *   trailer    directory offset (8), number of filters (8), crc32 of
+ *              the directory (4), 8 reserved bytes, "GARC"
+ *
+ * Appending writes the new filters over the old directory and a new
+ * directory after them, so an archive being appended to isn't readable
+ * until golomb_archive_finish. A name added again shadows the older
+ * filter of that name in lookups; both stay in the directory.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __ARCHIVE_H
+#define __ARCHIVE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GOLOMB_ARCHIVE_MAGIC "GARC"
+#define GOLOMB_ARCHIVE_VERSION 1
+#define GOLOMB_ARCHIVE_HEADER_SIZE 8
+#define GOLOMB_ARCHIVE_TRAILER_SIZE 32
+#define GOLOMB_ARCHIVE_MAX_NAME 65535
+
+/* a directory entry; for an opened archive the name points into the
+ * mapping and isn't NUL terminated */
+struct golomb_archive_entry {
+  uint64_t id;
+  uint64_t offset, length;    /* of the encoded bytes in the file */
+  uint64_t golomb_param;
+  uint64_t original_size;     /* bytes golomb_decode gives back */
+  uint32_t crc;
+  const char *name;
+  size_t name_len;
+};
+
+struct golomb_archive_writer {
+  FILE *f;
+  uint64_t offset;            /* where the next filter goes */
+  struct golomb_archive_entry *entries;   /* names malloc'd */
+  size_t n, room;
+};
+
+struct golomb_archive {
+  const unsigned char *base;  /* the mapping */
+  size_t size;
+  struct golomb_archive_entry *entries;
+  size_t n;
+  struct golomb_archive_entry **by_name;  /* newest first among equals */
+};
+
+int
+golomb_archive_create (struct golomb_archive_writer *w, const char *path);
+
+int
+golomb_archive_append (struct golomb_archive_writer *w, const char *path);
+
+int
+golomb_archive_add (struct golomb_archive_writer *w, const char *name,
+    uint64_t id, const void *encoded, size_t encoded_len,
+    uint64_t golomb_param, uint64_t original_size);
+
+int
+golomb_archive_add_bitmap (struct golomb_archive_writer *w,
+    const char *name, uint64_t id, const void *input, size_t input_len);
+
+int
+golomb_archive_finish (struct golomb_archive_writer *w);
+
+int
+golomb_archive_open (struct golomb_archive *a, const char *path);
+
+void
+golomb_archive_close (struct golomb_archive *a);
+
+const struct golomb_archive_entry *
+golomb_archive_find (const struct golomb_archive *a, const char *name);
+
+const struct golomb_archive_entry *
+golomb_archive_find_id (const struct golomb_archive *a, uint64_t id);
+
+int
+golomb_archive_decode (const struct golomb_archive *a,
+    const struct golomb_archive_entry *entry, void **out, size_t *outsize);
+
+#endif /* __ARCHIVE_H */
@@ -0,0 +1,182 @@
+/*
+ * General purpose compressor backends. See backend.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <zlib.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "backend.h"
+
+
+/* zlib streams, as zlib_encode writes and block.c stores */
+static size_t
+zlib_bound (size_t input_len)
+{
+  return compressBound (input_len);
+}
+
+static int
+zlib_backend_encode (const void *input, size_t input_len, void *output,
+    size_t output_room, size_t *output_len, int level)
+{
+  uLongf len = output_room;
+
+  if ((!input && input_len) || !output || !output_len) return -1;
+
+  if (compress2 (output, &len, input, input_len, level) != Z_OK)
+    return 1;
+  *output_len = len;
+  return 0;
+}
+
+static int
+zlib_backend_decode (const void *input, size_t input_len, void *output,
+    size_t output_room, size_t *output_len)
+{
+  uLongf len = output_room;
+
+  if (!input || !output || !output_len) return -1;
+
+  if (uncompress (output, &len, input, input_len) != Z_OK)
+    return 1;
+  *output_len = len;
+  return 0;
+}
+
+
+#ifdef HAVE_LZ4
+/* LZ4 block format; the level is LZ4's acceleration, higher is faster
+ * and bigger */
+static size_t
+lz4_bound (size_t input_len)
+{
+  return (input_len > LZ4_MAX_INPUT_SIZE) ? 0 :
+    (size_t) LZ4_compressBound (input_len);
+}
+
+static int
+lz4_backend_encode (const void *input, size_t input_len, void *output,
+    size_t output_room, size_t *output_len, int level)
+{
+  int len;
+
+  if ((!input && input_len) || !output || !output_len) return -1;
+  if (input_len > LZ4_MAX_INPUT_SIZE) return 1;
+
+  if (output_room > INT_MAX)
+    output_room = INT_MAX;
+  len = LZ4_compress_fast (input, output, input_len, output_room,
+      (level > 1) ? level : 1);
+  if (len <= 0) return 1;
+  *output_len = len;
+  return 0;
+}
+
+static int
+lz4_backend_decode (const void *input, size_t input_len, void *output,
+    size_t output_room, size_t *output_len)
+{
+  int len;
+
+  if (!input || !output || !output_len) return -1;
+  if (input_len > INT_MAX) return 1;
+
+  if (output_room > INT_MAX)
+    output_room = INT_MAX;
+  len = LZ4_decompress_safe (input, output, input_len, output_room);
+  if (len < 0) return 1;
+  *output_len = len;
+  return 0;
+}
+#endif /* HAVE_LZ4 */
+
+
+#ifdef HAVE_ZSTD
+/* zstd frames */
+static size_t
+zstd_bound (size_t input_len)
+{
+  return ZSTD_compressBound (input_len);
+}
+
+static int
+zstd_backend_encode (const void *input, size_t input_len, void *output,
+    size_t output_room, size_t *output_len, int level)
+{
+  size_t len;
+
+  if ((!input && input_len) || !output || !output_len) return -1;
+
+  len = ZSTD_compress (output, output_room, input, input_len, level);
+  if (ZSTD_isError (len)) return 1;
+  *output_len = len;
+  return 0;
+}
+
+static int
+zstd_backend_decode (const void *input, size_t input_len, void *output,
+    size_t output_room, size_t *output_len)
+{
+  size_t len;
+
+  if (!input || !output || !output_len) return -1;
+
+  len = ZSTD_decompress (output, output_room, input, input_len);
+  if (ZSTD_isError (len)) return 1;
+  *output_len = len;
+  return 0;
+}
+#endif /* HAVE_ZSTD */
+
+
+static const struct compress_backend backends[] = {
+  { "zlib", Z_DEFAULT_COMPRESSION, zlib_bound, zlib_backend_encode,
+    zlib_backend_decode },
+#ifdef HAVE_LZ4
+  { "lz4", 1, lz4_bound, lz4_backend_encode, lz4_backend_decode },
+#endif
+#ifdef HAVE_ZSTD
+  { "zstd", 3, zstd_bound, zstd_backend_encode, zstd_backend_decode },
+#endif
+};
+
+#define NBACKENDS (sizeof (backends) / sizeof (backends[0]))
+
+
+/*
+ * The backend called 'name' ("zlib", "lz4" or "zstd"), or NULL if it
+ * wasn't built in.
+ */
+const struct compress_backend *
+compress_backend_find (const char *name)
+{
+  size_t i;
+
+  if (!name) return NULL;
+
+  for (i = 0; i < NBACKENDS; ++i)
+    if (!strcmp (backends[i].name, name))
+      return &backends[i];
+  return NULL;
+}
+
+/*
+ * The i'th backend built in, zlib first, or NULL past the last one;
+ * for going through all of them.
+ */
+const struct compress_backend *
+compress_backend_get (size_t i)
+{
+  return (i < NBACKENDS) ? &backends[i] : NULL;
+}
@@ -0,0 +1,42 @@
+/*
+ * General purpose compressors behind one interface, for the blocks
+ * Golomb coding doesn't suit (dense or structured residue) and for
+ * benchmarking against it. Each backend is a table of bound, encode
+ * and decode functions working on caller buffers: encode writes at
+ * most bound (input_len) bytes, and decode needs to be told how much
+ * room the output has, which for a block is its known original size.
+ * Outputs carry no size or name of their own; whoever stores them
+ * records which backend made them.
+ *
+ * zlib is always there. LZ4 and zstd are built in with HAVE_LZ4 and
+ * HAVE_ZSTD, which the Makefile sets when their headers are installed.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __BACKEND_H
+#define __BACKEND_H
+
+#include <stddef.h>
+
+struct compress_backend {
+  const char *name;
+  int default_level;          /* in the backend's own scale */
+
+  size_t (*bound) (size_t input_len);
+
+  /* 0 on success, 1 if the output didn't fit or the codec failed, -1
+   * on bad arguments */
+  int (*encode) (const void *input, size_t input_len, void *output,
+      size_t output_room, size_t *output_len, int level);
+  int (*decode) (const void *input, size_t input_len, void *output,
+      size_t output_room, size_t *output_len);
+};
+
+const struct compress_backend *
+compress_backend_find (const char *name);
+
+const struct compress_backend *
+compress_backend_get (size_t i);
+
+#endif /* __BACKEND_H */
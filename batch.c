@@ -0,0 +1,633 @@
+/*
+ * Batch Golomb coding of many small buffers. See batch.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "encode.h"
+#include "batch.h"
+#include "pack.h"
+
+#if defined (__x86_64__) && defined (__GNUC__)
+#include <immintrin.h>
+#define BATCH_SIMD 1
+#endif
+
+/* arena bytes to start a batch (or a thread's share of one) with */
+#define BATCH_ARENA_MIN 4096
+
+/* the RLE's all-ones marker char */
+#define BATCH_SENTINEL 8
+
+/* inputs the AVX-512 kernel codes side by side, one per 64 bit lane */
+#define BATCH_LANES 8
+
+/* the kernel golomb_encode_batch uses; GOLOMB_BATCH_AUTO until the
+ * first batch (or golomb_encode_batch_kernel) picks one. Batches on
+ * other threads may be reading it, so it's only touched atomically */
+static int batch_kernel = GOLOMB_BATCH_AUTO;
+
+/* one thread's share of a batch: a run of inputs and its own arena */
+struct batch_job {
+  const struct golomb_buffer *inputs;
+  size_t n;
+  size_t *offsets;              /* n + 1, into this job's arena */
+  int own_offsets;
+  uint64_t *params;
+  unsigned char *arena;
+  size_t arena_len, arena_size;
+  uint64_t *gaps;
+  size_t gaps_size;
+  unsigned char *lane_out;      /* the lanes' outputs, before the arena */
+  size_t lane_out_size;
+  int kernel;
+  int ret;
+};
+
+
+/* make room for 'need' more zeroed bytes at the end of the arena */
+static int
+arena_reserve (struct batch_job *job, size_t need)
+{
+  unsigned char *tmp;
+  size_t size = job->arena_size ? job->arena_size : BATCH_ARENA_MIN;
+
+  if (job->arena_len + need <= job->arena_size) return 0;
+
+  while (size < job->arena_len + need)
+    size *= 2;
+  if ( !(tmp = realloc (job->arena, size)) ) {
+    perror ("batch encode: cannot realloc arena: ");
+    return 1;
+  }
+  memset (tmp + job->arena_size, 0, size - job->arena_size);
+  job->arena = tmp;
+  job->arena_size = size;
+  return 0;
+}
+
+
+/*
+ * Code one input onto the end of the job's arena. The gaps golomb_encode
+ * gets from its RLE are the gaps between the set bits (or the clear
+ * bits of a dense input) followed by those of the all-ones marker, so
+ * take them from the bitmap directly into the reused scratch.
+ */
+static int
+encode_one (struct batch_job *job, const unsigned char *in, size_t len,
+    size_t i)
+{
+  uint64_t b, bits, bitpos, nbits, last, *tmp;
+  size_t ones, n, k;
+  int flip;
+
+  ones = num_set_bits (in, len);
+  nbits = (uint64_t) len * 8;
+  flip = ones > nbits / 2;
+  if (flip)
+    ones = nbits - ones;
+  b = golomb_optimal_param (ones, nbits);
+
+  if (ones + BATCH_SENTINEL > job->gaps_size) {
+    if ( !(tmp = realloc (job->gaps, sizeof (uint64_t) * 
+            (ones + BATCH_SENTINEL))) ) {
+      perror ("batch encode: cannot realloc gaps: ");
+      return 1;
+    }
+    job->gaps = tmp;
+    job->gaps_size = ones + BATCH_SENTINEL;
+  }
+
+  n = flip ? get_clear_bit_gaps (in, len, job->gaps) : 
+    get_set_bit_gaps (in, len, job->gaps);
+  for (k = 0, last = 0; k < n; ++k)
+    last += job->gaps[k];
+  job->gaps[n++] = nbits + 1 - last;
+  for (k = 1; k < BATCH_SENTINEL; ++k)
+    job->gaps[n++] = 1;
+
+  bits = golomb_gaps_bits (job->gaps, n, b);
+  if (arena_reserve (job, (bits >> 3) + 1)) return 1;
+
+  bitpos = 0;
+  golomb_encode_gaps (job->gaps, n, b, job->arena + job->arena_len,
+      &bitpos);
+
+  /* like golomb_encode, keep whole bytes only, and clear the partial
+   * one for the next input to be coded over */
+  job->arena_len += bitpos >> 3;
+  job->arena[job->arena_len] = 0;
+  job->offsets[i + 1] = job->arena_len;
+  job->params[i] = flip ? (b | GOLOMB_PARAM_COMPLEMENT) : b;
+  return 0;
+}
+
+
+#ifdef BATCH_SIMD
+
+/*
+ * Multi-buffer coding: up to BATCH_LANES inputs are coded at once, each
+ * in its own lane of a vector register, the way multi-buffer hashing
+ * runs independent messages through one set of instructions. Every
+ * step takes each lane's next set bit (of the complement, for a dense
+ * input) out of a 64 bit input word, turns its gap into a Golomb code
+ * word and appends that to a 64 bit output accumulator. Whole bytes
+ * of an accumulator are stored when the next code word wouldn't fit.
+ * The input is read as if followed by golomb_encode's all-ones marker
+ * char, so the outputs come out byte for byte the same.
+ *
+ * The vector loop leaves the rare cases to lane_step_scalar: the last
+ * word or two of an input, where the marker comes in, and code words
+ * too long for the accumulator.
+ */
+
+/* lane state, a vector's worth of each field */
+struct lanes {
+  uint64_t word[BATCH_LANES];   /* the input word's bits not coded yet */
+  uint64_t wpos[BATCH_LANES];   /* bit offset of that word */
+  uint64_t last[BATCH_LANES];   /* position of the last bit coded */
+  uint64_t end[BATCH_LANES];    /* that of the marker's last bit */
+  uint64_t acc[BATCH_LANES];    /* output bits not stored yet, MSB first */
+  uint64_t accn[BATCH_LANES];
+  uint64_t out[BATCH_LANES];    /* where they go, as an address */
+  uint64_t in[BATCH_LANES];     /* the input, as an address */
+  int64_t limit[BATCH_LANES];   /* last byte a whole word is read at */
+  uint64_t flip[BATCH_LANES];
+  uint64_t b[BATCH_LANES];
+  uint64_t log2_b[BATCH_LANES];
+  uint64_t d[BATCH_LANES];
+  double binv[BATCH_LANES];
+  uint64_t len[BATCH_LANES];
+  unsigned active;
+} __attribute__ ((aligned (64)));
+
+static __attribute__ ((target ("popcnt"))) uint64_t
+count_ones (const unsigned char *in, size_t len)
+{
+  uint64_t w, count = 0;
+  size_t i;
+
+  for (i = 0; i + 8 <= len; i += 8) {
+    memcpy (&w, in + i, 8);
+    count += __builtin_popcountll (w);
+  }
+  return count + num_set_bits (in + i, len - i);
+}
+
+/* lane i's input word at byte 'off', MSB first, with the marker after
+ * the input and zeros after that */
+static uint64_t
+lane_word (const struct lanes *s, int i, uint64_t off)
+{
+  const unsigned char *in = (const unsigned char*) s->in[i];
+  uint64_t w = 0;
+  int k;
+
+  for (k = 0; k < 8; ++k, ++off)
+    w = (w << 8) | ((off < s->len[i]) ? 
+        (unsigned char) (in[off] ^ s->flip[i]) : (off == s->len[i]) ? 255 : 0);
+  return w;
+}
+
+/* append 'nbits' (up to 56) bits to lane i's output */
+static void
+lane_put (struct lanes *s, int i, uint64_t v, int nbits)
+{
+  unsigned char *out = (unsigned char*) s->out[i];
+
+  for (; s->accn[i] >= 8; s->accn[i] -= 8) {
+    *out++ = s->acc[i] >> 56;
+    s->acc[i] <<= 8;
+  }
+  s->out[i] = (uint64_t) out;
+  if (nbits)
+    s->acc[i] |= v << (64 - s->accn[i] - nbits);
+  s->accn[i] += nbits;
+}
+
+/* code lane i's next bit the slow way */
+static void
+lane_step_scalar (struct lanes *s, int i)
+{
+  uint64_t pos, gap, q, r, v;
+  int lz, nbits;
+
+  while (!s->word[i]) {
+    s->wpos[i] += 64;
+    s->word[i] = lane_word (s, i, s->wpos[i] >> 3);
+  }
+  lz = __builtin_clzll (s->word[i]);
+  s->word[i] &= ~((1ULL << 63) >> lz);
+  pos = s->wpos[i] + lz + 1;
+  gap = pos - s->last[i];
+  s->last[i] = pos;
+
+  q = (gap - 1) / s->b[i];
+  r = gap - q * s->b[i];
+  for (; q >= 32; q -= 32)
+    lane_put (s, i, 0xffffffff, 32);
+  lane_put (s, i, ((1ULL << q) - 1) << 1, q + 1);
+
+  if (r > s->d[i]) {
+    v = r - 1 + s->d[i];
+    nbits = s->log2_b[i];
+  } else {
+    v = r - 1;
+    nbits = s->log2_b[i] - 1;
+  }
+  if (nbits > 32) {
+    lane_put (s, i, v >> 32, nbits - 32);
+    v &= 0xffffffff;
+    nbits = 32;
+  }
+  lane_put (s, i, v, nbits);
+}
+
+/*
+ * Step every active lane one code word at a time until one of them
+ * finishes or needs lane_step_scalar. Returns the lanes that need it.
+ */
+static __attribute__ ((target ("avx512f,avx512cd,avx512dq,avx512bw"))) 
+unsigned
+lanes_run_avx512 (struct lanes *s)
+{
+  const __m512i zero = _mm512_setzero_si512 ();
+  const __m512i one = _mm512_set1_epi64 (1);
+  const __m512i seven = _mm512_set1_epi64 (7);
+  const __m512i c64 = _mm512_set1_epi64 (64);
+  const __m512i msb = _mm512_set1_epi64 (1ULL << 63);
+  /* big endian, so that byte 0 is the accumulator's top byte */
+  const __m512i bswap = _mm512_set4_epi32 (0x08090a0b, 0x0c0d0e0f, 
+      0x00010203, 0x04050607);
+  const __m512i end = _mm512_load_si512 (s->end);
+  const __m512i in = _mm512_load_si512 (s->in);
+  const __m512i limit = _mm512_load_si512 (s->limit);
+  const __m512i flip = _mm512_load_si512 (s->flip);
+  const __m512i b = _mm512_load_si512 (s->b);
+  const __m512i log2_b = _mm512_load_si512 (s->log2_b);
+  const __m512i d = _mm512_load_si512 (s->d);
+  const __m512d binv = _mm512_load_pd (s->binv);
+  __m512i word = _mm512_load_si512 (s->word);
+  __m512i wpos = _mm512_load_si512 (s->wpos);
+  __m512i last = _mm512_load_si512 (s->last);
+  __m512i acc = _mm512_load_si512 (s->acc);
+  __m512i accn = _mm512_load_si512 (s->accn);
+  __m512i out = _mm512_load_si512 (s->out);
+  __m512i nw, off, w, lz, pos, gap, q, r, nbits, v, len, code, nb;
+  __mmask8 active = s->active, z, m, slow = 0;
+
+  for (;;) {
+    /* lanes that have coded all of their word read the next one */
+    z = _mm512_mask_cmpeq_epi64_mask (active, word, zero);
+    while (z) {
+      nw = _mm512_add_epi64 (wpos, c64);
+      off = _mm512_srli_epi64 (nw, 3);
+      if ( (slow = _mm512_mask_cmpgt_epi64_mask (z, off, limit)) )
+        goto done;
+      wpos = _mm512_mask_mov_epi64 (wpos, z, nw);
+      w = _mm512_mask_i64gather_epi64 (zero, z, 
+          _mm512_add_epi64 (in, off), NULL, 1);
+      w = _mm512_xor_si512 (_mm512_shuffle_epi8 (w, bswap), flip);
+      word = _mm512_mask_mov_epi64 (word, z, w);
+      z = _mm512_mask_cmpeq_epi64_mask (z, word, zero);
+    }
+
+    lz = _mm512_lzcnt_epi64 (word);
+    pos = _mm512_add_epi64 (_mm512_add_epi64 (wpos, lz), one);
+    gap = _mm512_sub_epi64 (pos, last);
+
+    /* q = (gap - 1) / b from a double, which can be one off either
+     * way, and put right with the remainder */
+    q = _mm512_cvttpd_epu64 (_mm512_mul_pd (
+          _mm512_cvtepu64_pd (_mm512_sub_epi64 (gap, one)), binv));
+    r = _mm512_sub_epi64 (gap, _mm512_mullo_epi64 (q, b));
+    m = _mm512_cmple_epi64_mask (r, zero);
+    q = _mm512_mask_sub_epi64 (q, m, q, one);
+    r = _mm512_mask_add_epi64 (r, m, r, b);
+    m = _mm512_cmpgt_epu64_mask (r, b);
+    q = _mm512_mask_add_epi64 (q, m, q, one);
+    r = _mm512_mask_sub_epi64 (r, m, r, b);
+
+    /* q ones, a zero and the minimal binary remainder */
+    m = _mm512_cmpgt_epu64_mask (r, d);
+    nbits = _mm512_mask_mov_epi64 (_mm512_sub_epi64 (log2_b, one), m, 
+        log2_b);
+    v = _mm512_mask_add_epi64 (_mm512_sub_epi64 (r, one), m, 
+        _mm512_sub_epi64 (r, one), d);
+    len = _mm512_add_epi64 (_mm512_add_epi64 (q, one), nbits);
+    code = _mm512_or_si512 (_mm512_sllv_epi64 (
+          _mm512_sub_epi64 (_mm512_sllv_epi64 (one, q), one),
+          _mm512_add_epi64 (nbits, one)), v);
+
+    /* store the whole bytes of accumulators the code word won't fit
+     * in; if it still won't, the lane goes the slow way */
+    m = _mm512_mask_cmpgt_epu64_mask (active, 
+        _mm512_add_epi64 (accn, len), c64);
+    if (m) {
+      _mm512_mask_i64scatter_epi64 (NULL, m, out, 
+          _mm512_shuffle_epi8 (acc, bswap), 1);
+      nb = _mm512_srli_epi64 (accn, 3);
+      out = _mm512_mask_add_epi64 (out, m, out, nb);
+      acc = _mm512_mask_mov_epi64 (acc, m, 
+          _mm512_sllv_epi64 (acc, _mm512_slli_epi64 (nb, 3)));
+      accn = _mm512_mask_and_epi64 (accn, m, accn, seven);
+      if ( (slow = _mm512_mask_cmpgt_epu64_mask (m, 
+              _mm512_add_epi64 (accn, len), c64)) )
+        goto done;
+    }
+
+    acc = _mm512_mask_or_epi64 (acc, active, acc, _mm512_sllv_epi64 (code,
+          _mm512_sub_epi64 (_mm512_sub_epi64 (c64, accn), len)));
+    accn = _mm512_mask_add_epi64 (accn, active, accn, len);
+    last = _mm512_mask_mov_epi64 (last, active, pos);
+    word = _mm512_mask_andnot_epi64 (word, active, 
+        _mm512_srlv_epi64 (msb, lz), word);
+
+    if (_mm512_mask_cmpeq_epi64_mask (active, last, end))
+      goto done;
+  }
+
+done:
+  _mm512_store_si512 (s->word, word);
+  _mm512_store_si512 (s->wpos, wpos);
+  _mm512_store_si512 (s->last, last);
+  _mm512_store_si512 (s->acc, acc);
+  _mm512_store_si512 (s->accn, accn);
+  _mm512_store_si512 (s->out, out);
+  return slow;
+}
+
+/* make room for 'need' bytes of lane outputs */
+static int
+lane_out_reserve (struct batch_job *job, size_t need)
+{
+  unsigned char *tmp;
+
+  if (need <= job->lane_out_size) return 0;
+  if ( !(tmp = realloc (job->lane_out, need)) ) {
+    perror ("batch encode: cannot realloc lane outputs: ");
+    return 1;
+  }
+  job->lane_out = tmp;
+  job->lane_out_size = need;
+  return 0;
+}
+
+/* code inputs i to i + n - 1 (n up to BATCH_LANES) side by side, and
+ * append them to the arena in order */
+static int
+encode_lanes (struct batch_job *job, size_t i, size_t n)
+{
+  const struct golomb_buffer *input;
+  struct lanes s;
+  size_t bound[BATCH_LANES], start[BATCH_LANES], total = 0, len;
+  uint64_t nbits, ones;
+  unsigned slow;
+  int k;
+
+  memset (&s, 0, sizeof (s));
+  for (k = 0; k < n; ++k) {
+    input = &job->inputs[i + k];
+    if (!input->data) return -1;
+
+    ones = count_ones ((const unsigned char*) input->data, input->len);
+    nbits = (uint64_t) input->len * 8;
+    s.flip[k] = (ones > nbits / 2) ? ~0ULL : 0;
+    if (s.flip[k])
+      ones = nbits - ones;
+    s.b[k] = golomb_optimal_param (ones, nbits);
+    s.log2_b[k] = ceil_log2 (s.b[k]);
+    s.d[k] = (1ULL << s.log2_b[k]) - s.b[k];
+    s.binv[k] = 1.0 / s.b[k];
+
+    s.in[k] = (uint64_t) input->data;
+    s.len[k] = input->len;
+    s.limit[k] = (int64_t) input->len - 8;
+    s.wpos[k] = -64;
+    s.end[k] = nbits + BATCH_SENTINEL;
+
+    /* q adds up to at most the bits over b, and there's a one and
+     * log2 (b) bits of remainder per code word; the vector stores
+     * write up to 8 bytes ahead */
+    bound[k] = ((nbits + BATCH_SENTINEL) / s.b[k] + (ones + BATCH_SENTINEL) *
+        (s.log2_b[k] + 1)) / 8 + 16;
+    start[k] = total;
+    total += bound[k];
+    s.active |= 1u << k;
+  }
+
+  if (lane_out_reserve (job, total)) return 1;
+  for (k = 0; k < n; ++k)
+    s.out[k] = (uint64_t) (job->lane_out + start[k]);
+
+  while (s.active) {
+    slow = lanes_run_avx512 (&s);
+    for (k = 0; k < n; ++k) {
+      if (slow & (1u << k))
+        lane_step_scalar (&s, k);
+      if ((s.active & (1u << k)) && s.last[k] == s.end[k]) {
+        /* only whole bytes are kept, like golomb_encode does */
+        lane_put (&s, k, 0, 0);
+        s.active &= ~(1u << k);
+      }
+    }
+  }
+
+  for (k = 0; k < n; ++k) {
+    len = (unsigned char*) s.out[k] - (job->lane_out + start[k]);
+    if (arena_reserve (job, len + 1)) return 1;
+    memcpy (job->arena + job->arena_len, job->lane_out + start[k], len);
+    job->arena_len += len;
+    job->offsets[i + k + 1] = job->arena_len;
+    job->params[i + k] = s.flip[k] ? (s.b[k] | GOLOMB_PARAM_COMPLEMENT) : 
+      s.b[k];
+  }
+  return 0;
+}
+
+#endif /* BATCH_SIMD */
+
+
+static void *
+batch_worker (void *arg)
+{
+  struct batch_job *job = (struct batch_job*) arg;
+  size_t i, n;
+
+  job->offsets[0] = 0;
+  job->ret = arena_reserve (job, 1);
+  for (i = 0; i < job->n && !job->ret; i += n) {
+    n = 1;
+#ifdef BATCH_SIMD
+    if (job->kernel == GOLOMB_BATCH_AVX512) {
+      n = (job->n - i < BATCH_LANES) ? job->n - i : BATCH_LANES;
+      job->ret = encode_lanes (job, i, n);
+      continue;
+    }
+#endif
+    if (!job->inputs[i].data)
+      job->ret = -1;
+    else
+      job->ret = encode_one (job, (const unsigned char*) 
+          job->inputs[i].data, job->inputs[i].len, i);
+  }
+  return NULL;
+}
+
+
+/* the widest kernel this CPU runs, checked at run time so one build
+ * runs anywhere */
+static int
+best_kernel (void)
+{
+  int best = GOLOMB_BATCH_SCALAR;
+
+#ifdef BATCH_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx512f") && 
+      __builtin_cpu_supports ("avx512cd") &&
+      __builtin_cpu_supports ("avx512dq") &&
+      __builtin_cpu_supports ("avx512bw") && 
+      __builtin_cpu_supports ("popcnt"))
+    best = GOLOMB_BATCH_AVX512;
+#endif
+
+  return best;
+}
+
+/*
+ * Pick the kernel golomb_encode_batch codes with: GOLOMB_BATCH_SCALAR,
+ * or GOLOMB_BATCH_AUTO for the widest one this CPU runs. Batches
+ * already under way keep the kernel they started with. Returns the
+ * kernel picked.
+ */
+int
+golomb_encode_batch_kernel (int kernel)
+{
+  kernel = (kernel == GOLOMB_BATCH_SCALAR) ? kernel : best_kernel ();
+  __atomic_store_n (&batch_kernel, kernel, __ATOMIC_RELAXED);
+  return kernel;
+}
+
+
+/*
+ * Golomb code 'n' inputs. The outputs go one after another in
+ * '*arena' ('*arena_len' bytes in all, malloc'd; free it once);
+ * output i is the bytes from offsets[i] up to offsets[i + 1], and is
+ * decoded by golomb_decode with params[i]. 'offsets' needs room for
+ * n + 1 entries. With 'nthreads' over 1 the inputs are split into
+ * that many runs, each coded by its own thread into its own arena,
+ * and the arenas joined at the end. Returns 0 on success, 1 on
+ * allocation (or thread) failure and -1 on bad arguments.
+ */
+int
+golomb_encode_batch (const struct golomb_buffer *inputs, size_t n,
+    int nthreads, void **arena, size_t *arena_len, size_t *offsets,
+    uint64_t *params)
+{
+  struct batch_job one, *jobs = &one;
+  pthread_t *threads = NULL;
+  unsigned char *out;
+  size_t njobs, j, k, start, base;
+  int ret = 0, kernel, best;
+
+  if (!inputs || !arena || !arena_len || !offsets || !params) return -1;
+
+  /* the first batch picks the kernel, unless golomb_encode_batch_kernel
+   * got there first */
+  kernel = __atomic_load_n (&batch_kernel, __ATOMIC_RELAXED);
+  if (kernel == GOLOMB_BATCH_AUTO) {
+    best = best_kernel ();
+    kernel = __atomic_compare_exchange_n (&batch_kernel, &kernel, best, 0,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED) ? best : kernel;
+  }
+
+  njobs = (nthreads > 1) ? (size_t) nthreads : 1;
+  if (njobs > n) njobs = n ? n : 1;
+
+  if (njobs > 1 && 
+      (!(jobs = calloc (njobs, sizeof (*jobs))) ||
+       !(threads = malloc (sizeof (pthread_t) * njobs))) ) {
+    perror ("batch encode: cannot malloc jobs: ");
+    if (jobs != &one) free (jobs);
+    return 1;
+  }
+  memset (&one, 0, sizeof (one));
+
+  /* with threads, each job gets its own offsets table, rebased onto
+   * the joined arena at the end */
+  for (j = 0, start = 0; j < njobs; ++j) {
+    jobs[j].inputs = inputs + start;
+    jobs[j].n = n / njobs + (j < n % njobs);
+    jobs[j].params = params + start;
+    jobs[j].kernel = kernel;
+    if (njobs == 1) {
+      jobs[j].offsets = offsets;
+    } else if ( (jobs[j].offsets = malloc (sizeof (size_t) * 
+            (jobs[j].n + 1))) ) {
+      jobs[j].own_offsets = 1;
+    } else {
+      perror ("batch encode: cannot malloc offsets: ");
+      ret = 1;
+      goto done;
+    }
+    start += jobs[j].n;
+  }
+
+  if (njobs == 1) {
+    batch_worker (&jobs[0]);
+  } else {
+    for (j = 0; j < njobs; ++j) {
+      if (pthread_create (&threads[j], NULL, batch_worker, &jobs[j])) {
+        jobs[j].ret = 1;
+        break;
+      }
+    }
+    for (k = 0; k < j; ++k)
+      pthread_join (threads[k], NULL);
+  }
+
+  for (j = 0; j < njobs && !ret; ++j)
+    ret = jobs[j].ret;
+  if (ret) goto done;
+
+  if (njobs == 1) {
+    out = jobs[0].arena;
+    jobs[0].arena = NULL;
+  } else {
+    for (j = 0, base = 0; j < njobs; ++j)
+      base += jobs[j].arena_len;
+    if ( !(out = malloc (base ? base : 1)) ) {
+      perror ("batch encode: cannot malloc arena: ");
+      ret = 1;
+      goto done;
+    }
+    for (j = 0, base = 0, start = 0; j < njobs; ++j) {
+      memcpy (out + base, jobs[j].arena, jobs[j].arena_len);
+      for (k = 1; k <= jobs[j].n; ++k)
+        offsets[start + k] = jobs[j].offsets[k] + base;
+      base += jobs[j].arena_len;
+      start += jobs[j].n;
+    }
+  }
+
+  offsets[0] = 0;
+  *arena = out;
+  *arena_len = offsets[n];
+
+done:
+  for (j = 0; j < njobs; ++j) {
+    free (jobs[j].arena);
+    free (jobs[j].gaps);
+    free (jobs[j].lane_out);
+    if (jobs[j].own_offsets) free (jobs[j].offsets);
+  }
+  if (jobs != &one) free (jobs);
+  free (threads);
+  return ret;
+}
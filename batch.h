@@ -0,0 +1,39 @@
+/*
+ * Golomb coding many small buffers in one call. golomb_encode_batch
+ * produces the same bytes and parameter for each input as
+ * golomb_encode, but reuses one scratch buffer across the inputs,
+ * skips the RLE pass (the gaps come straight from the bitmap), and
+ * writes every output into one contiguous arena, with an offsets
+ * table saying where each one starts. The batch can be split across
+ * threads, and on CPUs with AVX-512 eight inputs at a time are coded
+ * side by side in the lanes of a vector register.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* one input to golomb_encode_batch */
+struct golomb_buffer {
+  const void *data;
+  size_t len;
+};
+
+/* kernels for golomb_encode_batch_kernel */
+#define GOLOMB_BATCH_AUTO -1
+#define GOLOMB_BATCH_SCALAR 0
+#define GOLOMB_BATCH_AVX512 1   /* 8 inputs at a time */
+
+int
+golomb_encode_batch_kernel (int kernel);
+
+int
+golomb_encode_batch (const struct golomb_buffer *inputs, size_t n,
+    int nthreads, void **arena, size_t *arena_len, size_t *offsets,
+    uint64_t *params);
+
+#endif /* __BATCH_H */
@@ -0,0 +1,709 @@
+/*
+ * Throughput benchmark for golomb_encode/golomb_decode on random
+ * bitmaps of a few densities, next to the general purpose backends
+ * on the same bitmaps, of golomb_encode_batch against a
+ * golomb_encode loop on many small filters, of golomb_decode_many
+ * against a golomb_decode loop, of golomb_decode_parallel and
+ * golomb_decoder_feed against golomb_decode on one large stream, and
+ * of zlib_encode_parallel against zlib_encode. Run with 'big' to also
+ * round trip a sparse bitmap of more than 2^31 bits.
+ *
+ * Run with 'perf' instead to time golomb_encode, golomb_decode and
+ * get_run_length_encoding on their own, reading the CPU's cycle,
+ * instruction, branch miss and cache miss counters (perf_event_open)
+ * around each, per input byte and per set bit. The counters are read
+ * as one group, so IPC and the ratios come from the same window; if
+ * the group can't be scheduled each is read on its own. Counters the
+ * kernel won't give (in a container, say) are left out and it falls
+ * back on the time alone.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "encode.h"
+#include "batch.h"
+#include "parallel.h"
+#include "stream.h"
+#include "backend.h"
+#include "test_util.h"
+
+#define BENCH_SIZE 65536
+#define BENCH_REPS 200
+#define BIG_SIZE ((size_t) 300 << 20)   /* 300 MB, ~2.5 billion bits */
+#define SMALL_COUNT 20000                /* 1 to 8 KB filters */
+#define MANY_COUNT 256                   /* streams decoded together */
+#define MANY_SIZE 8192
+#define MANY_REPS 20
+#define PARALLEL_SIZE ((size_t) 32 << 20)
+#define STREAM_SIZE ((size_t) 1 << 20)
+#define STREAM_PACKET 1460                /* a TCP segment's payload */
+#define STREAM_WINDOW 65536
+#define STREAM_REPS 20
+#define PERF_REPS 100
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+bench_density (unsigned char *in, int permille)
+{
+  void *ge, *gd;
+  size_t ge_size, gd_size;
+  uint64_t b;
+  double t, te, td;
+  int r;
+
+  fill_random (in, BENCH_SIZE, permille);
+
+  t = now ();
+  for (r = 0; r < BENCH_REPS; ++r) {
+    if (golomb_encode (in, BENCH_SIZE, &ge, &ge_size, &b)) return 1;
+    if (r < BENCH_REPS - 1) free (ge);
+  }
+  te = now () - t;
+
+  t = now ();
+  for (r = 0; r < BENCH_REPS; ++r) {
+    if (golomb_decode (ge, ge_size, b, &gd, &gd_size)) return 1;
+    if (r < BENCH_REPS - 1) free (gd);
+  }
+  td = now () - t;
+
+  if (gd_size != BENCH_SIZE || memcmp (gd, in, BENCH_SIZE)) {
+    printf ("round trip failed at density %d/1000\n", permille);
+    return 1;
+  }
+
+  printf ("density %5.1f%%: encode %7.1f MB/s, decode %7.1f MB/s "
+      "(%d -> %zu bytes, b = %llu)\n", permille / 10.0,
+      (double) BENCH_SIZE * BENCH_REPS / te / 1e6,
+      (double) BENCH_SIZE * BENCH_REPS / td / 1e6,
+      BENCH_SIZE, ge_size, (unsigned long long) b);
+
+  free (ge);
+  free (gd);
+  return 0;
+}
+
+/* the same bitmap through each general purpose backend, for setting
+ * against bench_density's Golomb line; 'in' is already filled */
+static int
+bench_backends (unsigned char *in, int permille)
+{
+  const struct compress_backend *be;
+  unsigned char *enc, *dec;
+  size_t i, enc_len, dec_len;
+  double t, te, td;
+  int r;
+
+  dec = malloc (BENCH_SIZE);
+  for (i = 0; (be = compress_backend_get (i)); ++i) {
+    enc = malloc (be->bound (BENCH_SIZE));
+
+    t = now ();
+    for (r = 0; r < BENCH_REPS; ++r)
+      if (be->encode (in, BENCH_SIZE, enc, be->bound (BENCH_SIZE), 
+            &enc_len, be->default_level)) 
+        return 1;
+    te = now () - t;
+
+    t = now ();
+    for (r = 0; r < BENCH_REPS; ++r)
+      if (be->decode (enc, enc_len, dec, BENCH_SIZE, &dec_len)) return 1;
+    td = now () - t;
+
+    if (dec_len != BENCH_SIZE || memcmp (dec, in, BENCH_SIZE)) {
+      printf ("%s round trip failed at density %d/1000\n", be->name,
+          permille);
+      return 1;
+    }
+
+    printf ("    %-6s encode %7.1f MB/s, decode %7.1f MB/s "
+        "(%d -> %zu bytes)\n", be->name,
+        (double) BENCH_SIZE * BENCH_REPS / te / 1e6,
+        (double) BENCH_SIZE * BENCH_REPS / td / 1e6,
+        BENCH_SIZE, enc_len);
+    free (enc);
+  }
+
+  free (dec);
+  return 0;
+}
+
+/* many small filters, one call each or one call for all */
+static int
+bench_small (void)
+{
+  struct golomb_buffer *inputs;
+  size_t *offsets, arena_len, ge_size, i, total = 0;
+  uint64_t *params, b;
+  unsigned char *buf;
+  void *arena, *ge;
+  double t, tl, tb;
+
+  inputs = malloc (sizeof (*inputs) * SMALL_COUNT);
+  offsets = malloc (sizeof (size_t) * (SMALL_COUNT + 1));
+  params = malloc (sizeof (uint64_t) * SMALL_COUNT);
+  for (i = 0; i < SMALL_COUNT; ++i) {
+    inputs[i].len = 1024 * (1 + rand () % 8);
+    buf = malloc (inputs[i].len);
+    fill_random (buf, inputs[i].len, 10);
+    inputs[i].data = buf;
+    total += inputs[i].len;
+  }
+
+  t = now ();
+  for (i = 0; i < SMALL_COUNT; ++i) {
+    if (golomb_encode (inputs[i].data, inputs[i].len, &ge, &ge_size, &b))
+      return 1;
+    free (ge);
+  }
+  tl = now () - t;
+
+  golomb_encode_batch_kernel (GOLOMB_BATCH_SCALAR);
+  t = now ();
+  if (golomb_encode_batch (inputs, SMALL_COUNT, 1, &arena, &arena_len, 
+        offsets, params))
+    return 1;
+  tb = now () - t;
+  free (arena);
+
+  printf ("%d small filters (%zu bytes): loop %.0f/s, batch %.0f/s",
+      SMALL_COUNT, total, SMALL_COUNT / tl, SMALL_COUNT / tb);
+
+  if (golomb_encode_batch_kernel (GOLOMB_BATCH_AUTO) != 
+      GOLOMB_BATCH_SCALAR) {
+    t = now ();
+    if (golomb_encode_batch (inputs, SMALL_COUNT, 1, &arena, &arena_len, 
+          offsets, params))
+      return 1;
+    tb = now () - t;
+    free (arena);
+    printf (", vector batch %.0f/s", SMALL_COUNT / tb);
+  }
+  printf ("\n");
+
+  for (i = 0; i < SMALL_COUNT; ++i)
+    free ((void*) inputs[i].data);
+  free (inputs);
+  free (offsets);
+  free (params);
+  return 0;
+}
+
+/* many streams, decoded one after another or interleaved */
+static int
+bench_many (int permille)
+{
+  struct golomb_stream streams[MANY_COUNT];
+  void *outs[MANY_COUNT], *ge;
+  size_t lens[MANY_COUNT], ge_size, i;
+  unsigned char *buf;
+  uint64_t b;
+  double t, ts, tm;
+  int r;
+
+  buf = malloc (MANY_SIZE);
+  for (i = 0; i < MANY_COUNT; ++i) {
+    fill_random (buf, MANY_SIZE, permille);
+    if (golomb_encode (buf, MANY_SIZE, &ge, &ge_size, &b)) return 1;
+    streams[i].data = ge;
+    streams[i].len = ge_size;
+    streams[i].golomb_param = b;
+  }
+  free (buf);
+
+  /* both keep all the outputs until the end of a rep, as a caller
+   * decoding a set of filters would */
+  t = now ();
+  for (r = 0; r < MANY_REPS; ++r) {
+    for (i = 0; i < MANY_COUNT; ++i)
+      if (golomb_decode (streams[i].data, streams[i].len, 
+            streams[i].golomb_param, &outs[i], &lens[i])) 
+        return 1;
+    for (i = 0; i < MANY_COUNT; ++i)
+      free (outs[i]);
+  }
+  ts = now () - t;
+
+  t = now ();
+  for (r = 0; r < MANY_REPS; ++r) {
+    if (golomb_decode_many (streams, MANY_COUNT, outs, lens)) return 1;
+    for (i = 0; i < MANY_COUNT; ++i)
+      free (outs[i]);
+  }
+  tm = now () - t;
+
+  printf ("%d streams at %4.1f%%: golomb_decode %7.1f MB/s, "
+      "golomb_decode_many %7.1f MB/s\n", MANY_COUNT, permille / 10.0,
+      (double) MANY_SIZE * MANY_COUNT * MANY_REPS / ts / 1e6,
+      (double) MANY_SIZE * MANY_COUNT * MANY_REPS / tm / 1e6);
+
+  for (i = 0; i < MANY_COUNT; ++i)
+    free ((void*) streams[i].data);
+  return 0;
+}
+
+/* the hardware counters read in 'perf' mode */
+static const struct {
+  const char *name;
+  uint64_t config;
+} perf_events[] = {
+  { "cycles", PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+  { "branch-misses", PERF_COUNT_HW_BRANCH_MISSES },
+  { "cache-misses", PERF_COUNT_HW_CACHE_MISSES },
+};
+
+#define PERF_NEVENTS (sizeof (perf_events) / sizeof (perf_events[0]))
+#define PERF_CYCLES 0
+#define PERF_INSTRUCTIONS 1
+
+/* an fd per counter, -1 for the ones the kernel wouldn't open; when
+ * 'group' is set they are one group led by cycles, so all of them
+ * count over the same stretch of time */
+struct perf_counters {
+  int fd[PERF_NEVENTS];
+  int group;
+  double count[PERF_NEVENTS];
+};
+
+static int
+perf_open_event (int i, int group_fd, uint64_t read_format)
+{
+  struct perf_event_attr attr;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = perf_events[i].config;
+  attr.disabled = (group_fd < 0);     /* members follow their leader */
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = read_format | PERF_FORMAT_TOTAL_TIME_ENABLED |
+    PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return syscall (__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void
+perf_close (struct perf_counters *pc)
+{
+  int i;
+
+  for (i = 0; i < PERF_NEVENTS; ++i)
+    if (pc->fd[i] >= 0)
+      close (pc->fd[i]);
+}
+
+/* the group's read: the times, then a value per counter */
+struct perf_group_read {
+  uint64_t nr, enabled, running;
+  uint64_t value[PERF_NEVENTS];
+};
+
+/*
+ * Open all the counters as one group, cycles leading, and make sure
+ * the PMU can schedule them together: a group is counted all at once
+ * or not at all. Returns 0, or -1 with nothing left open.
+ */
+static int
+perf_open_group (struct perf_counters *pc)
+{
+  struct perf_group_read g;
+  int i;
+
+  for (i = 0; i < PERF_NEVENTS; ++i)
+    pc->fd[i] = -1;
+  for (i = 0; i < PERF_NEVENTS; ++i)
+    if ((pc->fd[i] = perf_open_event (i, i ? pc->fd[0] : -1, 
+            PERF_FORMAT_GROUP)) < 0)
+      goto group_error;
+
+  ioctl (pc->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl (pc->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  ioctl (pc->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  if (read (pc->fd[0], &g, sizeof (g)) != sizeof (g) || !g.running)
+    goto group_error;
+
+  pc->group = 1;
+  return 0;
+
+group_error:
+  perf_close (pc);
+  for (i = 0; i < PERF_NEVENTS; ++i)
+    pc->fd[i] = -1;
+  return -1;
+}
+
+/* open what counters there are for this thread, user space only, as a
+ * group if they fit in one and each on its own if not; returns how
+ * many */
+static int
+perf_open (struct perf_counters *pc)
+{
+  int i, n = 0, err = 0;
+
+  pc->group = 0;
+  if (!perf_open_group (pc))
+    return PERF_NEVENTS;
+
+  for (i = 0; i < PERF_NEVENTS; ++i) {
+    pc->fd[i] = perf_open_event (i, -1, 0);
+    if (pc->fd[i] >= 0)
+      n++;
+    else
+      err = errno;
+  }
+
+  if (!n)
+    printf ("no hardware counters (%s), timing only\n", strerror (err));
+  else
+    printf ("counters not grouped, each is scaled on its own\n");
+  if (n && n < PERF_NEVENTS)
+    for (i = 0; i < PERF_NEVENTS; ++i)
+      if (pc->fd[i] < 0)
+        printf ("no %s counter\n", perf_events[i].name);
+  return n;
+}
+
+static void
+perf_start (struct perf_counters *pc)
+{
+  int i;
+
+  if (pc->group) {
+    ioctl (pc->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl (pc->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return;
+  }
+
+  for (i = 0; i < PERF_NEVENTS; ++i)
+    if (pc->fd[i] >= 0) {
+      ioctl (pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl (pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/* stop the counters and read them, scaled up for the time they were
+ * multiplexed out; -1 for the ones missing */
+static void
+perf_stop (struct perf_counters *pc)
+{
+  struct perf_group_read g;
+  uint64_t v[3];
+  int i;
+
+  for (i = 0; i < PERF_NEVENTS; ++i)
+    pc->count[i] = -1;
+
+  if (pc->group) {
+    ioctl (pc->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read (pc->fd[0], &g, sizeof (g)) == sizeof (g) && g.running)
+      for (i = 0; i < PERF_NEVENTS; ++i)
+        pc->count[i] = (double) g.value[i] * g.enabled / g.running;
+    return;
+  }
+
+  for (i = 0; i < PERF_NEVENTS; ++i) {
+    if (pc->fd[i] < 0) continue;
+    ioctl (pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read (pc->fd[i], v, sizeof (v)) == sizeof (v) && v[2])
+      pc->count[i] = (double) v[0] * v[1] / v[2];
+  }
+}
+
+/* one stage's time and counters, per input byte and per set bit */
+static void
+perf_report (const char *stage, const struct perf_counters *pc,
+    double secs, double bytes, double setbits)
+{
+  int i;
+
+  printf ("  %-7s %7.2f ns/byte", stage, secs * 1e9 / bytes);
+  if (pc->count[PERF_CYCLES] >= 0 && pc->count[PERF_INSTRUCTIONS] >= 0)
+    printf (", IPC %.2f", 
+        pc->count[PERF_INSTRUCTIONS] / pc->count[PERF_CYCLES]);
+  printf ("\n");
+
+  for (i = 0; i < PERF_NEVENTS; ++i)
+    if (pc->count[i] >= 0)
+      printf ("    %-13s %9.3f per byte %9.3f per set bit\n",
+          perf_events[i].name, pc->count[i] / bytes,
+          pc->count[i] / setbits);
+}
+
+/* the three stages of coding a bitmap of this density, each timed
+ * and counted over PERF_REPS runs */
+static int
+bench_perf (unsigned char *in, int permille, struct perf_counters *pc)
+{
+  void *ge, *gd;
+  uint64_t *rle;
+  size_t ge_size, gd_size, rle_size, i;
+  double t, bytes, setbits = 0;
+  uint64_t b;
+  int r;
+
+  fill_random (in, BENCH_SIZE, permille);
+  for (i = 0; i < BENCH_SIZE; ++i)
+    setbits += __builtin_popcount (in[i]);
+  bytes = (double) BENCH_SIZE * PERF_REPS;
+  setbits *= PERF_REPS;
+  printf ("density %5.1f%%:\n", permille / 10.0);
+
+  t = now ();
+  perf_start (pc);
+  for (r = 0; r < PERF_REPS; ++r) {
+    if (get_run_length_encoding (in, BENCH_SIZE, &rle, &rle_size)) 
+      return 1;
+    free (rle);
+  }
+  perf_stop (pc);
+  perf_report ("rle", pc, now () - t, bytes, setbits);
+
+  t = now ();
+  perf_start (pc);
+  for (r = 0; r < PERF_REPS; ++r) {
+    if (golomb_encode (in, BENCH_SIZE, &ge, &ge_size, &b)) return 1;
+    if (r < PERF_REPS - 1) free (ge);
+  }
+  perf_stop (pc);
+  perf_report ("encode", pc, now () - t, bytes, setbits);
+
+  t = now ();
+  perf_start (pc);
+  for (r = 0; r < PERF_REPS; ++r) {
+    if (golomb_decode (ge, ge_size, b, &gd, &gd_size)) return 1;
+    if (r < PERF_REPS - 1) free (gd);
+  }
+  perf_stop (pc);
+  perf_report ("decode", pc, now () - t, bytes, setbits);
+
+  if (gd_size != BENCH_SIZE || memcmp (gd, in, BENCH_SIZE)) {
+    printf ("round trip failed at density %d/1000\n", permille);
+    return 1;
+  }
+
+  free (ge);
+  free (gd);
+  return 0;
+}
+
+/* one large stream, decoded by one thread or split across several */
+static int
+bench_parallel (int nthreads)
+{
+  unsigned char *in;
+  void *ge, *gd;
+  size_t ge_size, gd_size;
+  uint64_t b;
+  double t, ts, tp;
+
+  in = malloc (PARALLEL_SIZE);
+  fill_random (in, PARALLEL_SIZE, 50);
+  if (golomb_encode (in, PARALLEL_SIZE, &ge, &ge_size, &b)) return 1;
+
+  t = now ();
+  if (golomb_decode (ge, ge_size, b, &gd, &gd_size)) return 1;
+  ts = now () - t;
+  free (gd);
+
+  t = now ();
+  if (golomb_decode_parallel (ge, ge_size, b, nthreads, &gd, &gd_size)) 
+    return 1;
+  tp = now () - t;
+
+  if (gd_size != PARALLEL_SIZE || memcmp (gd, in, PARALLEL_SIZE)) {
+    printf ("parallel round trip failed\n");
+    return 1;
+  }
+
+  printf ("%zu MB at 5.0%%: golomb_decode %7.1f MB/s, "
+      "golomb_decode_parallel (%d threads) %7.1f MB/s\n", 
+      PARALLEL_SIZE >> 20, PARALLEL_SIZE / ts / 1e6, nthreads, 
+      PARALLEL_SIZE / tp / 1e6);
+  free (gd);
+
+  /* and the same bitmap deflated */
+  t = now ();
+  if (zlib_encode (in, PARALLEL_SIZE, &gd, &gd_size, 6)) return 1;
+  ts = now () - t;
+  free (gd);
+
+  t = now ();
+  if (zlib_encode_parallel (in, PARALLEL_SIZE, &gd, &gd_size, 6, nthreads))
+    return 1;
+  tp = now () - t;
+
+  printf ("%zu MB at 5.0%%: zlib_encode %7.1f MB/s, "
+      "zlib_encode_parallel (%d threads) %7.1f MB/s\n", 
+      PARALLEL_SIZE >> 20, PARALLEL_SIZE / ts / 1e6, nthreads, 
+      PARALLEL_SIZE / tp / 1e6);
+
+  free (in);
+  free (ge);
+  free (gd);
+  return 0;
+}
+
+/* one stream fed to golomb_decoder_feed a network packet at a time,
+ * with a fixed output window that is drained as it fills */
+static int
+bench_stream (void)
+{
+  struct golomb_decoder dec;
+  unsigned char *in, *window;
+  void *ge, *gd;
+  size_t ge_size, gd_size, off, got, frag, used, made;
+  uint64_t b;
+  double t, ts, tf;
+  int r;
+
+  in = malloc (STREAM_SIZE);
+  window = malloc (STREAM_WINDOW);
+  fill_random (in, STREAM_SIZE, 50);
+  if (golomb_encode (in, STREAM_SIZE, &ge, &ge_size, &b)) return 1;
+
+  t = now ();
+  for (r = 0; r < STREAM_REPS; ++r) {
+    if (golomb_decode (ge, ge_size, b, &gd, &gd_size)) return 1;
+    free (gd);
+  }
+  ts = now () - t;
+
+  t = now ();
+  for (r = 0; r < STREAM_REPS; ++r) {
+    golomb_decoder_init (&dec, b);
+    for (off = 0, got = 0; ; ) {
+      frag = (ge_size - off < STREAM_PACKET) ? ge_size - off : 
+        STREAM_PACKET;
+      if (golomb_decoder_feed (&dec, (unsigned char*) ge + off, frag, 
+            &used, window, STREAM_WINDOW, &made))
+        return 1;
+      if (r == 0 && memcmp (window, in + got, made)) {
+        printf ("stream decode mismatch\n");
+        return 1;
+      }
+      off += used;
+      got += made;
+      if (off == ge_size && !made) break;
+    }
+  }
+  tf = now () - t;
+
+  printf ("%zu KB at 5.0%%: golomb_decode %7.1f MB/s, "
+      "golomb_decoder_feed (%d byte packets) %7.1f MB/s\n", 
+      STREAM_SIZE >> 10, (double) STREAM_SIZE * STREAM_REPS / ts / 1e6, 
+      STREAM_PACKET, (double) STREAM_SIZE * STREAM_REPS / tf / 1e6);
+
+  free (in);
+  free (window);
+  free (ge);
+  return 0;
+}
+
+/* a sparse bitmap too long for 32 bit bit offsets */
+static int
+bench_big (void)
+{
+  unsigned char *in;
+  void *ge = NULL, *gd = NULL;
+  size_t ge_size, gd_size, i;
+  uint64_t b;
+  double t;
+
+  if ( !(in = calloc (BIG_SIZE, 1)) ) {
+    perror ("bench: cannot malloc big input: ");
+    return 1;
+  }
+  for (i = 0; i < 64; ++i)
+    in[(BIG_SIZE / 64) * i + i] = 0x81;
+  in[BIG_SIZE - 1] = 0x01;
+
+  t = now ();
+  if (golomb_encode (in, BIG_SIZE, &ge, &ge_size, &b)) goto big_error;
+  printf ("big: %zu bytes -> %zu bytes, b = %llu, encode %.2fs\n",
+      BIG_SIZE, ge_size, (unsigned long long) b, now () - t);
+
+  t = now ();
+  if (golomb_decode (ge, ge_size, b, &gd, &gd_size)) goto big_error;
+  printf ("big: decode %.2fs\n", now () - t);
+
+  if (gd_size != BIG_SIZE || memcmp (gd, in, BIG_SIZE)) {
+    printf ("big round trip failed\n");
+    goto big_error;
+  }
+
+  free (in);
+  free (ge);
+  free (gd);
+  return 0;
+
+big_error:
+  free (in);
+  free (ge);
+  free (gd);
+  return 1;
+}
+
+int main (int argc, char **argv)
+{
+  unsigned char *in;
+  int densities[] = { 10, 50, 100, 250 };
+  int i;
+
+  srand (1);
+  in = malloc (BENCH_SIZE);
+
+  if (argc > 1 && !strcmp (argv[1], "perf")) {
+    struct perf_counters pc;
+
+    perf_open (&pc);
+    for (i = 0; i < sizeof (densities) / sizeof (densities[0]); ++i)
+      if (bench_perf (in, densities[i], &pc)) {
+        perf_close (&pc);
+        goto bench_error;
+      }
+    perf_close (&pc);
+    free (in);
+    return 0;
+  }
+
+  for (i = 0; i < sizeof (densities) / sizeof (densities[0]); ++i)
+    if (bench_density (in, densities[i]) || 
+        bench_backends (in, densities[i]))
+      goto bench_error;
+
+  if (bench_small ())
+    goto bench_error;
+
+  for (i = 0; i < sizeof (densities) / sizeof (densities[0]); ++i)
+    if (bench_many (densities[i]))
+      goto bench_error;
+
+  if (bench_parallel (4) || bench_stream ())
+    goto bench_error;
+
+  if (argc > 1 && !strcmp (argv[1], "big") && bench_big ())
+    goto bench_error;
+
+  free (in);
+  return 0;
+
+bench_error:
+  free (in);
+  return 1;
+}
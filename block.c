@@ -0,0 +1,704 @@
+/*
+ * Block-partitioned coding with a per-block codec and Golomb
+ * parameter. See block.h for the layout.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <zlib.h>
+
+#include "encode.h"
+#include "block.h"
+#include "pack.h"
+
+/* gaps decoded at a time when expanding a block */
+#define BLOCK_DECODE_BATCH 256
+
+/* gaps below this get their own entropy estimate bin */
+#define BLOCK_ENTROPY_SMALL 256
+
+
+/*
+ * The b that minimises the coded size of 'gaps', and that size in
+ * '*bits'. The cost is close to convex in b, so start from the
+ * estimate for a geometric distribution of this density and walk
+ * downhill with a shrinking step.
+ */
+static uint64_t
+best_block_param (const uint64_t *gaps, size_t n, uint64_t nbits,
+    uint64_t *bits)
+{
+  uint64_t best, best_cost, step, cand, cost;
+  int improved, rounds = 0;
+
+  best = golomb_optimal_param (n, nbits);
+  best_cost = golomb_gaps_bits (gaps, n, best);
+  step = best / 4 ? best / 4 : 1;
+
+  while (rounds++ < 64) {
+    improved = 0;
+
+    cand = best + step;
+    if ((cost = golomb_gaps_bits (gaps, n, cand)) < best_cost) {
+      best = cand; best_cost = cost; improved = 1;
+    } else if (best > step) {
+      cand = best - step;
+      if ((cost = golomb_gaps_bits (gaps, n, cand)) < best_cost) {
+        best = cand; best_cost = cost; improved = 1;
+      }
+    }
+
+    if (!improved) {
+      if (step == 1) break;
+      step /= 2;
+    }
+  }
+
+  *bits = best_cost;
+  return best;
+}
+
+
+/*
+ * Order-0 entropy of 'gaps' in bits, with gaps past the table costed
+ * as their log2 bucket plus the raw bits under it. Golomb is close to
+ * this when the gaps are geometric; when it is well under what Golomb
+ * takes (a few favourite strides, repeated patterns), a general
+ * purpose coder has something to find.
+ */
+static uint64_t
+gap_entropy_bits (const uint64_t *gaps, size_t n)
+{
+  uint32_t hist[BLOCK_ENTROPY_SMALL + 64];
+  double bits = 0;
+  size_t i;
+  int L;
+
+  if (!n) return 0;
+
+  memset (hist, 0, sizeof (hist));
+  for (i = 0; i < n; ++i) {
+    if (gaps[i] < BLOCK_ENTROPY_SMALL) {
+      hist[gaps[i]]++;
+    } else {
+      L = 63 - __builtin_clzll (gaps[i]);
+      hist[BLOCK_ENTROPY_SMALL + L]++;
+      bits += L;
+    }
+  }
+
+  for (i = 0; i < BLOCK_ENTROPY_SMALL + 64; ++i)
+    if (hist[i])
+      bits -= hist[i] * log2 ((double) hist[i] / n);
+
+  return (uint64_t) bits;
+}
+
+
+/*
+ * Deflate 'len' bytes into 'out', with room for at most 'room' bytes.
+ * Returns the size, or 0 if it didn't fit (or deflate failed), in
+ * which case the caller codes the block some other way. 'strm' is set
+ * up once by the caller and reset here, so each block doesn't pay for
+ * a fresh deflate state.
+ */
+static size_t
+deflate_block (z_stream *strm, const unsigned char *in, size_t len,
+    unsigned char *out, size_t room)
+{
+  if (deflateReset (strm) != Z_OK) return 0;
+
+  strm->next_in = (unsigned char*) in;
+  strm->avail_in = len;
+  strm->next_out = out;
+  strm->avail_out = room;
+
+  if (deflate (strm, Z_FINISH) != Z_STREAM_END) return 0;
+  return room - strm->avail_out;
+}
+
+
+/*
+ * Code the 'len' input bytes of one block at 'p', which has room for
+ * 1 + len bytes: raw, Golomb or deflate, whichever comes out smallest
+ * of the ones 'bias' lets it try ('strm' is only touched past
+ * GOLOMB_BLOCK_FAST). 'gaps' has room for len * 8 gaps. Returns the
+ * bytes written, and the set bits of the block in '*ones'.
+ */
+static size_t
+encode_block (const unsigned char *in, size_t len, int bias,
+    z_stream *strm, uint64_t *gaps, unsigned char *p, uint64_t *ones)
+{
+  uint64_t bits, bitpos, b;
+  size_t n, golomb_len, best_len, dlen;
+  unsigned char *start = p;
+  int type, try_deflate;
+
+  /* code whichever polarity is the minority, so a saturated block
+   * costs as little as an empty one */
+  *ones = num_set_bits (in, len);
+  type = (*ones > len * 4) ? GOLOMB_BLOCK_COMPLEMENT : GOLOMB_BLOCK_GOLOMB;
+  n = (type == GOLOMB_BLOCK_COMPLEMENT) ? 
+    get_clear_bit_gaps (in, len, gaps) : get_set_bit_gaps (in, len, gaps);
+
+  b = n ? best_block_param (gaps, n, (uint64_t) len * 8, &bits) : 1;
+  if (!n) bits = 0;
+  golomb_len = 1 + varint_len (b) + varint_len (n) + (bits + 7) / 8;
+
+  if (golomb_len > 1 + len) {
+    type = GOLOMB_BLOCK_RAW;
+    best_len = 1 + len;
+  } else {
+    best_len = golomb_len;
+  }
+
+  /* deflate only has to beat what's already in hand; the balanced
+   * setting only tries it where the gaps look compressible beyond
+   * what Golomb gets */
+  try_deflate = (bias == GOLOMB_BLOCK_SMALLEST) ||
+    (bias == GOLOMB_BLOCK_BALANCED && 
+     gap_entropy_bits (gaps, n) * 4 < bits * 3);
+  if (try_deflate && best_len > 2 && 
+      (dlen = deflate_block (strm, in, len, p + 1, best_len - 2))) {
+    *p = GOLOMB_BLOCK_DEFLATE;
+    return 1 + dlen;
+  }
+
+  /* deflate may have scribbled here, and the kernel needs zeros */
+  memset (p, 0, best_len);
+  *p++ = type;
+  if (type == GOLOMB_BLOCK_RAW) {
+    memcpy (p, in, len);
+    return 1 + len;
+  }
+
+  p += put_varint (p, b);
+  p += put_varint (p, n);
+  bitpos = 0;
+  golomb_encode_gaps (gaps, n, b, p, &bitpos);
+  return (p - start) + (bitpos + 7) / 8;
+}
+
+
+/*
+ * Encode 'input' in blocks of 'block_size' bytes (0 picks
+ * GOLOMB_BLOCK_DEFAULT_SIZE), coding each block raw, with Golomb or
+ * with deflate, whichever comes out smallest of the ones the bias in
+ * 'options' lets it try (see block.h). Each block's Golomb parameter
+ * is chosen for that block alone, and no block takes more than one
+ * byte over its raw size. With GOLOMB_BLOCK_RANK in 'options' the
+ * output also gets the rank index. 'slack' zero bytes are left after
+ * every block for golomb_block_set_bits to grow it into. Returns 0 on
+ * success, 1 on allocation failure and -1 on bad arguments.
+ */
+int
+golomb_block_encode_slack (const void *input, size_t input_len,
+    size_t block_size, int options, size_t slack, void **output,
+    size_t *output_len)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  unsigned char *out = NULL, *p, *payload, *ranks = NULL, *tmp;
+  uint64_t *gaps = NULL;
+  uint64_t ones, rank = 0;
+  size_t nblocks, k, len, index_len, ranks_len;
+  int have_strm = 0;
+  int bias = options & GOLOMB_BLOCK_BIAS_MASK;
+  z_stream strm;
+
+  if (!in || !output || !output_len) return -1;
+  if (bias > GOLOMB_BLOCK_SMALLEST || 
+      (options & ~(GOLOMB_BLOCK_BIAS_MASK | GOLOMB_BLOCK_RANK)))
+    return -1;
+
+  if (!block_size)
+    block_size = GOLOMB_BLOCK_DEFAULT_SIZE;
+  if (block_size > UINT32_MAX || slack > UINT32_MAX) return -1;
+
+  nblocks = (input_len + block_size - 1) / block_size;
+  if (nblocks > UINT32_MAX) return -1;
+
+  /* a raw block is its type byte and the input, and nothing is kept
+   * unless it's smaller than that, so this is the worst case */
+  index_len = (nblocks + 1) * 8;
+  ranks_len = (options & GOLOMB_BLOCK_RANK) ? (nblocks + 1) * 8 : 0;
+  if ( !(gaps = malloc (sizeof (uint64_t) * block_size * 8)) ||
+      !(out = calloc (GOLOMB_BLOCK_HEADER_SIZE + index_len + ranks_len + 
+          nblocks * (1 + slack) + input_len, 1)) ) {
+    perror ("block encode: cannot malloc: ");
+    goto encode_error;
+  }
+
+  if (bias != GOLOMB_BLOCK_FAST) {
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    if (deflateInit (&strm, bias == GOLOMB_BLOCK_SMALLEST ? 
+          Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION) != Z_OK) {
+      fprintf (stderr, "block encode: cannot set up deflate\n");
+      goto encode_error;
+    }
+    have_strm = 1;
+  }
+
+  memcpy (out, GOLOMB_BLOCK_MAGIC, 4);
+  out[4] = GOLOMB_BLOCK_VERSION;
+  out[5] = (ranks_len ? GOLOMB_BLOCK_FLAG_RANK : 0) | 
+    (slack ? GOLOMB_BLOCK_FLAG_SLACK : 0);
+  put_le64 (out + 8, input_len);
+  put_le32 (out + 16, (uint32_t) block_size);
+  put_le32 (out + 20, (uint32_t) nblocks);
+  if (ranks_len)
+    ranks = out + GOLOMB_BLOCK_HEADER_SIZE + index_len;
+  payload = out + GOLOMB_BLOCK_HEADER_SIZE + index_len + ranks_len;
+
+  p = payload;
+  for (k = 0; k < nblocks; ++k) {
+    put_le64 (out + GOLOMB_BLOCK_HEADER_SIZE + k * 8, p - payload);
+
+    len = (input_len - k * block_size < block_size) ? 
+      input_len - k * block_size : block_size;
+
+    p += encode_block (in + k * block_size, len, bias, &strm, gaps, p, 
+        &ones);
+    if (ranks) {
+      put_le64 (ranks + k * 8, rank);
+      rank += ones;
+    }
+
+    /* calloc left the slack zeroed */
+    p += slack;
+  }
+  put_le64 (out + GOLOMB_BLOCK_HEADER_SIZE + nblocks * 8, p - payload);
+  if (ranks)
+    put_le64 (ranks + nblocks * 8, rank);
+
+  free (gaps);
+  if (have_strm) (void) deflateEnd (&strm);
+
+  *output_len = p - out;
+  if ( (tmp = realloc (out, *output_len)) )
+    out = tmp;
+  *output = out;
+  return 0;
+
+encode_error:
+  free (gaps);
+  free (out);
+  if (have_strm) (void) deflateEnd (&strm);
+  return 1;
+}
+
+
+/*
+ * golomb_block_encode_slack without the slack.
+ */
+int
+golomb_block_encode_hybrid (const void *input, size_t input_len,
+    size_t block_size, int options, void **output, size_t *output_len)
+{
+  return golomb_block_encode_slack (input, input_len, block_size, options,
+      0, output, output_len);
+}
+
+
+/*
+ * Encode 'input' with raw or Golomb blocks only; see
+ * golomb_block_encode_hybrid.
+ */
+int
+golomb_block_encode (const void *input, size_t input_len,
+    size_t block_size, void **output, size_t *output_len)
+{
+  return golomb_block_encode_hybrid (input, input_len, block_size,
+      GOLOMB_BLOCK_FAST, output, output_len);
+}
+
+
+/*
+ * Parse and sanity check the header and index of an encoded buffer.
+ * Returns 0 if it looks good, -1 otherwise.
+ */
+int
+golomb_block_info (const void *input, size_t input_len,
+    struct golomb_block_info *info)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  uint64_t index_len, ranks_len, prev, off, len;
+  uint32_t k;
+
+  if (!in || !info || input_len < GOLOMB_BLOCK_HEADER_SIZE) return -1;
+  if (memcmp (in, GOLOMB_BLOCK_MAGIC, 4) || 
+      in[4] != GOLOMB_BLOCK_VERSION) 
+    return -1;
+
+  info->input_len = get_le64 (in + 8);
+  info->block_size = get_le32 (in + 16);
+  info->nblocks = get_le32 (in + 20);
+
+  if (!info->block_size || info->nblocks != 
+      (info->input_len + info->block_size - 1) / info->block_size)
+    return -1;
+
+  if (in[5] & ~(GOLOMB_BLOCK_FLAG_RANK | GOLOMB_BLOCK_FLAG_SLACK)) 
+    return -1;
+  info->flags = in[5];
+
+  index_len = ((uint64_t) info->nblocks + 1) * 8;
+  ranks_len = (in[5] & GOLOMB_BLOCK_FLAG_RANK) ? index_len : 0;
+  if (input_len - GOLOMB_BLOCK_HEADER_SIZE < index_len + ranks_len) 
+    return -1;
+
+  info->index = in + GOLOMB_BLOCK_HEADER_SIZE;
+  info->ranks = ranks_len ? info->index + index_len : NULL;
+  info->payload = info->index + index_len + ranks_len;
+  info->payload_len = input_len - GOLOMB_BLOCK_HEADER_SIZE - index_len - 
+    ranks_len;
+
+  /* offsets must be increasing and inside the payload */
+  for (k = 0, prev = 0; k <= info->nblocks; ++k) {
+    off = get_le64 (info->index + (uint64_t) k * 8);
+    if (off < prev || off > info->payload_len) return -1;
+    prev = off;
+  }
+
+  /* and a block can't hold more set bits than it has bits */
+  for (k = 0, prev = 0; info->ranks && k < info->nblocks; ++k) {
+    off = get_le64 (info->ranks + ((uint64_t) k + 1) * 8);
+    len = info->input_len - (uint64_t) k * info->block_size;
+    if (len > info->block_size) len = info->block_size;
+    if (off < prev || off - prev > len * 8) return -1;
+    prev = off;
+  }
+  if (info->ranks && get_le64 (info->ranks)) return -1;
+
+  return 0;
+}
+
+
+/*
+ * Decode block 'block' into 'out', which must have room for
+ * block_size bytes (the last block may be shorter). Returns 0 on
+ * success and -1 if the block is corrupt.
+ */
+int
+golomb_block_decode_block (const struct golomb_block_info *info,
+    size_t block, unsigned char *out)
+{
+  uint64_t gaps[BLOCK_DECODE_BATCH];
+  const unsigned char *p, *end;
+  uint64_t b, count, bitpos, endbit, pos, last, nbits;
+  size_t len, n, i, used;
+  uLongf dlen;
+  int type;
+
+  if (!info || !out || block >= info->nblocks) return -1;
+
+  len = (info->input_len - (uint64_t) block * info->block_size < 
+      info->block_size) ? 
+    info->input_len - (uint64_t) block * info->block_size : 
+    info->block_size;
+  nbits = (uint64_t) len * 8;
+  memset (out, 0, len);
+
+  p = info->payload + get_le64 (info->index + block * 8);
+  end = info->payload + get_le64 (info->index + (block + 1) * 8);
+
+  if (p >= end) return -1;
+  type = *p++;
+
+  if (type == GOLOMB_BLOCK_RAW) {
+    /* slack past the bytes is only allowed where the header says */
+    if ((size_t) (end - p) < len || ((size_t) (end - p) > len && 
+          !(info->flags & GOLOMB_BLOCK_FLAG_SLACK)))
+      return -1;
+    memcpy (out, p, len);
+    return 0;
+  }
+
+  if (type == GOLOMB_BLOCK_DEFLATE) {
+    dlen = len;
+    if (uncompress (out, &dlen, p, end - p) != Z_OK || dlen != len) 
+      return -1;
+    return 0;
+  }
+
+  if (type != GOLOMB_BLOCK_GOLOMB && type != GOLOMB_BLOCK_COMPLEMENT) 
+    return -1;
+  if ( !(used = get_varint (p, end, &b)) || !b) return -1;
+  p += used;
+  if ( !(used = get_varint (p, end, &count)) || count > nbits) return -1;
+  p += used;
+
+  /* b is fixed for the whole block, so this is one tight loop of
+   * kernel calls */
+  bitpos = 0; pos = 0;
+  endbit = (uint64_t) (end - p) * 8;
+  while (count) {
+    n = golomb_decode_gaps (p, &bitpos, endbit, b, gaps,
+        count < BLOCK_DECODE_BATCH ? count : BLOCK_DECODE_BATCH);
+    if (!n) return -1;
+
+    for (i = 0, last = pos; i < n; ++i)
+      last += gaps[i];
+    if (last > nbits) return -1;
+
+    apply_run_lengths (gaps, n, out, &pos);
+    count -= n;
+  }
+
+  if (type == GOLOMB_BLOCK_COMPLEMENT)
+    for (i = 0; i < len; ++i)
+      out[i] = ~out[i];
+
+  return 0;
+}
+
+
+int
+golomb_block_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len)
+{
+  struct golomb_block_info info;
+  unsigned char *out;
+  uint32_t k;
+
+  if (!output || !output_len) return -1;
+  if (golomb_block_info (input, input_len, &info)) return -1;
+
+  if ( !(out = malloc (info.input_len ? info.input_len : 1)) ) {
+    perror ("block decode: cannot malloc output: ");
+    return 1;
+  }
+
+  for (k = 0; k < info.nblocks; ++k) {
+    if (golomb_block_decode_block (&info, k, 
+          out + (uint64_t) k * info.block_size)) {
+      free (out);
+      return -1;
+    }
+  }
+
+  *output = out;
+  *output_len = info.input_len;
+  return 0;
+}
+
+
+/*
+ * Set the bits at 'positions' (MSB first, as everywhere else) in an
+ * encoded buffer, in place. Only the blocks the bits fall in are
+ * decoded and coded again, raw or Golomb, into the room the index
+ * already gives them: their own bytes and the slack
+ * golomb_block_encode_slack left after them. Nothing else moves; with
+ * a rank index the counts after each changed block are bumped.
+ * Positions in the same block are best passed next to each other,
+ * since each run of them costs a block decode and encode.
+ *
+ * Returns 0 on success, 1 on allocation failure, -1 on bad arguments,
+ * a position past the end or a corrupt block, and GOLOMB_BLOCK_FULL
+ * if a block's new coding doesn't fit its room. That block is left as
+ * it was, and the bits before it are set; setting them again does no
+ * harm, so the caller can decode, encode with more slack and retry.
+ */
+int
+golomb_block_set_bits (void *encoded, size_t encoded_len,
+    const uint64_t *positions, size_t npositions)
+{
+  struct golomb_block_info info;
+  unsigned char *buf = NULL, *code = NULL, *payload, *ranks;
+  uint64_t *gaps = NULL;
+  uint64_t block_bits, block, before, after, off, room, r;
+  size_t i, j, len, used;
+  int ret = 0;
+
+  if (!positions && npositions) return -1;
+  if (golomb_block_info (encoded, encoded_len, &info)) return -1;
+
+  for (i = 0; i < npositions; ++i)
+    if (positions[i] >= info.input_len * 8) return -1;
+  if (!npositions) return 0;
+
+  /* the info points at a const buffer, but it's ours to write */
+  payload = (unsigned char*) encoded + (info.payload - 
+      (const unsigned char*) encoded);
+  ranks = info.ranks ? (unsigned char*) encoded + (info.ranks - 
+      (const unsigned char*) encoded) : NULL;
+
+  if ( !(buf = malloc (info.block_size)) ||
+      !(code = malloc ((size_t) info.block_size + 1)) ||
+      !(gaps = malloc (sizeof (uint64_t) * info.block_size * 8)) ) {
+    perror ("block set bits: cannot malloc: ");
+    ret = 1;
+    goto set_bits_done;
+  }
+
+  block_bits = (uint64_t) info.block_size * 8;
+  for (i = 0; i < npositions; i = j) {
+    block = positions[i] / block_bits;
+    if (golomb_block_decode_block (&info, block, buf)) {
+      ret = -1;
+      goto set_bits_done;
+    }
+
+    len = (info.input_len - block * info.block_size < info.block_size) ?
+      info.input_len - block * info.block_size : info.block_size;
+    before = num_set_bits (buf, len);
+
+    for (j = i; j < npositions && positions[j] / block_bits == block; ++j)
+      buf[(positions[j] % block_bits) / 8] |= 0x80 >> (positions[j] % 8);
+
+    /* deflate would need a stream set up per call, and a block that
+     * keeps changing is better off without it anyway */
+    used = encode_block (buf, len, GOLOMB_BLOCK_FAST, NULL, gaps, code, 
+        &after);
+    if (after == before) continue;
+
+    off = get_le64 (info.index + block * 8);
+    room = get_le64 (info.index + (block + 1) * 8) - off;
+    if (used > room) {
+      ret = GOLOMB_BLOCK_FULL;
+      goto set_bits_done;
+    }
+    memcpy (payload + off, code, used);
+    memset (payload + off + used, 0, room - used);
+
+    if (ranks)
+      for (r = block + 1; r <= info.nblocks; ++r)
+        put_le64 (ranks + r * 8, get_le64 (ranks + r * 8) + 
+            (after - before));
+  }
+
+set_bits_done:
+  free (buf);
+  free (code);
+  free (gaps);
+  return ret;
+}
+
+
+/*
+ * The number of set bits in the whole input, straight from the rank
+ * index. Returns -1 if the buffer was encoded without one.
+ */
+int
+golomb_block_cardinality (const struct golomb_block_info *info,
+    uint64_t *count)
+{
+  if (!info || !count || !info->ranks) return -1;
+
+  *count = get_le64 (info->ranks + (uint64_t) info->nblocks * 8);
+  return 0;
+}
+
+
+/*
+ * The number of set bits before bit 'pos' (MSB first, as everywhere
+ * else), decoding at most the one block 'pos' falls in. 'pos' may be
+ * one past the last bit. Returns 0 on success, 1 on allocation failure
+ * and -1 if there's no rank index, 'pos' is out of range or the block
+ * is corrupt.
+ */
+int
+golomb_block_rank (const struct golomb_block_info *info, uint64_t pos,
+    uint64_t *rank)
+{
+  unsigned char *buf;
+  uint64_t block, bit;
+  size_t byte;
+
+  if (!info || !rank || !info->ranks || pos > info->input_len * 8) 
+    return -1;
+
+  block = pos / ((uint64_t) info->block_size * 8);
+  bit = pos % ((uint64_t) info->block_size * 8);
+  if (block == info->nblocks) 
+    return golomb_block_cardinality (info, rank);
+
+  *rank = get_le64 (info->ranks + block * 8);
+  if (!bit) return 0;
+
+  if ( !(buf = malloc (info->block_size)) ) {
+    perror ("block rank: cannot malloc block: ");
+    return 1;
+  }
+  if (golomb_block_decode_block (info, block, buf)) {
+    free (buf);
+    return -1;
+  }
+
+  byte = bit / 8;
+  *rank += num_set_bits (buf, byte);
+  if (bit % 8)
+    *rank += __builtin_popcount (buf[byte] & (0xff00 >> (bit % 8)));
+
+  free (buf);
+  return 0;
+}
+
+
+/*
+ * The position of set bit 'k' (counting from 0), found by a binary
+ * search of the rank index and one block decode. Returns 0 on
+ * success, 1 on allocation failure and -1 if there's no rank index,
+ * there are no more than 'k' set bits or the block is corrupt.
+ */
+int
+golomb_block_select (const struct golomb_block_info *info, uint64_t k,
+    uint64_t *pos)
+{
+  unsigned char *buf;
+  uint64_t lo, hi, mid, len, count;
+  unsigned int c;
+  size_t i;
+
+  if (!info || !pos || golomb_block_cardinality (info, &count) || 
+      k >= count) 
+    return -1;
+
+  /* the last block whose first rank is at most k */
+  lo = 0; hi = info->nblocks - 1;
+  while (lo < hi) {
+    mid = (lo + hi + 1) / 2;
+    if (get_le64 (info->ranks + mid * 8) <= k)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  k -= get_le64 (info->ranks + lo * 8);
+
+  if ( !(buf = malloc (info->block_size)) ) {
+    perror ("block select: cannot malloc block: ");
+    return 1;
+  }
+  if (golomb_block_decode_block (info, lo, buf)) {
+    free (buf);
+    return -1;
+  }
+
+  len = info->input_len - lo * info->block_size;
+  if (len > info->block_size) len = info->block_size;
+
+  for (i = 0; i < len; ++i) {
+    c = buf[i];
+    if (k < (uint64_t) __builtin_popcount (c))
+      break;
+    k -= __builtin_popcount (c);
+  }
+  if (i == len) {
+    free (buf);
+    return -1;
+  }
+
+  /* k-th set bit of this char, MSB first */
+  while (k--)
+    c &= ~(0x80u >> (__builtin_clz (c) - 24));
+  *pos = lo * info->block_size * 8 + (uint64_t) i * 8 + 
+    (__builtin_clz (c) - 24);
+
+  free (buf);
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Block-partitioned Golomb coding. The input bitmap is cut into fixed
+ * size blocks and each block is coded on its own, with the Golomb
+ * parameter that suits its own density, so inputs whose density
+ * varies from region to region compress close to what each region
+ * would on its own. A block Golomb would expand is stored raw, and
+ * golomb_block_encode_hybrid can also deflate the blocks with some
+ * structure Golomb can't see. An index of block offsets up front means
+ * any one block can be decoded without touching the others.
+ * golomb_block_set_bits sets bits in an encoded buffer in place, coding
+ * only the blocks they fall in again; golomb_block_encode_slack leaves
+ * room after each block for them to grow into.
+ *
+ * Layout (all integers little endian):
+ *
+ *   header   "GBLK", version, flags, 2 reserved bytes,
+ *            input_len (8), block_size (4), nblocks (4)
+ *   index    nblocks + 1 payload offsets (8 each); the last one is
+ *            the payload length
+ *   ranks    only with GOLOMB_BLOCK_FLAG_RANK: nblocks + 1 counts (8
+ *            each) of the bits set before each block; the last one is
+ *            the cardinality of the whole input
+ *   payload  per block: type (1), b (varint), set bits (varint),
+ *            then the Golomb coded gaps between set bits, padded to
+ *            a byte; complement blocks count and code the clear bits,
+ *            raw blocks hold the input bytes and deflate blocks a zlib
+ *            stream of them after the type; with
+ *            GOLOMB_BLOCK_FLAG_SLACK a block may be followed by unused
+ *            bytes up to the next offset
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __BLOCK_H
+#define __BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GOLOMB_BLOCK_MAGIC "GBLK"
+#define GOLOMB_BLOCK_VERSION 1
+#define GOLOMB_BLOCK_HEADER_SIZE 24
+#define GOLOMB_BLOCK_DEFAULT_SIZE 4096   /* input bytes per block */
+
+/* block types, the first byte of each block; a complement block codes
+ * the clear bits of a block more than half full */
+#define GOLOMB_BLOCK_GOLOMB 0
+#define GOLOMB_BLOCK_COMPLEMENT 1
+#define GOLOMB_BLOCK_RAW 2          /* the input bytes as they are */
+#define GOLOMB_BLOCK_DEFLATE 3      /* a zlib stream of the input bytes */
+
+/* what golomb_block_encode_hybrid may try on each block */
+#define GOLOMB_BLOCK_FAST 0         /* raw or Golomb, never deflate */
+#define GOLOMB_BLOCK_BALANCED 1     /* deflate where the gaps look
+                                       compressible beyond Golomb */
+#define GOLOMB_BLOCK_SMALLEST 2     /* deflate (level 9) every block */
+#define GOLOMB_BLOCK_BIAS_MASK 3
+
+/* or'ed into the bias to store the rank index, for
+ * golomb_block_rank, golomb_block_select and golomb_block_cardinality */
+#define GOLOMB_BLOCK_RANK 4
+
+/* header flags */
+#define GOLOMB_BLOCK_FLAG_RANK 1
+#define GOLOMB_BLOCK_FLAG_SLACK 2   /* blocks may have room to spare */
+
+/* golomb_block_set_bits: a block's new coding didn't fit its room */
+#define GOLOMB_BLOCK_FULL 2
+
+/* a parsed header; the pointers point into the encoded buffer */
+struct golomb_block_info {
+  uint64_t input_len;
+  uint32_t block_size;
+  uint32_t nblocks;
+  const unsigned char *index;
+  const unsigned char *ranks;       /* NULL without the rank index */
+  const unsigned char *payload;
+  uint64_t payload_len;
+  int flags;                        /* GOLOMB_BLOCK_FLAG_* */
+};
+
+int
+golomb_block_encode (const void *input, size_t input_len,
+    size_t block_size, void **output, size_t *output_len);
+
+int
+golomb_block_encode_hybrid (const void *input, size_t input_len,
+    size_t block_size, int options, void **output, size_t *output_len);
+
+int
+golomb_block_encode_slack (const void *input, size_t input_len,
+    size_t block_size, int options, size_t slack, void **output,
+    size_t *output_len);
+
+int
+golomb_block_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len);
+
+int
+golomb_block_info (const void *input, size_t input_len,
+    struct golomb_block_info *info);
+
+int
+golomb_block_decode_block (const struct golomb_block_info *info,
+    size_t block, unsigned char *out);
+
+int
+golomb_block_set_bits (void *encoded, size_t encoded_len,
+    const uint64_t *positions, size_t npositions);
+
+int
+golomb_block_cardinality (const struct golomb_block_info *info,
+    uint64_t *count);
+
+int
+golomb_block_rank (const struct golomb_block_info *info, uint64_t pos,
+    uint64_t *rank);
+
+int
+golomb_block_select (const struct golomb_block_info *info, uint64_t k,
+    uint64_t *pos);
+
+#endif /* __BLOCK_H */
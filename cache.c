@@ -0,0 +1,418 @@
+/*
+ * Sharded LRU cache of decoded blocks. See cache.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "block.h"
+#include "cache.h"
+
+/* buckets a shard starts with; the table doubles as it fills */
+#define CACHE_MIN_BUCKETS 64
+
+struct golomb_cache_entry {
+  uint64_t filter_id, block, hash;
+  struct golomb_cache_entry *chain;           /* in the bucket */
+  struct golomb_cache_entry *newer, *older;   /* in the LRU list */
+  struct golomb_cache_shard *shard;
+  int refs;
+  int cached;                 /* still in the table */
+  size_t len;
+  unsigned char data[];
+};
+
+struct golomb_cache_shard {
+  pthread_mutex_t lock;
+  struct golomb_cache_entry **buckets;
+  size_t nbuckets, entries;
+  struct golomb_cache_entry *newest, *oldest;
+  size_t bytes, budget;
+  uint64_t hits, misses, evictions;
+  uint64_t epoch;             /* golomb_cache_invalidate calls */
+};
+
+
+/* what an entry counts against the budget */
+static size_t
+entry_cost (const struct golomb_cache_entry *e)
+{
+  return sizeof (*e) + e->len;
+}
+
+/* splitmix64's finaliser over the key; the shard comes from the top
+ * bits and the bucket from the bottom ones */
+static uint64_t
+cache_hash (uint64_t filter_id, uint64_t block)
+{
+  uint64_t h = filter_id * 0x9e3779b97f4a7c15ULL + block;
+
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return h ^ (h >> 31);
+}
+
+
+/*
+ * Set up an empty cache holding at most 'budget' bytes of blocks, in
+ * 'nshards' shards (0 for GOLOMB_CACHE_DEFAULT_SHARDS; more shards,
+ * less contention between threads). Returns 0 on success, 1 on
+ * allocation failure and -1 on bad arguments.
+ */
+int
+golomb_cache_init (struct golomb_cache *cache, size_t budget, int nshards)
+{
+  struct golomb_cache_shard *s;
+  int i;
+
+  if (!cache || nshards < 0) return -1;
+  if (!nshards)
+    nshards = GOLOMB_CACHE_DEFAULT_SHARDS;
+
+  memset (cache, 0, sizeof (*cache));
+  if ( !(cache->shards = calloc (nshards, sizeof (*cache->shards))) ) {
+    perror ("cache init: cannot malloc shards: ");
+    return 1;
+  }
+  cache->nshards = nshards;
+  cache->budget = budget;
+
+  for (i = 0; i < nshards; ++i) {
+    s = &cache->shards[i];
+    s->budget = budget / nshards;
+    s->nbuckets = CACHE_MIN_BUCKETS;
+    if ( !(s->buckets = calloc (s->nbuckets, sizeof (*s->buckets))) ) {
+      perror ("cache init: cannot malloc buckets: ");
+      cache->nshards = i;
+      golomb_cache_destroy (cache);
+      return 1;
+    }
+    pthread_mutex_init (&s->lock, NULL);
+  }
+  return 0;
+}
+
+
+/*
+ * Free every block, which must not be pinned any more, and the shards.
+ */
+void
+golomb_cache_destroy (struct golomb_cache *cache)
+{
+  struct golomb_cache_shard *s;
+  struct golomb_cache_entry *e, *next;
+  int i;
+
+  if (!cache || !cache->shards) return;
+
+  for (i = 0; i < cache->nshards; ++i) {
+    s = &cache->shards[i];
+    for (e = s->newest; e; e = next) {
+      next = e->older;
+      free (e);
+    }
+    free (s->buckets);
+    pthread_mutex_destroy (&s->lock);
+  }
+  free (cache->shards);
+  memset (cache, 0, sizeof (*cache));
+}
+
+
+static struct golomb_cache_entry *
+shard_lookup (struct golomb_cache_shard *s, uint64_t filter_id,
+    uint64_t block, uint64_t hash)
+{
+  struct golomb_cache_entry *e;
+
+  for (e = s->buckets[hash & (s->nbuckets - 1)]; e; e = e->chain)
+    if (e->block == block && e->filter_id == filter_id)
+      return e;
+  return NULL;
+}
+
+static void
+list_unlink (struct golomb_cache_shard *s, struct golomb_cache_entry *e)
+{
+  if (e->newer) e->newer->older = e->older; else s->newest = e->older;
+  if (e->older) e->older->newer = e->newer; else s->oldest = e->newer;
+}
+
+static void
+list_push (struct golomb_cache_shard *s, struct golomb_cache_entry *e)
+{
+  e->newer = NULL;
+  e->older = s->newest;
+  if (s->newest) s->newest->newer = e; else s->oldest = e;
+  s->newest = e;
+}
+
+/* double the buckets once there are more entries than them; if that
+ * can't be had the chains just get longer */
+static void
+shard_grow (struct golomb_cache_shard *s)
+{
+  struct golomb_cache_entry **buckets, *e, *next;
+  size_t i, n = s->nbuckets * 2;
+
+  if ( !(buckets = calloc (n, sizeof (*buckets))) ) return;
+
+  for (i = 0; i < s->nbuckets; ++i) {
+    for (e = s->buckets[i]; e; e = next) {
+      next = e->chain;
+      e->chain = buckets[e->hash & (n - 1)];
+      buckets[e->hash & (n - 1)] = e;
+    }
+  }
+  free (s->buckets);
+  s->buckets = buckets;
+  s->nbuckets = n;
+}
+
+/* take 'e' out of the table and the list; it's freed now, or by the
+ * last golomb_cache_put if it's pinned */
+static void
+shard_remove (struct golomb_cache_shard *s, struct golomb_cache_entry *e)
+{
+  struct golomb_cache_entry **pp;
+
+  pp = &s->buckets[e->hash & (s->nbuckets - 1)];
+  while (*pp != e)
+    pp = &(*pp)->chain;
+  *pp = e->chain;
+
+  list_unlink (s, e);
+  s->entries--;
+  s->bytes -= entry_cost (e);
+  e->cached = 0;
+  if (!e->refs)
+    free (e);
+}
+
+/* evict from the old end until the shard is within budget, passing
+ * over the pinned blocks */
+static void
+shard_evict (struct golomb_cache_shard *s)
+{
+  struct golomb_cache_entry *e, *newer;
+
+  for (e = s->oldest; e && s->bytes > s->budget; e = newer) {
+    newer = e->newer;
+    if (e->refs) continue;
+    shard_remove (s, e);
+    s->evictions++;
+  }
+}
+
+
+/*
+ * Block 'block' of the filter 'info' describes, decoded: from the
+ * cache if it's there, or decoded and added if it isn't. '*data'
+ * points at the block's bytes (the last block may be short), which
+ * stay put until the block is handed back with golomb_cache_put
+ * '*entry'. 'filter_id' is whatever the caller uses to tell filters
+ * apart. Returns 0 on success, 1 on allocation failure and -1 on bad
+ * arguments or if the block is corrupt.
+ */
+int
+golomb_cache_get (struct golomb_cache *cache, uint64_t filter_id,
+    const struct golomb_block_info *info, size_t block,
+    const unsigned char **data, struct golomb_cache_entry **entry)
+{
+  struct golomb_cache_shard *s;
+  struct golomb_cache_entry *e, *found;
+  uint64_t hash, epoch;
+  size_t len;
+
+  if (!cache || !cache->shards || !info || !data || !entry ||
+      block >= info->nblocks)
+    return -1;
+
+  hash = cache_hash (filter_id, block);
+  s = &cache->shards[(hash >> 32) % cache->nshards];
+
+  pthread_mutex_lock (&s->lock);
+  if ( (e = shard_lookup (s, filter_id, block, hash)) ) {
+    list_unlink (s, e);
+    list_push (s, e);
+    e->refs++;
+    s->hits++;
+    pthread_mutex_unlock (&s->lock);
+    *data = e->data;
+    *entry = e;
+    return 0;
+  }
+  s->misses++;
+  epoch = s->epoch;
+  pthread_mutex_unlock (&s->lock);
+
+  /* decode without holding up the shard */
+  len = (info->input_len - (uint64_t) block * info->block_size <
+      info->block_size) ?
+    info->input_len - (uint64_t) block * info->block_size :
+    info->block_size;
+  if ( !(e = malloc (sizeof (*e) + (len ? len : 1))) ) {
+    perror ("cache get: cannot malloc block: ");
+    return 1;
+  }
+  if (golomb_block_decode_block (info, block, e->data)) {
+    free (e);
+    return -1;
+  }
+  e->filter_id = filter_id;
+  e->block = block;
+  e->hash = hash;
+  e->shard = s;
+  e->refs = 1;
+  e->cached = 1;
+  e->len = len;
+
+  pthread_mutex_lock (&s->lock);
+  /* a filter invalidated while this was decoding may have changed
+   * under it: the caller gets the block, but it isn't kept */
+  if (s->epoch != epoch) {
+    e->cached = 0;
+    pthread_mutex_unlock (&s->lock);
+    *data = e->data;
+    *entry = e;
+    return 0;
+  }
+
+  /* another thread may have decoded it meanwhile */
+  if ( (found = shard_lookup (s, filter_id, block, hash)) ) {
+    list_unlink (s, found);
+    list_push (s, found);
+    found->refs++;
+    pthread_mutex_unlock (&s->lock);
+    free (e);
+    *data = found->data;
+    *entry = found;
+    return 0;
+  }
+
+  if (s->entries >= s->nbuckets)
+    shard_grow (s);
+  e->chain = s->buckets[hash & (s->nbuckets - 1)];
+  s->buckets[hash & (s->nbuckets - 1)] = e;
+  list_push (s, e);
+  s->entries++;
+  s->bytes += entry_cost (e);
+  shard_evict (s);
+  pthread_mutex_unlock (&s->lock);
+
+  *data = e->data;
+  *entry = e;
+  return 0;
+}
+
+
+/*
+ * Unpin a block golomb_cache_get handed out. Its data mustn't be
+ * touched after this.
+ */
+void
+golomb_cache_put (struct golomb_cache *cache,
+    struct golomb_cache_entry *entry)
+{
+  struct golomb_cache_shard *s;
+
+  if (!cache || !entry) return;
+
+  s = entry->shard;
+  pthread_mutex_lock (&s->lock);
+  if (--entry->refs == 0) {
+    if (!entry->cached)
+      free (entry);
+    else if (s->bytes > s->budget)
+      shard_evict (s);
+  }
+  pthread_mutex_unlock (&s->lock);
+}
+
+
+/*
+ * Whether bit 'pos' (MSB first) of the filter is set, through the
+ * cache. Returns as golomb_cache_get does, and -1 if 'pos' is past the
+ * end.
+ */
+int
+golomb_cache_test_bit (struct golomb_cache *cache, uint64_t filter_id,
+    const struct golomb_block_info *info, uint64_t pos, int *bit)
+{
+  struct golomb_cache_entry *entry;
+  const unsigned char *data;
+  uint64_t block_bits, off;
+  int ret;
+
+  if (!info || !bit || pos >= info->input_len * 8) return -1;
+
+  block_bits = (uint64_t) info->block_size * 8;
+  if ( (ret = golomb_cache_get (cache, filter_id, info, pos / block_bits,
+          &data, &entry)) )
+    return ret;
+
+  off = pos % block_bits;
+  *bit = !!(data[off / 8] & (0x80 >> (off % 8)));
+  golomb_cache_put (cache, entry);
+  return 0;
+}
+
+
+/*
+ * Drop every block of filter 'filter_id', for when it has changed.
+ * Blocks still pinned go once they're put back, and blocks being
+ * decoded on a miss at the time aren't added once they are.
+ */
+void
+golomb_cache_invalidate (struct golomb_cache *cache, uint64_t filter_id)
+{
+  struct golomb_cache_shard *s;
+  struct golomb_cache_entry *e, *older;
+  int i;
+
+  if (!cache || !cache->shards) return;
+
+  for (i = 0; i < cache->nshards; ++i) {
+    s = &cache->shards[i];
+    pthread_mutex_lock (&s->lock);
+    s->epoch++;
+    for (e = s->newest; e; e = older) {
+      older = e->older;
+      if (e->filter_id == filter_id)
+        shard_remove (s, e);
+    }
+    pthread_mutex_unlock (&s->lock);
+  }
+}
+
+
+/*
+ * The hit, miss and eviction counts since golomb_cache_init, and what
+ * the cache holds now.
+ */
+void
+golomb_cache_get_stats (struct golomb_cache *cache,
+    struct golomb_cache_stats *stats)
+{
+  struct golomb_cache_shard *s;
+  int i;
+
+  if (!stats) return;
+  memset (stats, 0, sizeof (*stats));
+  if (!cache || !cache->shards) return;
+
+  for (i = 0; i < cache->nshards; ++i) {
+    s = &cache->shards[i];
+    pthread_mutex_lock (&s->lock);
+    stats->hits += s->hits;
+    stats->misses += s->misses;
+    stats->evictions += s->evictions;
+    stats->entries += s->entries;
+    stats->bytes += s->bytes;
+    pthread_mutex_unlock (&s->lock);
+  }
+}
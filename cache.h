@@ -0,0 +1,81 @@
+/*
+ * A cache of decoded blocks for serving lookups against block-encoded
+ * filters (block.h), so that hot blocks are decoded once rather than
+ * on every query. Blocks are keyed by a filter id of the caller's
+ * choosing and the block number, and spread over shards by a hash of
+ * the two, each shard a hash table and an LRU list behind its own
+ * mutex; a miss decodes outside the lock (two threads missing on the
+ * same block may both decode it, and one copy is kept). The memory
+ * the blocks take is held to a byte budget, split evenly between the
+ * shards, by evicting the least recently used.
+ *
+ * golomb_cache_get hands out the block pinned, so it can't be freed
+ * under the caller by an eviction on another thread; golomb_cache_put
+ * unpins it. Pinned blocks are never evicted, so a shard can go over
+ * its budget by as much as is pinned at once.
+ *
+ * The ids are only compared: a filter that changes needs a new id, or
+ * golomb_cache_invalidate on the old one once lookups have moved on to
+ * the new 'info'. Each shard counts the invalidations, and a miss that
+ * was decoding while one happened hands its block to the caller
+ * without caching it, so lookups of the old filter still under way
+ * can't put it back.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.h"
+
+#define GOLOMB_CACHE_DEFAULT_SHARDS 16
+
+struct golomb_cache_shard;
+struct golomb_cache_entry;
+
+struct golomb_cache {
+  struct golomb_cache_shard *shards;
+  int nshards;
+  size_t budget;              /* bytes, for all the shards */
+};
+
+/* counters, summed over the shards */
+struct golomb_cache_stats {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t entries;           /* blocks held now */
+  uint64_t bytes;             /* ... and what they take */
+};
+
+int
+golomb_cache_init (struct golomb_cache *cache, size_t budget, int nshards);
+
+void
+golomb_cache_destroy (struct golomb_cache *cache);
+
+int
+golomb_cache_get (struct golomb_cache *cache, uint64_t filter_id,
+    const struct golomb_block_info *info, size_t block,
+    const unsigned char **data, struct golomb_cache_entry **entry);
+
+void
+golomb_cache_put (struct golomb_cache *cache,
+    struct golomb_cache_entry *entry);
+
+int
+golomb_cache_test_bit (struct golomb_cache *cache, uint64_t filter_id,
+    const struct golomb_block_info *info, uint64_t pos, int *bit);
+
+void
+golomb_cache_invalidate (struct golomb_cache *cache, uint64_t filter_id);
+
+void
+golomb_cache_get_stats (struct golomb_cache *cache,
+    struct golomb_cache_stats *stats);
+
+#endif /* __CACHE_H */
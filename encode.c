@@ -14,24 +14,87 @@
 #include <math.h>
 
 #include "encode.h"
+#include "pack.h"
 
 #define CHUNK 8192
 #define CHUNK_2 16384
 #define BUF_REALLOC_PENALTY 3
-#define MAX_INPUT_SIZE 131072 /* 128 KB */
+
+/* gaps decoded at a time by golomb_decode before they're applied */
+#define DECODE_BATCH 1024
+
+/* streams golomb_decode_many advances side by side */
+#define DECODE_LANES 8
+
+/* the most a decoder allocates up front on its guess of the output
+ * size; past that it grows as it goes */
+#define DECODE_GUESS_MAX ((size_t) 64 << 20)
 
 
 /*
- * XXX
- * these two are static buffers used to write encoded output, both
- * during run-length encoding/decoding and golomb encoding/decoding.
- * We need them to be greater than the max. input size we expect as some
- * run-length encodings will actually be longer than the input. 10 times
- * the max.input length seems reasonable (about 4 MB each, i think..)
- *
+ * Instrumentation (see encode.h). A function that counts declares its
+ * own golomb_stats with STATS_DECLARE, times its stages with
+ * STATS_START/STATS_STOP and hands them over with STATS_DONE; without
+ * GOLOMB_STATS these are all nothing.
  */
-unsigned int rle_buf[10*MAX_INPUT_SIZE];
-unsigned int golomb_buf[10*MAX_INPUT_SIZE];
+#ifdef GOLOMB_STATS
+#include <time.h>
+
+static struct golomb_stats stats_totals[GOLOMB_STATS_OPS];
+static golomb_stats_callback stats_fn;
+static void *stats_arg;
+
+static inline uint64_t
+stats_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* add a call to the totals for its kind, which other threads may be
+ * adding to as well, and pass it to the callback */
+static void
+stats_done (int op, const struct golomb_stats *call)
+{
+  struct golomb_stats *t = &stats_totals[op];
+
+#define STATS_SUM(f) __atomic_fetch_add (&t->f, call->f, __ATOMIC_RELAXED)
+  STATS_SUM (calls);
+  STATS_SUM (bytes_in);
+  STATS_SUM (bytes_out);
+  STATS_SUM (runs);
+  STATS_SUM (complemented);
+  STATS_SUM (reallocs);
+  STATS_SUM (expanded);
+  STATS_SUM (ns_density);
+  STATS_SUM (ns_rle);
+  STATS_SUM (ns_pack);
+  STATS_SUM (ns_alloc);
+#undef STATS_SUM
+  __atomic_store_n (&t->b, call->b, __ATOMIC_RELAXED);
+
+  if (stats_fn)
+    stats_fn (op, call, stats_arg);
+}
+
+#define STATS_DECLARE \
+  struct golomb_stats st_ = { .calls = 1 }; uint64_t st_t_;
+#define STATS_START() (st_t_ = stats_now ())
+#define STATS_STOP(ns) (st_.ns += stats_now () - st_t_)
+#define STATS_SET(f, v) (st_.f = (v))
+#define STATS_ADD(f, v) (st_.f += (v))
+#define STATS_DONE(op) stats_done ((op), &st_)
+#else
+#define STATS_DECLARE
+#define STATS_START() ((void) 0)
+#define STATS_STOP(ns) ((void) 0)
+#define STATS_SET(f, v) ((void) 0)
+#define STATS_ADD(f, v) ((void) 0)
+#define STATS_DONE(op) ((void) 0)
+#endif /* GOLOMB_STATS */
+
+
 
 /*
  *
@@ -49,42 +112,80 @@ unsigned int golomb_buf[10*MAX_INPUT_SIZE];
 
 
 
+/* each byte with its bits in the opposite order, for LSB first input */
+static const unsigned char bit_reverse[256] = {
+  0, 128, 64, 192, 32, 160, 96, 224, 16, 144, 80, 208,
+  48, 176, 112, 240, 8, 136, 72, 200, 40, 168, 104, 232,
+  24, 152, 88, 216, 56, 184, 120, 248, 4, 132, 68, 196,
+  36, 164, 100, 228, 20, 148, 84, 212, 52, 180, 116, 244,
+  12, 140, 76, 204, 44, 172, 108, 236, 28, 156, 92, 220,
+  60, 188, 124, 252, 2, 130, 66, 194, 34, 162, 98, 226,
+  18, 146, 82, 210, 50, 178, 114, 242, 10, 138, 74, 202,
+  42, 170, 106, 234, 26, 154, 90, 218, 58, 186, 122, 250,
+  6, 134, 70, 198, 38, 166, 102, 230, 22, 150, 86, 214,
+  54, 182, 118, 246, 14, 142, 78, 206, 46, 174, 110, 238,
+  30, 158, 94, 222, 62, 190, 126, 254, 1, 129, 65, 193,
+  33, 161, 97, 225, 17, 145, 81, 209, 49, 177, 113, 241,
+  9, 137, 73, 201, 41, 169, 105, 233, 25, 153, 89, 217,
+  57, 185, 121, 249, 5, 133, 69, 197, 37, 165, 101, 229,
+  21, 149, 85, 213, 53, 181, 117, 245, 13, 141, 77, 205,
+  45, 173, 109, 237, 29, 157, 93, 221, 61, 189, 125, 253,
+  3, 131, 67, 195, 35, 163, 99, 227, 19, 147, 83, 211,
+  51, 179, 115, 243, 11, 139, 75, 203, 43, 171, 107, 235,
+  27, 155, 91, 219, 59, 187, 123, 251, 7, 135, 71, 199,
+  39, 167, 103, 231, 23, 151, 87, 215, 55, 183, 119, 247,
+  15, 143, 79, 207, 47, 175, 111, 239, 31, 159, 95, 223,
+  63, 191, 127, 255
+};
+
 /*
  * The main RLE function. Takes as input an unsigned char buffer, and
- * outputs the RLE as an unsigned int buf. This function automatically
+ * outputs the RLE as a uint64_t buf. This function automatically
  * adds a last unsigned char of all 1s (ie., value 255) so that we don't
  * come to the problem of having a hanging ends-in-zero marker, if the
  * last char of the input ends in a 0. This char is automatically
  * removed after you do run-length decode
+ *
+ * Every input char is xor'ed with 'flip' first, so a flip of 255 gives
+ * the RLE of the complement without making a copy of it. 'setbits' is
+ * the number of bits set after flipping, for sizing the output. With
+ * GOLOMB_ORDER_LSB each char is read LSB first, through bit_reverse.
  */
 
-int
-get_run_length_encoding (unsigned char *in, 
-    unsigned long size,
-    unsigned int **out,
-    unsigned long *outsize)
+static int
+run_length_encode (const unsigned char *in, 
+    size_t size,
+    unsigned char flip,
+    int order,
+    size_t setbits,
+    uint64_t **out,
+    size_t *outsize)
 {
-  unsigned int *rle;
-  int i, j;
-  int rle_index = 0;
+  uint64_t *rle;
+  size_t i, rle_index = 0;
+  int j;
   int need_to_splice = 0;
-  unsigned char allones = 255;
+  unsigned char allones = 255, c;
 
-  rle = rle_buf;
+  /* one run per set bit, eight for the all-ones char, and at most a
+   * trailing run of zeros and its marker waiting to be spliced */
+  if ( !(rle = malloc (sizeof (uint64_t) * (setbits + 8 + 2))) ) {
+    perror ("cant malloc: ");
+    return 1;
+  }
 
   for (i = 0; i < size; ++i) {
-    //printf ("got char %d\n", in[i]);
-    for (j = 0; j < rle_lookup_sizes[in[i]]; ++j) {
+    c = (order == GOLOMB_ORDER_LSB) ? bit_reverse[in[i]] : in[i];
+    c ^= flip;
+    //printf ("got char %d\n", c);
+    for (j = 0; j < rle_lookup_sizes[c]; ++j) {
       if (!j && need_to_splice) {
         //printf ("splicing..");
-        if (rle_lookup[in[i]][0] > 1) {
+        if (rle_lookup[c][0] > 1) {
           /* this means that the first bit is a run of one or more
            * zeros.  so we can successfully splice with the previous set
            * */
-          //assert (rle_index > 7);
-          //printf ("increased %d with %d\n", 
-              //rle[rle_index - 2], rle_lookup[in[i]][0]);
-          rle[rle_index - 2] += rle_lookup[in[i]][0];
+          rle[rle_index - 2] += rle_lookup[c][0];
           rle_index--;
         } else { 
           /* darn, the first entry is a 1 (ie, the first bit is a 1), so
@@ -96,8 +197,8 @@ get_run_length_encoding (unsigned char *in,
         }
         need_to_splice = 0;
       } else {
-        rle[rle_index++] = rle_lookup[in[i]][j];
-        //printf ("writing %d\n", rle_lookup[in[i]][j]);
+        rle[rle_index++] = rle_lookup[c][j];
+        //printf ("writing %d\n", rle_lookup[c][j]);
       }
     }
 
@@ -113,9 +214,6 @@ get_run_length_encoding (unsigned char *in,
         /* this means that the first bit is a run of one or more
          * zeros.  so we can successfully splice with the previous set
          * */
-        //assert (rle_index > 7);
-        //printf ("increased %d with %d\n", 
-            //rle[rle_index - 2], rle_lookup[allones][0]);
         rle[rle_index - 2] += rle_lookup[allones][0];
         rle_index--;
       } else { 
@@ -132,70 +230,164 @@ get_run_length_encoding (unsigned char *in,
     }
   }
 
-  if ( !(*out = malloc (sizeof (unsigned int) * (rle_index))) ) {
-    perror ("cant malloc: ");
-    return 1;
-  }
-
-  if ( !(memcpy (*out, rle, sizeof (unsigned int) * (rle_index))) ) {
-    perror ("cant memcpy: ");
-    free (*out);
-    return 1;
-  }
-
+  *out = rle;
   *outsize = rle_index;
   return 0;
 }
 
+int
+get_run_length_encoding (const unsigned char *in, 
+    size_t size,
+    uint64_t **out,
+    size_t *outsize)
+{
+  return get_run_length_encoding_order (in, size, GOLOMB_ORDER_MSB, 
+      out, outsize);
+}
+
+/* the same, reading the input's bits in 'order' */
+int
+get_run_length_encoding_order (const unsigned char *in, 
+    size_t size,
+    int order,
+    uint64_t **out,
+    size_t *outsize)
+{
+  if (order != GOLOMB_ORDER_MSB && order != GOLOMB_ORDER_LSB) return -1;
+
+  return run_length_encode (in, size, 0, order, num_set_bits (in, size), 
+      out, outsize);
+}
+
+
+/*
+ * Bit 'k' of a byte counting from the first in 'order': xor'ed with
+ * this, k is the shift that sets it
+ */
+static inline int
+order_xor (int order)
+{
+  return (order == GOLOMB_ORDER_LSB) ? 0 : 7;
+}
+
+/* apply_run_lengths, with the bit in each byte xor'ed with 'x' */
+static inline void
+apply_runs (const uint64_t *in, size_t n, unsigned char *out,
+    uint64_t *pos, int x)
+{
+  uint64_t p = *pos;
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    p += in[i];
+    out[(p - 1) >> 3] |= 1 << (((p - 1) & 7) ^ x);
+  }
+  *pos = p;
+}
+
+/*
+ * Set the bits that the runs in 'in' land on, starting from bit
+ * '*pos' (one past the last bit set so far, counting from 1 like the
+ * runs do). 'out' must be zeroed and big enough.
+ */
+void
+apply_run_lengths (const uint64_t *in, size_t n, unsigned char *out,
+    uint64_t *pos)
+{
+  apply_runs (in, n, out, pos, 7);
+}
 
 /*
- * Decode the unsigned integer buffer obtained above. Output is returned
+ * Decode the integer buffer obtained above. Output is returned
  * as an unsigned char buffer
  */
  
 int 
-get_run_length_decoding (unsigned int *in,
-    unsigned long size,
+get_run_length_decoding (const uint64_t *in,
+    size_t size,
     unsigned char **out,
-    unsigned long *outsize)
+    size_t *outsize)
 {
-  int i;
-  int currindex, bytecounter;
-  unsigned char *currbyte;
-
-  currindex = 0;
-  bytecounter = 1;
+  return get_run_length_decoding_order (in, size, GOLOMB_ORDER_MSB, 
+      out, outsize);
+}
 
-  memset (rle_buf, 0, sizeof(unsigned int) * MAX_INPUT_SIZE);
-  currbyte = (unsigned char*) rle_buf;
+/* the same, setting the output's bits in 'order' */
+int 
+get_run_length_decoding_order (const uint64_t *in,
+    size_t size,
+    int order,
+    unsigned char **out,
+    size_t *outsize)
+{
+  uint64_t total, pos;
+  size_t i;
 
-  //printf ("last at %d: %d\n", size, in[size-1]);
+  if (order != GOLOMB_ORDER_MSB && order != GOLOMB_ORDER_LSB) return -1;
 
-  for (i = 0; i < size; ++i) {
-    currindex += in[i];
-    while (currindex > 8) {
-      currbyte++;
-      currindex -= 8;
-      bytecounter++;
-    }
-    *currbyte |= 1 << (8 - currindex);
-    //printf ("setting bit %d of byte %d\n", 
-        //currindex, bytecounter);
+  /* a zero run or a total that overflows would put bits outside the
+   * output */
+  for (i = 0, total = 0; i < size; ++i) {
+    if (!in[i] || total + in[i] < total) return -1;
+    total += in[i];
   }
 
-  *outsize = bytecounter - 1;
-  if ( !(*out= (unsigned char *) malloc (*outsize)) ) {
+  /* the last set bit is in the all-ones char added by the encoder,
+   * which isn't part of the output */
+  *outsize = total ? (total - 1) >> 3 : 0;
+  if ( !(*out = (unsigned char *) calloc (*outsize + 1, 1)) ) {
     perror ("RLD: cannot malloc: ");
     return 1;
   }
 
-  if ( !(memcpy (*out, rle_buf, *outsize)) ) {
-    perror ("RLD: cannot memcpy: ");
-    free (*out);
-    return 1;
+  pos = 0;
+  apply_runs (in, size, *out, &pos, order_xor (order));
+  return 0;
+}
+
+
+/*
+ * Gaps between the set bits of 'in', in the same convention as the
+ * run lengths above: the first gap is the position of the first set
+ * bit plus one, so apply_run_lengths() puts the bits back. Unlike the
+ * RLE there is no all-ones marker; the caller keeps the count instead.
+ * 'gaps' needs room for one entry per set bit. Returns the count.
+ */
+static size_t
+bit_gaps (const unsigned char *in, size_t size, unsigned char flip,
+    uint64_t *gaps)
+{
+  uint64_t pos, last = 0;
+  size_t i, n = 0;
+  unsigned int c;
+  int bit;
+
+  for (i = 0; i < size; ++i) {
+    c = in[i] ^ flip;
+    while (c) {
+      bit = __builtin_clz (c) - 24;   /* MSB first, like the RLE */
+      pos = (uint64_t) i * 8 + bit + 1;
+      gaps[n++] = pos - last;
+      last = pos;
+      c &= ~(0x80u >> bit);
+    }
   }
 
-  return 0;
+  return n;
+}
+
+size_t
+get_set_bit_gaps (const unsigned char *in, size_t size, uint64_t *gaps)
+{
+  return bit_gaps (in, size, 0, gaps);
+}
+
+/* the same for the clear bits, for coding the complement of a dense
+ * bitmap */
+size_t
+get_clear_bit_gaps (const unsigned char *in, size_t size, uint64_t *gaps)
+{
+  return bit_gaps (in, size, 255, gaps);
 }
 
 
@@ -262,30 +454,6 @@ char *h2b[] = {
   "1100", "1101", "1110", "1111"
 };
 
-/*
- * This function finds ceil (log (base 2, n))
- */
-inline int
-ceil_log2 (int b) {
-  int last = -1, secondlast = -1, count = 0;
-  int log2_b, tmp = b;
-
-  while (tmp) {
-    if (tmp & 1) {
-      secondlast = last;
-      last = count;
-    }
-    tmp >>= 1;
-    ++count;
-  }
-  if (secondlast == -1)
-    log2_b = last;
-  else
-    log2_b = last+1;
-
-  return log2_b;
-}
-
 /* an array to help with the num_set_bits function that follows.
  * Records the number of set bits for each value of an unsigned char */
 const unsigned char set_bits_lookup_table[256] = 
@@ -328,10 +496,10 @@ const unsigned char set_bits_lookup_table[256] =
    This function uses a lookup table to quickly find the number of bits
    set in a char array of size 'size'
 */
-static unsigned long 
-num_set_bits (unsigned char *input, unsigned long size)
+size_t 
+num_set_bits (const unsigned char *input, size_t size)
 {
-  unsigned long count = 0, i = 0;
+  size_t count = 0, i = 0;
   while (i < size)
     count += set_bits_lookup_table[input[i++]];
   return count;
@@ -339,78 +507,95 @@ num_set_bits (unsigned char *input, unsigned long size)
 
 
 /*
- *
- * Encoding function: golomb encoding
- *
- * Golomb encoding is done on a sequence of positive integers.
- * Typically, if you want to encode an arbitrary char buffer, you should
- * first run-length encode it (which will give you an
- * all-positive-integer buffer, which you can provide to golomb
- * encoding. 
- *
- * The input is the positive integer buffer, and the output is the
- * encoded buffer (say a char *), and a parameter for the encoding (see
- * the reference above for details), which is typically calculated as a
- * function of the number of set bits in the (original) input. The more
- * sparse the input, the better the compression (duh!).
+ * Golomb code kernels. These work on a sequence of positive integers
+ * (run lengths, or gaps between sorted values) and a caller-supplied
+ * bit buffer, so that anything that can produce gaps -- the RLE below,
+ * a sorted list of hashes, a block of a bitmap -- can share the same
+ * coder. Bits are filled MSB first, as everywhere else in this file.
+ * Gaps, parameters and bit positions are all 64 bit, so bitmaps past
+ * 2^32 bits and very long runs are fine.
  */
 
-int
-golomb_encode (void *input,
-    unsigned long input_len,
-    void **out,
-    unsigned long *outsize,
-    unsigned int *golomb_param)
+/*
+ * The Golomb parameter for a bitmap of 'nbits' bits with 'ones' of
+ * them set: runs are geometric with p = ones / nbits, and b is picked
+ * so that p^b is about 1/2. Clamped to [1, nbits], as no run can be
+ * longer than the bitmap.
+ */
+uint64_t
+golomb_optimal_param (uint64_t ones, uint64_t nbits)
 {
-  unsigned long setbits, currindex, size, rle_size;
-  int b, i;
-  int q, r;
-  int d, bytecounter;
-  unsigned int *rle;
-  unsigned int log2_b;
-  unsigned char *currbyte, *in;
-  float prob;
+  double b;
 
-  in = (unsigned char*) input;
-  size = input_len;
-
-  if (!in) return -1;
+  if (!ones || ones > nbits)
+    return nbits ? nbits : 1;
+  if (ones == nbits)
+    return 1;
 
-  setbits = size * 8 - num_set_bits (in, size); /* from bf.h */
-  prob = (float)setbits / (float)(size * 8);
+  b = ceil (-(LN2 / log1p (-(double) ones / (double) nbits)));
+  if (b < 1.0)
+    return 1;
+  if (b > (double) nbits)
+    return nbits;
+  return (uint64_t) b;
+}
 
-  //printf ("set bits in input: %lu\n", setbits);
-  //b = (int) ceilf (LN2 * (float) (size * 8.0) / (float) setbits);
-  b = (int) ceilf (-(LN2 / (float) (logf (prob))));
-  //b = 3;
+/*
+ * Number of bits golomb_encode_gaps() will need to code 'n' gaps
+ * with parameter 'b'
+ */
+uint64_t
+golomb_gaps_bits (const uint64_t *gaps, size_t n, uint64_t b)
+{
+  uint64_t q, r, d, bits = 0;
+  size_t i;
+  int log2_b;
 
-  /* b+=2; */
+  if (!b) return 0;
 
-  //printf ("p = %f, b = %d\n",(float) setbits / (float) (size * 8.0), b);
+  log2_b = ceil_log2 (b);
+  d = (1ULL << log2_b) - b;
 
-  if (get_run_length_encoding (in, size, &rle, &rle_size) ) {
-    fprintf (stderr, "golomb encode: error with RLE\n");
-    return 1;
+  for (i = 0; i < n; ++i) {
+    q = (gaps[i] - 1) / b;
+    r = gaps[i] - q * b;
+    bits += q + 1 + ((r > d) ? log2_b : log2_b - 1);
   }
 
-  memset (golomb_buf, 0, sizeof(unsigned int) * MAX_INPUT_SIZE);
-  currbyte = (unsigned char*) golomb_buf;
-  currindex = 0; bytecounter = 0;
+  return bits;
+}
+
+/*
+ * Golomb code 'n' gaps (each >= 1) with parameter 'b' into 'out',
+ * starting at bit '*bitpos'. 'out' must be zeroed and have room for
+ * golomb_gaps_bits() more bits. On return '*bitpos' points just past
+ * the last code word written.
+ */
+int
+golomb_encode_gaps (const uint64_t *gaps, size_t n, uint64_t b,
+    unsigned char *out, uint64_t *bitpos)
+{
+  uint64_t q, r, d, currindex, bytecounter;
+  size_t i;
+  int log2_b;
+  unsigned char *currbyte;
+
+  if (!gaps || !out || !b) return -1;
+
+  bytecounter = *bitpos >> 3;
+  currindex = *bitpos & 7;
+  currbyte = out + bytecounter;
 
   /* this is for the ceil (log_{2} (b) ) 
    * needed in minimal binary decode
    * need to compute only once 
    */
   log2_b = ceil_log2 (b);
+  d = (1ULL << log2_b) - b;
 
-  //printf ("log2_b = %d\n", log2_b);
-
-  /* main loop reading RLE input */
-  for (i = 0; i < rle_size; ++i) {
-    q = (rle[i] - 1) / b;
-    r = rle[i] - q * b;
-
-    //printf ("q: %d, r: %d\n", q, r);
+  for (i = 0; i < n; ++i) {
+    q = (gaps[i] - 1) / b;
+    r = gaps[i] - q * b;
 
     /* unary encode (q + 1) */
     ++q;
@@ -424,9 +609,6 @@ golomb_encode (void *input,
       }
     }
 
-    //printf ("after encoding quotient byte %d = %s %s\n",
-        //bytecounter, h2b[*currbyte >> 4], h2b[*currbyte & 0x0f]);
-    
     /* equivalent to putting the last 0 */
     currindex++;
 
@@ -437,161 +619,1234 @@ golomb_encode (void *input,
     }
 
     /* minimal binary encode (r, b) */
-    d = (1 << log2_b) - b;
-    //printf ("d = %d\n", d);
-
     if (r > d) {
-      /* put_one_integer (r - 1 + d, log2_b) */
       PUT_ONE_INTEGER (r - 1 + d, log2_b);
     } else {
       PUT_ONE_INTEGER (r - 1, log2_b - 1);
     }
+  }
 
-    //printf ("after encoding remainder byte %d (%d)= %s %s\n",
-        //bytecounter, currindex, h2b[*currbyte >> 4], h2b[*currbyte & 0x0f]);
+  *bitpos = bytecounter * 8 + currindex;
+  return 0;
+}
 
+/*
+ * A minimal binary remainder is 'log2_b' bits long rather than one
+ * less when its first log2_b - 1 bits are at least 'd'. This is that
+ * threshold as a 64 bit window with the remainder at the top, so the
+ * length is one compare away.
+ */
+static inline uint64_t
+remainder_long_min (int log2_b, uint64_t d)
+{
+  return d ? d << (65 - log2_b) : 0;
+}
+
+/*
+ * Decode up to 'n' code words with parameter 'b' from 'in', starting
+ * at bit '*bitpos' and stopping once '*bitpos' reaches 'endbit'.
+ * Returns the number of integers written to 'gaps'.
+ *
+ * Rather than walking the input a bit at a time, each code word is
+ * read out of a 64 bit window: the quotient is the count of leading
+ * ones, and the minimal binary remainder is the top bits after that.
+ */
+size_t
+golomb_decode_gaps (const unsigned char *in, uint64_t *bitpos,
+    uint64_t endbit, uint64_t b, uint64_t *gaps, size_t n)
+{
+  uint64_t w, x, q, d, long_min, mask, pos, endbyte;
+  size_t count;
+  int log2_b, ones, long_code;
+
+  if (!in || !gaps || !b) return 0;
+
+  pos = *bitpos;
+  endbyte = (endbit + 7) >> 3;
+
+  /* log2 hack */
+  log2_b = ceil_log2 (b);
+  d = (1ULL << log2_b) - b;
+  long_min = remainder_long_min (log2_b, d);
+
+  count = 0;
+  while (count < n && pos < endbit) {
+    /* q := unary_decode() - 1. Only 57 bits of a window are
+     * guaranteed valid, so very long runs take several windows */
+    q = 0;
+    for (;;) {
+      w = peek_bits64 (in, pos, endbyte);
+      ones = (~w) ? __builtin_clzll (~w) : 64;
+      if (ones < 57)
+        break;
+      q += 56;
+      pos += 56;
+    }
+    q += ones;
+    pos += ones + 1;
+
+    /* r = minimal_binary_decode (b). With b == 1 the remainder
+     * takes no bits at all */
+    x = 0;
+    if (log2_b) {
+      /* usually the remainder is still inside the same window. The
+       * next code word can't start until its length is known, so that
+       * comes from one compare of the window; the value itself is off
+       * the critical path */
+      if (ones + 1 + log2_b <= 57) {
+        w <<= ones + 1;
+        long_code = w >= long_min;
+        w >>= 64 - log2_b;
+      } else {
+        w = get_bits (in, pos, log2_b, endbyte);
+        long_code = (w >> 1) + 1 > d;
+      }
+
+      /* which case we're in is as good as random, so pick with a
+       * mask: left as ?:, the compiler sometimes makes it a branch */
+      mask = -(uint64_t) long_code;
+      x = ((w - d) & mask) | ((w >> 1) & ~mask);
+      pos += log2_b - 1 + long_code;
+    }
+
+    /* a code word running past 'endbit' was cut short by the
+     * encoder keeping only whole bytes; it is not part of the data */
+    if (pos > endbit) {
+      pos = endbit;
+      break;
+    }
+
+    /* decode integer */
+    gaps[count++] = x + 1 + q * b;
   }
 
-  *outsize = bytecounter;
-  if ( !(*out = malloc (*outsize) ) ) {
-    perror ("golombencode: cannot malloc output buf: ");
+  *bitpos = pos;
+  return count;
+}
+
+
+/*
+ *
+ * Encoding function: golomb encoding
+ *
+ * Golomb encoding is done on a sequence of positive integers.
+ * Typically, if you want to encode an arbitrary char buffer, you should
+ * first run-length encode it (which will give you an
+ * all-positive-integer buffer, which you can provide to golomb
+ * encoding. 
+ *
+ * The input is the positive integer buffer, and the output is the
+ * encoded buffer (say a char *), and a parameter for the encoding (see
+ * the reference above for details), which is typically calculated as a
+ * function of the number of set bits in the (original) input. The more
+ * sparse the input, the better the compression (duh!).
+ */
+
+int
+golomb_encode (const void *input,
+    size_t input_len,
+    void **out,
+    size_t *outsize,
+    uint64_t *golomb_param)
+{
+  return golomb_encode_order (input, input_len, GOLOMB_ORDER_MSB, out,
+      outsize, golomb_param);
+}
+
+/*
+ * golomb_encode with the input's bits read in 'order'. With
+ * GOLOMB_ORDER_LSB, bit i of the input is bit i % 8 of byte i / 8 (bit
+ * i % 64 of 64 bit word i / 64 on a little endian machine), and the
+ * parameter returned has GOLOMB_PARAM_LSB set, so golomb_decode puts
+ * the bits back the same way.
+ */
+int
+golomb_encode_order (const void *input,
+    size_t input_len,
+    int order,
+    void **out,
+    size_t *outsize,
+    uint64_t *golomb_param)
+{
+  uint64_t b, bits, bitpos, nbits;
+  size_t size, rle_size, ones;
+  uint64_t *rle;
+  const unsigned char *in;
+  unsigned char flip;
+  STATS_DECLARE
+
+  in = (const unsigned char*) input;
+  size = input_len;
+
+  if (!in) return -1;
+  if (order != GOLOMB_ORDER_MSB && order != GOLOMB_ORDER_LSB) return -1;
+
+  /* past half full, the runs of ones are shorter than the runs of
+   * zeros would be, so code the complement instead; the runs (and the
+   * time spent coding them) then scale with the minority bit */
+  STATS_START ();
+  ones = num_set_bits (in, size);
+  nbits = (uint64_t) size * 8;
+  flip = (ones > nbits / 2) ? 255 : 0;
+  if (flip)
+    ones = nbits - ones;
+
+  b = golomb_optimal_param (ones, nbits);
+  STATS_STOP (ns_density);
+
+  STATS_START ();
+  if (run_length_encode (in, size, flip, order, ones, &rle, &rle_size) ) {
+    fprintf (stderr, "golomb encode: error with RLE\n");
     return 1;
   }
+  STATS_STOP (ns_rle);
 
-  if ( !(memcpy (*out, golomb_buf, *outsize) ) ) {
-    perror ("golombencode: cannot memcpy to output: ");
-    free (*out);
+  STATS_START ();
+  bits = golomb_gaps_bits (rle, rle_size, b);
+  STATS_STOP (ns_pack);
+  STATS_START ();
+  if ( !(*out = calloc ((bits >> 3) + 1, 1) ) ) {
+    perror ("golombencode: cannot malloc output buf: ");
+    free (rle);
     return 1;
   }
+  STATS_STOP (ns_alloc);
 
-  //*golomb_param = log2_b;
-  *golomb_param = b;
-
+  /* main loop reading RLE input */
+  STATS_START ();
+  bitpos = 0;
+  golomb_encode_gaps (rle, rle_size, b, *out, &bitpos);
+  STATS_STOP (ns_pack);
+  free (rle);
+
+  /* only whole bytes are kept; the trailing partial byte holds
+   * nothing but code words for the all-ones marker char */
+  *outsize = bitpos >> 3;
+  *golomb_param = flip ? (b | GOLOMB_PARAM_COMPLEMENT) : b;
+  if (order == GOLOMB_ORDER_LSB)
+    *golomb_param |= GOLOMB_PARAM_LSB;
+
+  STATS_SET (bytes_in, size);
+  STATS_SET (bytes_out, *outsize);
+  STATS_SET (runs, rle_size);
+  STATS_SET (b, b);
+  STATS_SET (complemented, flip ? 1 : 0);
+  STATS_SET (expanded, *outsize > size);
+  STATS_DONE (GOLOMB_STATS_ENCODE);
   return 0;
 }
 
 /*
  * Decode a golomb-encoded input. This function also requires the
- * parameter returned by the golomb encode funciton above
+ * parameter returned by the golomb encode funciton above. The run
+ * lengths are applied to the output as they're decoded, a batch at a
+ * time, rather than being collected for get_run_length_decoding. If
+ * the parameter says the complement was coded, the output is flipped
+ * back at the end.
+ */
+
+/*
+ * A guess at the size of what a golomb_encode output of 'len' bytes
+ * decodes to, so the decoder doesn't have to grow (and copy) its
+ * output more than once or twice. The gaps are about geometric with
+ * mean b / ln 2 and take about log2 (b) + 1.5 bits each; pad that by
+ * an eighth.
  */
+static size_t
+decode_size_guess (size_t len, uint64_t b)
+{
+  double guess = (double) len * b / LN2 / (ceil_log2 (b) + 1.5) * 1.125;
+
+  if (guess < CHUNK_2) return CHUNK_2;
+  if (guess > DECODE_GUESS_MAX) return DECODE_GUESS_MAX;
+  return (size_t) guess;
+}
+
+/*
+ * golomb_decode and golomb_decode_safe. Reads never go past the input
+ * (peek_bits64 reads the bytes past its end as zeros, with one compare
+ * per window), and every batch of gaps is checked before it's applied,
+ * so writes stay inside the output whatever the input holds: a gap of
+ * zero (a quotient that overflowed) is corrupt, and output past
+ * 'max_output' bytes is refused before it's allocated.
+ *
+ * With 'strict', the end of the stream is checked too. golomb_encode
+ * drops under a byte of the last code words, all of them for the
+ * all-ones char the RLE adds, so what's left after the last whole code
+ * word is shorter than one of those, and the last bit decoded is in
+ * a byte whose bits up to it are all set, most of them. Anything else
+ * was cut short or damaged. (There's no checksum, so damage that
+ * happens to decode cleanly gets through.)
+ */
+static int
+decode_checked (const unsigned char *in, size_t input_len,
+    uint64_t golomb_param, size_t max_output, int strict, void **out,
+    size_t *outsize)
+{
+  uint64_t gaps[DECODE_BATCH];
+  uint64_t bitpos, before, endbit, pos, last, limit, tail, hi, lo;
+  size_t i, n, cap, need;
+  unsigned char *buf, *tmp, mask;
+  uint64_t b;
+  int log2_b, one, x;
+
+  b = golomb_param & ~GOLOMB_PARAM_FLAGS;
+  if (!in || !b || !out || !outsize) return GOLOMB_ERR_ARGS;
+  x = order_xor ((golomb_param & GOLOMB_PARAM_LSB) ? GOLOMB_ORDER_LSB : 
+      GOLOMB_ORDER_MSB);
+
+  /* the output and the all-ones char after it, in bits */
+  limit = (max_output < (1ULL << 49)) ? 
+    ((uint64_t) max_output + 1) * 8 : 1ULL << 52;
+
+  cap = decode_size_guess (input_len, b);
+  if (cap > limit / 8)
+    cap = limit / 8;
+  if ( !(buf = calloc (cap, 1)) ) {
+    perror ("golombdecode: cannot malloc output buf: ");
+    return GOLOMB_ERR_NOMEM;
+  }
+
+  bitpos = before = 0; pos = 0; n = 0;
+  endbit = (uint64_t) input_len * 8;
+
+  while (bitpos < endbit) {
+    before = bitpos;
+    n = golomb_decode_gaps (in, &bitpos, endbit, b, gaps, 
+        DECODE_BATCH);
+    if (!n) break;
+
+    /* checked a batch at a time, off the per gap path; with 'limit'
+     * under 2^53 a batch of gaps no bigger than it can't overflow */
+    for (i = 0, last = pos, hi = 0, lo = ~0ULL; i < n; ++i) {
+      last += gaps[i];
+      hi = (gaps[i] > hi) ? gaps[i] : hi;
+      lo = (gaps[i] < lo) ? gaps[i] : lo;
+    }
+    if (!lo) goto corrupt;
+    if (hi > limit || last > limit) {
+      free (buf);
+      return GOLOMB_ERR_TOO_BIG;
+    }
+
+    /* grow the output the way zlib_decode does, zeroing the new tail
+     * since runs only ever set bits */
+    if (((last - 1) >> 3) >= cap) {
+      need = ((last - 1) >> 3) + 1;
+      need = need > cap * 2 ? need : cap * 2;
+      if (need > limit / 8)
+        need = limit / 8;
+      if ( !(tmp = realloc (buf, need)) ) {
+        perror ("golombdecode: cannot realloc output buf: ");
+        free (buf);
+        return GOLOMB_ERR_NOMEM;
+      }
+      buf = tmp;
+      memset (buf + cap, 0, need - cap);
+      cap = need;
+    }
+
+    apply_runs (gaps, n, buf, &pos, x);
+  }
+
+  /* drop the all-ones char the RLE added */
+  *outsize = pos ? (pos - 1) >> 3 : 0;
+
+  if (strict) {
+    /* the last batch skipped any code word cut short, so where its
+     * whole ones end is worked out from their gaps */
+    tail = endbit - before - (n ? golomb_gaps_bits (gaps, n, b) : 0);
+
+    /* each of the all-ones char's gaps of one takes 'one' bits, and
+     * the dropped bits (under 8) cut into as few of them as that
+     * allows; the rest of the char is there */
+    log2_b = ceil_log2 (b);
+    one = 1 + log2_b - ((1ULL << log2_b) != b);
+    if (tail >= one || !pos) goto truncated;
+    if (((pos - 1) & 7) + 1 < 8 - (7 + one - 1) / one) goto truncated;
+
+    mask = x ? 0xff << (7 - ((pos - 1) & 7)) : 
+      0xff >> (7 - ((pos - 1) & 7));
+    if ((buf[*outsize] & mask) != mask) goto truncated;
+  }
+
+  if (golomb_param & GOLOMB_PARAM_COMPLEMENT)
+    for (i = 0; i < *outsize; ++i)
+      buf[i] = ~buf[i];
+
+  *out = buf;
+  return 0;
+
+corrupt:
+  free (buf);
+  return GOLOMB_ERR_CORRUPT;
+
+truncated:
+  free (buf);
+  return GOLOMB_ERR_TRUNCATED;
+}
 
 int
-golomb_decode (void *input, unsigned long input_len, 
-    unsigned int golomb_param, void **out, 
-    unsigned long *outsize) 
+golomb_decode (const void *input, size_t input_len, 
+    uint64_t golomb_param, void **out, 
+    size_t *outsize) 
 {
-  unsigned long setbits, currindex, size, rle_size;
-  int b, i;
-  int x, q, r;
-  int d, bytecounter;
-  unsigned int *gd;
-  unsigned int log2_b;
-  unsigned char *currbyte, *in;
-  unsigned long decoded_rle_size;
+  return decode_checked ((const unsigned char*) input, input_len,
+      golomb_param, SIZE_MAX, 0, out, outsize);
+}
 
-  in = (unsigned char*) input;
-  size = input_len;
-  b = golomb_param;
+/*
+ * golomb_decode for input that can't be trusted: refuses to produce
+ * more than 'max_output' bytes, and checks that the stream ends the way
+ * golomb_encode's do. Returns 0 on success, or one of the GOLOMB_ERR_
+ * codes. No output is left allocated on error.
+ */
+int
+golomb_decode_safe (const void *input, size_t input_len,
+    uint64_t golomb_param, size_t max_output, void **out,
+    size_t *outsize)
+{
+  return decode_checked ((const unsigned char*) input, input_len,
+      golomb_param, max_output, 1, out, outsize);
+}
 
-  if (!in) return -1;
 
-  memset (golomb_buf, 0, sizeof (unsigned int) * MAX_INPUT_SIZE);
+/*
+ * One stream being decoded by golomb_decode_many: golomb_decode_gaps'
+ * state, the position of the last bit set and the growing output.
+ */
+struct decode_lane {
+  const unsigned char *in;
+  uint64_t bitpos, endbit, endbyte;
+  uint64_t b, d, long_min, pos;
+  int log2_b;
+  int x;                      /* order_xor of the stream's bit order */
+  int failed;                 /* the output couldn't grow */
+  unsigned char *buf;         /* NULL when the lane is idle */
+  size_t cap;
+  size_t stream;
+};
+
+static int
+lane_start (struct decode_lane *l, const struct golomb_stream *s,
+    size_t stream)
+{
+  l->cap = decode_size_guess (s->len, s->golomb_param & 
+      ~GOLOMB_PARAM_FLAGS);
+  if ( !(l->buf = calloc (l->cap, 1)) ) {
+    perror ("golomb decode many: cannot malloc output buf: ");
+    return 1;
+  }
+
+  l->in = (const unsigned char*) s->data;
+  l->bitpos = 0;
+  l->endbit = (uint64_t) s->len * 8;
+  l->endbyte = s->len;
+  l->b = s->golomb_param & ~GOLOMB_PARAM_FLAGS;
+  l->x = order_xor ((s->golomb_param & GOLOMB_PARAM_LSB) ? 
+      GOLOMB_ORDER_LSB : GOLOMB_ORDER_MSB);
+  l->log2_b = ceil_log2 (l->b);
+  l->d = (1ULL << l->log2_b) - l->b;
+  l->long_min = remainder_long_min (l->log2_b, l->d);
+  l->pos = 0;
+  l->failed = 0;
+  l->stream = stream;
+  return 0;
+}
+
+static int
+lane_grow (struct decode_lane *l, uint64_t byte)
+{
+  unsigned char *tmp;
+  size_t need = byte + 1 > l->cap * 2 ? byte + 1 : l->cap * 2;
 
-  currbyte = (unsigned char*) in;
-  gd = (unsigned int*) golomb_buf;
+  if ( !(tmp = realloc (l->buf, need)) ) {
+    perror ("golomb decode many: cannot realloc output buf: ");
+    return 1;
+  }
+  memset (tmp + l->cap, 0, need - l->cap);
+  l->buf = tmp;
+  l->cap = need;
+  return 0;
+}
+
+/*
+ * Decode one code word of the lane and set its bit: the loop body of
+ * golomb_decode_gaps and apply_run_lengths. Returns 1 if it did, and 0
+ * at the end of the stream or if the output couldn't grow ('failed').
+ * It has to be inlined into the unrolled loop for the lanes to
+ * overlap, and gcc won't do that for eight copies on its own.
+ */
+static inline __attribute__ ((always_inline)) int
+lane_step (struct decode_lane *l)
+{
+  uint64_t w, x, q, mask, pos, byte;
+  int ones, long_code;
+
+  pos = l->bitpos;
+  if (pos >= l->endbit) return 0;
 
-  currindex = 0; bytecounter = 0;
   q = 0;
+  for (;;) {
+    w = peek_bits64 (l->in, pos, l->endbyte);
+    ones = (~w) ? __builtin_clzll (~w) : 64;
+    if (ones < 57)
+      break;
+    q += 56;
+    pos += 56;
+  }
+  q += ones;
+  pos += ones + 1;
+
   x = 0;
+  if (l->log2_b) {
+    if (ones + 1 + l->log2_b <= 57) {
+      w <<= ones + 1;
+      long_code = w >= l->long_min;
+      w >>= 64 - l->log2_b;
+    } else {
+      w = get_bits (l->in, pos, l->log2_b, l->endbyte);
+      long_code = (w >> 1) + 1 > l->d;
+    }
+    mask = -(uint64_t) long_code;
+    x = ((w - l->d) & mask) | ((w >> 1) & ~mask);
+    pos += l->log2_b - 1 + long_code;
+  }
 
-  /* log2 hack */
-  log2_b = ceil_log2 (golomb_param);
+  /* the cut short last code word, as in golomb_decode_gaps */
+  if (pos > l->endbit) {
+    l->bitpos = l->endbit;
+    return 0;
+  }
+  l->bitpos = pos;
 
-  //printf ("decode: log2_b = %d\n", log2_b);
+  l->pos += x + 1 + q * l->b;
+  byte = (l->pos - 1) >> 3;
+  if (byte >= l->cap && lane_grow (l, byte)) {
+    l->failed = 1;
+    return 0;
+  }
+  l->buf[byte] |= 1 << (((l->pos - 1) & 7) ^ l->x);
+  return 1;
+}
 
-  while (bytecounter < size) {
-    //printf ("byte: %d: %s %s\n", bytecounter,
-        //h2b[*currbyte >> 4], h2b[*currbyte & 0x0f]);
+static void
+lane_finish (struct decode_lane *l, const struct golomb_stream *s,
+    void **outputs, size_t *output_lens)
+{
+  size_t i, size;
 
-    /* q := unary_decode() - 1 */
-    q = 0;
-    while (*currbyte & (1 << (7 - currindex++))) {
-      ++q;
-      if (currindex >= 8) {
-        currbyte++;
-        bytecounter++;
-        currindex -= 8;
+  size = l->pos ? (l->pos - 1) >> 3 : 0;
+  if (s->golomb_param & GOLOMB_PARAM_COMPLEMENT)
+    for (i = 0; i < size; ++i)
+      l->buf[i] = ~l->buf[i];
+
+  outputs[l->stream] = l->buf;
+  output_lens[l->stream] = size;
+  l->buf = NULL;
+}
+
+
+/*
+ * Decode 'n' golomb_encode outputs, the same as calling golomb_decode
+ * on each. Each code word's start depends on the length of the one
+ * before, so one stream is a serial chain; this keeps DECODE_LANES
+ * streams going at once, taking one code word from each in turn, so
+ * the CPU can overlap their chains. A lane that finishes picks up the
+ * next stream. outputs[i] and output_lens[i] get stream i's result.
+ * Returns 0 on success, 1 on allocation failure (with no outputs
+ * left allocated) and -1 on bad arguments.
+ */
+int
+golomb_decode_many (const struct golomb_stream *streams, size_t n,
+    void **outputs, size_t *output_lens)
+{
+  struct decode_lane lanes[DECODE_LANES];
+  size_t next = 0, active = 0, i;
+  int l;
+
+  if (!streams || !outputs || !output_lens) return -1;
+  for (i = 0; i < n; ++i) {
+    if (!streams[i].data || 
+        !(streams[i].golomb_param & ~GOLOMB_PARAM_FLAGS))
+      return -1;
+    outputs[i] = NULL;
+  }
+
+  for (l = 0; l < DECODE_LANES; ++l)
+    lanes[l].buf = NULL;
+  for (l = 0; l < DECODE_LANES; ++l) {
+    if (next < n) {
+      if (lane_start (&lanes[l], &streams[next], next))
+        goto decode_many_error;
+      next++;
+      active++;
+    }
+  }
+
+  while (active) {
+    /* while every lane is busy, step them all with no branch between
+     * one lane's code word and the next lane's, so the out-of-order
+     * core sees all eight chains at once; stop after the first round
+     * in which any lane runs out. Spelled out since -O2 won't unroll
+     * a loop over the lanes */
+    if (active == DECODE_LANES)
+      while (lane_step (&lanes[0]) & lane_step (&lanes[1]) &
+          lane_step (&lanes[2]) & lane_step (&lanes[3]) &
+          lane_step (&lanes[4]) & lane_step (&lanes[5]) &
+          lane_step (&lanes[6]) & lane_step (&lanes[7]))
+        ;
+
+    for (l = 0; l < DECODE_LANES; ++l) {
+      if (!lanes[l].buf || lane_step (&lanes[l]))
+        continue;
+      if (lanes[l].failed)
+        goto decode_many_error;
+
+      lane_finish (&lanes[l], &streams[lanes[l].stream], outputs, 
+          output_lens);
+      active--;
+      if (next < n) {
+        if (lane_start (&lanes[l], &streams[next], next))
+          goto decode_many_error;
+        next++;
+        active++;
       }
     }
-    //--q;
+  }
 
+  return 0;
 
-    /* sanity check */
-    if (currindex >= 8) {
-      currbyte++;
-      bytecounter++;
-      currindex -= 8;
-    }
+decode_many_error:
+  for (l = 0; l < DECODE_LANES; ++l)
+    free (lanes[l].buf);
+  for (i = 0; i < n; ++i) {
+    free (outputs[i]);
+    outputs[i] = NULL;
+  }
+  return 1;
+}
 
-    //printf ("got q: %d, currbyte: %d, currindex: %d\n", 
-        //q, bytecounter, currindex);
 
-    /* r = minimal_binary_decode (b) */
-    d = (1 << log2_b) - b;
 
-    //printf ("d: %d, log2_b-1: %d\n", d, log2_b-1);
+/*
+ *
+ * Alternative codecs: Exp-Golomb and Elias-Fano. Golomb coding is
+ * only optimal when the gaps are geometric; skewed gap distributions
+ * (posting lists, clustered filters) often do better with one of
+ * these. Both take and return buffers the same way zlib_encode and
+ * zlib_decode do, and their output is self-describing: it starts
+ * with the input length and whatever parameters the decoder needs.
+ *
+ */
 
-    GET_ONE_INTEGER (log2_b - 1);
-    //printf ("got integer: %d\n", x);
+/* 
+ * Append the low 'nbits' (0 to 64) bits of 'v' at bit '*bitpos' of
+ * the zeroed buffer 'out', MSB first
+ */
+static inline void
+put_bits (unsigned char *out, uint64_t *bitpos, uint64_t v, int nbits)
+{
+  uint64_t pos = *bitpos;
+  int room, take;
+
+  while (nbits > 0) {
+    room = 8 - (pos & 7);
+    take = nbits < room ? nbits : room;
+    out[pos >> 3] |= ((v >> (nbits - take)) & ((1u << take) - 1)) << 
+      (room - take);
+    pos += take;
+    nbits -= take;
+  }
+  *bitpos = pos;
+}
 
-    //printf ("x+1 (%d) ~ d (%d)\n", x+1, d);
-    if (x + 1 > d) {
-      x = (x << 1) | ((*currbyte & (1 << (7 - currindex))) > 0);
-      x -= d;
-      currindex++;
-      if (currindex >= 8) {
-        currbyte++;
-        bytecounter++;
-        currindex -= 8;
+/* set bit 'x' (MSB first) of a bitmap */
+static inline void
+set_bit (unsigned char *out, uint64_t x)
+{
+  out[x >> 3] |= 0x80 >> (x & 7);
+}
+
+/*
+ * One pass of statistics over a bitmap's set bits: how many, where
+ * the last one is, exact counts of the small gaps and, for the rest,
+ * counts and sums by floor(log2(gap)). Enough to estimate the size of
+ * every codec here without coding anything; small gaps are where the
+ * estimates would otherwise go wrong, so those are exact.
+ */
+#define GAP_STATS_SMALL 64
+
+struct gap_stats {
+  uint64_t n;                       /* set bits */
+  uint64_t sum;                     /* sum of the gaps: last bit + 1 */
+  uint64_t small[GAP_STATS_SMALL];  /* gaps below GAP_STATS_SMALL */
+  uint64_t hist[64];                /* the rest by floor (log2 (gap)) */
+  uint64_t hist_sum[64];
+};
+
+static void
+get_gap_stats (const unsigned char *in, size_t size, unsigned char flip,
+    struct gap_stats *st)
+{
+  uint64_t pos, g, last = 0;
+  size_t i;
+  unsigned int c;
+  int bit, L;
+
+  memset (st, 0, sizeof (*st));
+  for (i = 0; i < size; ++i) {
+    c = in[i] ^ flip;
+    while (c) {
+      bit = __builtin_clz (c) - 24;
+      pos = (uint64_t) i * 8 + bit + 1;
+      g = pos - last;
+      if (g < GAP_STATS_SMALL) {
+        st->small[g]++;
+      } else {
+        L = 63 - __builtin_clzll (g);
+        st->hist[L]++;
+        st->hist_sum[L] += g;
       }
+      st->n++;
+      last = pos;
+      c &= ~(0x80u >> bit);
     }
+  }
+  st->sum = last;
+}
 
-    r = x + 1;
+/* exact Exp-Golomb code length of gap 'g' with order k */
+static inline int
+expgolomb_bits (uint64_t g, int k)
+{
+  int L = 63 - __builtin_clzll ((g - 1) + (1ULL << k));
+  return 2 * L - k + 1;
+}
 
-    //printf ("got remainder: %d, currbyte: %d, currindex: %d\n", 
-        //r, bytecounter, currindex);
+/*
+ * Exp-Golomb code length of a gap in [2^L, 2^(L+1)) with order k,
+ * taking the gap to sit inside its bucket; exact for k > L
+ */
+static inline uint64_t
+expgolomb_bucket_bits (int L, int k)
+{
+  if (k > L) return k + 1;
+  if (k == L) return L + 3;
+  return 2 * L - k + 1;
+}
 
-    /* decode integer */
-    *gd++ = r + q * b;
-    //printf ("got answer: %d\n", r + q * b);
+/* the order k with the smallest estimated size, and that size */
+static int
+best_expgolomb_order (const struct gap_stats *st, uint64_t *bits)
+{
+  uint64_t cost, best_cost = UINT64_MAX;
+  int k, g, L, best = 0;
+
+  for (k = 0; k < 63; ++k) {
+    for (g = 1, cost = 0; g < GAP_STATS_SMALL; ++g)
+      cost += st->small[g] * expgolomb_bits (g, k);
+    for (L = 0; L < 64; ++L)
+      cost += st->hist[L] * expgolomb_bucket_bits (L, k);
+    if (cost < best_cost) {
+      best_cost = cost;
+      best = k;
+    }
   }
 
-  decoded_rle_size =  gd - golomb_buf + 1;
-  
-  if (get_run_length_decoding (golomb_buf, decoded_rle_size - 1, 
-        (unsigned char**)out, 
-        outsize) ) {
-    printf ("Golomb decoding worked; RLE decoding failed\n");
+  *bits = best_cost;
+  return best;
+}
+
+
+/*
+ * Exp-Golomb: gap g is coded as v = g - 1 + 2^k written in binary,
+ * preceded by as many zeros as it has bits beyond k + 1.
+ *
+ * Output: varint input length, order k (1 byte), varint number of set
+ * bits, then the codes.
+ */
+int
+expgolomb_encode (const void *input, size_t input_len,
+    void **output, size_t *output_len)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  struct gap_stats st;
+  uint64_t *gaps, bits, bitpos, est, v;
+  unsigned char *out;
+  size_t i, n, hdr;
+  int k, L;
+
+  if (!in || !output || !output_len) return -1;
+
+  get_gap_stats (in, input_len, 0, &st);
+  k = best_expgolomb_order (&st, &est);
+
+  if ( !(gaps = malloc (sizeof (uint64_t) * (st.n ? st.n : 1))) ) {
+    perror ("expgolomb encode: cannot malloc gaps: ");
     return 1;
   }
+  n = get_set_bit_gaps (in, input_len, gaps);
 
+  for (i = 0, bits = 0; i < n; ++i)
+    bits += expgolomb_bits (gaps[i], k);
 
-  /*
-  if ( !(*out = malloc (*outsize * sizeof (unsigned int)) ) ) {
-    perror ("golombdecode: cannot malloc output buf: ");
+  if ( !(out = calloc (2 * 10 + 1 + (bits + 7) / 8, 1)) ) {
+    perror ("expgolomb encode: cannot malloc output: ");
+    free (gaps);
+    return 1;
+  }
+
+  hdr = put_varint (out, input_len);
+  out[hdr++] = k;
+  hdr += put_varint (out + hdr, n);
+
+  bitpos = (uint64_t) hdr * 8;
+  for (i = 0; i < n; ++i) {
+    v = (gaps[i] - 1) + (1ULL << k);
+    L = 63 - __builtin_clzll (v);
+    bitpos += L - k;              /* the zeros, already there */
+    put_bits (out, &bitpos, v, L + 1);
+  }
+  free (gaps);
+
+  *output = out;
+  *output_len = (bitpos + 7) / 8;
+  return 0;
+}
+
+int
+expgolomb_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  const unsigned char *end = in + input_len;
+  uint64_t len, n, v, w, pos, bitpos, endbit, zeros, i;
+  unsigned char *out;
+  size_t used, hdr;
+  int k, width;
+
+  if (!in || !output || !output_len) return -1;
+
+  if ( !(used = get_varint (in, end, &len)) ) return -1;
+  hdr = used;
+  if (hdr >= input_len || (k = in[hdr++]) > 63) return -1;
+  if ( !(used = get_varint (in + hdr, end, &n)) || n > len * 8) 
+    return -1;
+  hdr += used;
+
+  if ( !(out = calloc (len ? len : 1, 1)) ) {
+    perror ("expgolomb decode: cannot malloc output: ");
+    return 1;
+  }
+
+  bitpos = (uint64_t) hdr * 8;
+  endbit = (uint64_t) input_len * 8;
+  for (i = 0, pos = 0; i < n; ++i) {
+    /* leading zeros, possibly across windows */
+    zeros = 0;
+    while ((w = peek_bits64 (in, bitpos, input_len)) == 0 && 
+        bitpos < endbit) {
+      zeros += 56;
+      bitpos += 56;
+    }
+    zeros += __builtin_clzll (w | 1);
+    bitpos += __builtin_clzll (w | 1);
+
+    width = zeros + k + 1;
+    if (!w || width > 64 || bitpos + width > endbit) goto decode_error;
+    v = get_bits (in, bitpos, width, input_len);
+    bitpos += width;
+
+    pos += v - (1ULL << k) + 1;
+    if (pos > len * 8) goto decode_error;
+    set_bit (out, pos - 1);
+  }
+
+  *output = out;
+  *output_len = len;
+  return 0;
+
+decode_error:
+  free (out);
+  return -1;
+}
+
+
+/*
+ * Elias-Fano: with n set bits in a universe of u bits, each position
+ * is split into l = floor(log2(u/n)) low bits, stored verbatim, and
+ * the high part, stored as a unary-coded bit vector where the i'th
+ * element sets bit (high + i). Every ELIASFANO_SAMPLE'th element's
+ * bit in that vector is sampled, so select is a sample lookup plus a
+ * short scan.
+ *
+ * Output: varint input length, varint n, l (1 byte), the samples (8
+ * bytes each, little endian), the low bits and the high bit vector,
+ * each padded to a byte.
+ */
+#define ELIASFANO_SAMPLE 256
+
+struct eliasfano {
+  uint64_t len, n;
+  int l;
+  const unsigned char *samples, *low, *high;
+  uint64_t nsamples, high_bytes;
+};
+
+static uint64_t
+eliasfano_high_bits (uint64_t n, uint64_t u, int l)
+{
+  return n ? n + ((u - 1) >> l) + 1 : 0;
+}
+
+static int
+eliasfano_parse (const unsigned char *in, size_t input_len,
+    struct eliasfano *ef)
+{
+  const unsigned char *end = in + input_len;
+  uint64_t low_bytes, need;
+  size_t used, hdr;
+
+  /* a length or count big enough for len * 8, n * l or the high bit
+   * count to wrap is corrupt */
+  if ( !(used = get_varint (in, end, &ef->len)) ||
+      ef->len > UINT64_MAX / 16)
+    return -1;
+  hdr = used;
+  if ( !(used = get_varint (in + hdr, end, &ef->n)) ||
+      ef->n > ef->len * 8)
+    return -1;
+  hdr += used;
+  if (hdr >= input_len || (ef->l = in[hdr++]) > 63 ||
+      (ef->l && ef->n > (UINT64_MAX - 7) / ef->l))
+    return -1;
+
+  ef->nsamples = (ef->n + ELIASFANO_SAMPLE - 1) / ELIASFANO_SAMPLE;
+  low_bytes = (ef->n * ef->l + 7) / 8;
+  ef->high_bytes = 
+    (eliasfano_high_bits (ef->n, ef->len * 8, ef->l) + 7) / 8;
+
+  need = hdr + ef->nsamples * 8 + low_bytes + ef->high_bytes;
+  if (need > input_len) return -1;
+
+  ef->samples = in + hdr;
+  ef->low = ef->samples + ef->nsamples * 8;
+  ef->high = ef->low + low_bytes;
+  return 0;
+}
+
+int
+eliasfano_encode (const void *input, size_t input_len,
+    void **output, size_t *output_len)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  uint64_t n, u, x, i, nsamples, low_bytes, high_bytes, bitpos;
+  unsigned char *out, *samples, *low, *high;
+  size_t byte, hdr;
+  unsigned int c;
+  int l, bit;
+
+  if (!in || !output || !output_len) return -1;
+
+  n = num_set_bits (in, input_len);
+  u = (uint64_t) input_len * 8;
+  for (l = 0; n && (u / n) >> (l + 1); ++l)
+    ;
+
+  nsamples = (n + ELIASFANO_SAMPLE - 1) / ELIASFANO_SAMPLE;
+  low_bytes = (n * l + 7) / 8;
+  high_bytes = (eliasfano_high_bits (n, u, l) + 7) / 8;
+
+  if ( !(out = calloc (2 * 10 + 1 + nsamples * 8 + low_bytes + 
+          high_bytes, 1)) ) {
+    perror ("eliasfano encode: cannot malloc output: ");
     return 1;
   }
 
-  if ( !(memcpy (*out, golomb_buf, *outsize * sizeof (unsigned int)) ) ) {
-    perror ("golombdecode: cannot memcpy to output: ");
-    free (*out);
+  hdr = put_varint (out, input_len);
+  hdr += put_varint (out + hdr, n);
+  out[hdr++] = l;
+  samples = out + hdr;
+  low = samples + nsamples * 8;
+  high = low + low_bytes;
+
+  for (byte = 0, i = 0, bitpos = 0; byte < input_len; ++byte) {
+    c = in[byte];
+    while (c) {
+      bit = __builtin_clz (c) - 24;
+      x = (uint64_t) byte * 8 + bit;
+      c &= ~(0x80u >> bit);
+
+      if (i % ELIASFANO_SAMPLE == 0)
+        put_le64 (samples + (i / ELIASFANO_SAMPLE) * 8, (x >> l) + i);
+      put_bits (low, &bitpos, x, l);
+      set_bit (high, (x >> l) + i);
+      ++i;
+    }
+  }
+
+  *output = out;
+  *output_len = (high - out) + high_bytes;
+  return 0;
+}
+
+int
+eliasfano_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len)
+{
+  struct eliasfano ef;
+  unsigned char *out;
+  uint64_t i, x, low_end;
+  size_t byte;
+  unsigned int c;
+  int bit;
+
+  if (!input || !output || !output_len) return -1;
+  if (eliasfano_parse (input, input_len, &ef)) return -1;
+
+  if ( !(out = calloc (ef.len ? ef.len : 1, 1)) ) {
+    perror ("eliasfano decode: cannot malloc output: ");
     return 1;
   }
-  */
 
+  low_end = ef.high - ef.low;
+  for (byte = 0, i = 0; byte < ef.high_bytes && i < ef.n; ++byte) {
+    c = ef.high[byte];
+    while (c && i < ef.n) {
+      bit = __builtin_clz (c) - 24;
+      c &= ~(0x80u >> bit);
+
+      x = (((uint64_t) byte * 8 + bit - i) << ef.l);
+      if (ef.l)
+        x |= get_bits (ef.low, i * ef.l, ef.l, low_end);
+      if (x >= ef.len * 8) {
+        free (out);
+        return -1;
+      }
+      set_bit (out, x);
+      ++i;
+    }
+  }
+
+  *output = out;
+  *output_len = ef.len;
   return 0;
 }
 
+/*
+ * Position of the k'th (from 0) set bit of an Elias-Fano coded
+ * bitmap, without decoding it: jump to the nearest sample, then count
+ * ones in the high bit vector a byte at a time. Returns 0, or -1 if
+ * there is no such bit or the input is corrupt. The samples aren't
+ * checked up front, which would make every select linear; a sample
+ * that points outside the high bits is caught here instead.
+ */
+int
+eliasfano_select (const void *input, size_t input_len, uint64_t k,
+    uint64_t *position)
+{
+  struct eliasfano ef;
+  uint64_t p, r, byte;
+  unsigned int c;
+  int cnt, bit;
+
+  if (!input || !position) return -1;
+  if (eliasfano_parse (input, input_len, &ef) || k >= ef.n) return -1;
+
+  p = get_le64 (ef.samples + (k / ELIASFANO_SAMPLE) * 8);
+  r = k % ELIASFANO_SAMPLE;
+
+  /* the r'th one at or after bit p */
+  byte = p >> 3;
+  if (byte >= ef.high_bytes) return -1;
+  c = ef.high[byte] & (0xffu >> (p & 7));
+  for (;;) {
+    cnt = set_bits_lookup_table[c];
+    if (r < cnt) break;
+    r -= cnt;
+    if (++byte >= ef.high_bytes) return -1;
+    c = ef.high[byte];
+  }
+  for (;;) {
+    bit = __builtin_clz (c) - 24;
+    if (!r--) break;
+    c &= ~(0x80u >> bit);
+  }
+
+  p = byte * 8 + bit;
+  if (p < k) return -1;
+  p = ((p - k) << ef.l) | 
+    (ef.l ? get_bits (ef.low, k * ef.l, ef.l, ef.high - ef.low) : 0);
+  if (p >= ef.len * 8) return -1;
+
+  *position = p;
+  return 0;
+}
+
+
+/*
+ *
+ * Codec selection: one statistics pass over the input estimates the
+ * output size of Golomb, Exp-Golomb and Elias-Fano coding (and of
+ * storing the input as is), and the smallest one is used. The first
+ * byte of the output says which, followed for Golomb by the varint
+ * parameter, so auto_decode needs nothing else.
+ *
+ */
+
+/*
+ * Size in bits of golomb_encode's output, from the stats: exact for
+ * the small gaps, and for the others the quotient comes from the
+ * bucket's sum and the remainder is taken as uniform. The RLE also
+ * codes the run from the last set bit into its all-ones char, and the
+ * seven ones after that.
+ */
+static uint64_t
+golomb_estimate_bits (const struct gap_stats *st, uint64_t nbits)
+{
+  uint64_t b, d, cnt, bits;
+  double q;
+  int log2_b, g, L;
+
+  b = golomb_optimal_param (st->n, nbits);
+  log2_b = ceil_log2 (b);
+  d = (1ULL << log2_b) - b;
+
+  bits = golomb_code_bits (nbits - st->sum + 1, b, log2_b, d) +
+    7 * golomb_code_bits (1, b, log2_b, d);
+  for (g = 1; g < GAP_STATS_SMALL; ++g)
+    bits += st->small[g] * golomb_code_bits (g, b, log2_b, d);
+
+  for (L = 0; L < 64; ++L) {
+    if (!(cnt = st->hist[L])) continue;
+    q = ((double) st->hist_sum[L] - cnt) / b - 
+      cnt * ((double) b - 1) / (2.0 * b);
+    if (q < 0) q = 0;
+    bits += (uint64_t) (cnt * (1 + log2_b - (double) d / b) + q);
+  }
+
+  return bits;
+}
+
+static uint64_t
+eliasfano_estimate_bits (const struct gap_stats *st, uint64_t nbits)
+{
+  uint64_t n = st->n;
+  int l;
+
+  for (l = 0; n && (nbits / n) >> (l + 1); ++l)
+    ;
+  return 8 * ((n * l + 7) / 8 + ((n + ELIASFANO_SAMPLE - 1) / 
+        ELIASFANO_SAMPLE) * 8 + 1) + eliasfano_high_bits (n, nbits, l);
+}
+
+/*
+ * Pick the codec the statistics say is smallest for 'input' and code
+ * it with that. Returns the codec chosen in '*codec' if it's not NULL.
+ */
+int
+auto_encode (const void *input, size_t input_len,
+    void **output, size_t *output_len, int *codec)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  struct gap_stats st;
+  uint64_t est[4], nbits, b;
+  unsigned char *out;
+  void *payload;
+  size_t payload_len, hdr;
+  int c, best;
+
+  if (!in || !output || !output_len) return -1;
+
+  nbits = (uint64_t) input_len * 8;
+  get_gap_stats (in, input_len, 0, &st);
+
+  est[AUTO_RAW] = nbits;
+  best_expgolomb_order (&st, &est[AUTO_EXPGOLOMB]);
+  est[AUTO_ELIASFANO] = eliasfano_estimate_bits (&st, nbits);
+
+  /* golomb_encode codes the clear bits of a dense input */
+  if (st.n > nbits / 2)
+    get_gap_stats (in, input_len, 255, &st);
+  est[AUTO_GOLOMB] = golomb_estimate_bits (&st, nbits);
+
+  for (c = 1, best = AUTO_RAW; c < 4; ++c)
+    if (est[c] < est[best])
+      best = c;
+
+  switch (best) {
+    case AUTO_GOLOMB:
+      if (golomb_encode (in, input_len, &payload, &payload_len, &b))
+        return 1;
+      break;
+    case AUTO_EXPGOLOMB:
+      if (expgolomb_encode (in, input_len, &payload, &payload_len))
+        return 1;
+      break;
+    case AUTO_ELIASFANO:
+      if (eliasfano_encode (in, input_len, &payload, &payload_len))
+        return 1;
+      break;
+    default:
+      payload = (void*) in;
+      payload_len = input_len;
+  }
+
+  if ( !(out = malloc (1 + 10 + payload_len)) ) {
+    perror ("auto encode: cannot malloc output: ");
+    if (payload != in) free (payload);
+    return 1;
+  }
+
+  out[0] = best;
+  hdr = 1;
+  if (best == AUTO_GOLOMB)
+    hdr += put_varint (out + hdr, b);
+  memcpy (out + hdr, payload, payload_len);
+  if (payload != in) free (payload);
+
+  *output = out;
+  *output_len = hdr + payload_len;
+  if (codec) *codec = best;
+  return 0;
+}
+
+int
+auto_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  uint64_t b;
+  size_t used;
+
+  if (!in || !input_len || !output || !output_len) return -1;
+
+  switch (in[0]) {
+    case AUTO_RAW:
+      if ( !(*output = malloc (input_len - 1 ? input_len - 1 : 1)) ) {
+        perror ("auto decode: cannot malloc output: ");
+        return 1;
+      }
+      memcpy (*output, in + 1, input_len - 1);
+      *output_len = input_len - 1;
+      return 0;
+    case AUTO_GOLOMB:
+      if ( !(used = get_varint (in + 1, in + input_len, &b)) ) 
+        return -1;
+      return golomb_decode (in + 1 + used, input_len - 1 - used, b,
+          output, output_len);
+    case AUTO_EXPGOLOMB:
+      return expgolomb_decode (in + 1, input_len - 1, output, 
+          output_len);
+    case AUTO_ELIASFANO:
+      return eliasfano_decode (in + 1, input_len - 1, output, 
+          output_len);
+  }
+
+  return -1;
+}
+
 
 
 /* 
@@ -922,8 +2177,8 @@ int rle_lookup_sizes[256] = {
    version of the library linked do not match, or Z_ERRNO if there is
    an error reading or writing the files. */
 int 
-zlib_encode (void *input, unsigned long input_len, 
-    void **output, unsigned long *output_len, int level)
+zlib_encode (const void *input, size_t input_len, 
+    void **output, size_t *output_len, int level)
 {
   int ret, flush;
   unsigned have;
@@ -931,24 +2186,29 @@ zlib_encode (void *input, unsigned long input_len,
   //unsigned char in[CHUNK];
   unsigned char *in;
   //unsigned char out[CHUNK];
-  unsigned char *out_head, *out;
-  unsigned long bytes_left, bytes_written;
-  unsigned long output_bytes_left;
+  unsigned char *out_head, *out, *tmp;
+  size_t bytes_left, bytes_written;
+  size_t output_bytes;
   int buf_realloc_penalty = BUF_REALLOC_PENALTY;
+  STATS_DECLARE
 
   bytes_left = input_len;
   bytes_written = 0;
   in = (unsigned char*) input;
 
-  /* allocate exactly enough space to out as in */
+  /* allocate as much space for out as in, and at least the CHUNK each
+   * deflate call may write */
   /* XXX this is probably too much space, since we're encoding
    * what are the performance hits of large malloc, i wonder... */
-  if ( !(out_head = (unsigned char*) malloc (input_len)) ) {
-    printf ("malloc failed\n");
-    goto encode_error_save;
+  output_bytes = input_len > CHUNK ? input_len : CHUNK;
+  STATS_START ();
+  if ( !(out_head = (unsigned char*) malloc (output_bytes)) ) {
+    perror ("zlib encode: cannot malloc output buf: ");
+    *output_len = 0;
+    return 1;
   }
+  STATS_STOP (ns_alloc);
   out = out_head;
-  output_bytes_left = input_len;
 
   /* allocate deflate state */
   strm.zalloc = Z_NULL;
@@ -957,6 +2217,7 @@ zlib_encode (void *input, unsigned long input_len,
   ret = deflateInit(&strm, level);
   if (ret != Z_OK) {
     //return ret;
+    free (out_head);
     return 1;
   }
 
@@ -969,10 +2230,8 @@ zlib_encode (void *input, unsigned long input_len,
       in += CHUNK;
       //bytes_left -= CHUNK;
       flush = Z_NO_FLUSH;
-    } else if (bytes_left == 0) {
-      printf ("hmm, shouldnt have come here?\n");
-      break;
     } else {
+      /* the rest, if any: empty input still gets a whole stream */
       strm.avail_in = bytes_left;
       strm.next_in = in;
       in += bytes_left;
@@ -994,22 +2253,30 @@ zlib_encode (void *input, unsigned long input_len,
        compression if all of source has been read in */
     do {
 
-      /* to take care of the case when output is not big enough */
-      if (bytes_left && output_bytes_left <= bytes_left) {
-        unsigned extra = buf_realloc_penalty*CHUNK;
-        unsigned offset = out - out_head;
-        if (!(out_head = realloc (out_head, input_len + extra)) ) {
-          printf ("allocing more bytes didnt work");
+      /* to take care of the case when output is not big enough
+       * for the CHUNK deflate may write next */
+      if ((size_t) (out - out_head) + CHUNK > output_bytes) {
+        size_t extra = (size_t) buf_realloc_penalty*CHUNK;
+        size_t offset = out - out_head;
+        STATS_START ();
+        if (!(tmp = realloc (out_head, output_bytes + extra)) ) {
+          perror ("zlib encode: cannot realloc output buf: ");
+          (void)deflateEnd(&strm);
           goto encode_error_save;
         }
+        STATS_STOP (ns_alloc);
+        STATS_ADD (reallocs, 1);
+        out_head = tmp;
         out = out_head + offset;
-        output_bytes_left += extra;
+        output_bytes += extra;
         buf_realloc_penalty *= BUF_REALLOC_PENALTY;
       }
 
       strm.avail_out = CHUNK;
       strm.next_out = out;
+      STATS_START ();
       ret = deflate(&strm, flush);    /* no bad return value */
+      STATS_STOP (ns_pack);
       assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
       have = CHUNK - strm.avail_out;
       out += have;
@@ -1031,17 +2298,22 @@ zlib_encode (void *input, unsigned long input_len,
   /* clean up and return */
   (void)deflateEnd(&strm);
 
-  /* general sanity checks and cleanup */
-  if (bytes_written > input_len)
-    printf ("encoding sucks: input was %lu but output is %lu\n",
-        input_len, bytes_written);
-
-  if ( !(out_head = realloc (out_head, bytes_written)) )  {
-    perror ("realloc failed: ");
+  /* general sanity checks and cleanup; an output bigger than the
+   * input is counted as 'expanded' with GOLOMB_STATS */
+  STATS_START ();
+  if ( !(tmp = realloc (out_head, bytes_written)) ) {
+    perror ("zlib encode: cannot realloc output buf: ");
     goto encode_error_save;
   }
+  STATS_STOP (ns_alloc);
+  out_head = tmp;
   *output = out_head;
   *output_len = bytes_written;
+
+  STATS_SET (bytes_in, input_len);
+  STATS_SET (bytes_out, bytes_written);
+  STATS_SET (expanded, bytes_written > input_len);
+  STATS_DONE (GOLOMB_STATS_ZLIB_ENCODE);
   return 0;
 
 encode_error_save:
@@ -1057,8 +2329,8 @@ encode_error_save:
    the version of the library linked do not match, or Z_ERRNO if there
    is an error reading or writing the files. */
 int
-zlib_decode (void *input, unsigned long input_len, 
-    void **output, unsigned long *output_len) 
+zlib_decode (const void *input, size_t input_len, 
+    void **output, size_t *output_len) 
 {
   int ret;
   unsigned have;
@@ -1066,10 +2338,11 @@ zlib_decode (void *input, unsigned long input_len,
   //unsigned char in[CHUNK];
   //unsigned char out[CHUNK];
   unsigned char *in;
-  unsigned char *out_head, *out;
-  unsigned long bytes_left, bytes_written;
-  unsigned long output_bytes, output_bytes_left;
+  unsigned char *out_head, *out, *tmp;
+  size_t bytes_left, bytes_written;
+  size_t output_bytes, output_bytes_left;
   int buf_realloc_penalty = BUF_REALLOC_PENALTY;
+  STATS_DECLARE
 
   bytes_left = input_len;
   bytes_written = 0;
@@ -1078,10 +2351,13 @@ zlib_decode (void *input, unsigned long input_len,
   /* allocate a reasonable amount of space */
 
   output_bytes = input_len > CHUNK_2 ? input_len : CHUNK_2;
+  STATS_START ();
   if ( !(out_head = (unsigned char*) malloc (output_bytes)) ) {
-    printf ("decode: malloc failed\n");
-    goto decode_error_save;
+    perror ("zlib decode: cannot malloc output buf: ");
+    *output_len = 0;
+    return 1;
   }
+  STATS_STOP (ns_alloc);
   out = out_head;
   output_bytes_left = output_bytes;
 
@@ -1094,6 +2370,7 @@ zlib_decode (void *input, unsigned long input_len,
   ret = inflateInit(&strm);
   if (ret != Z_OK) {
     //return ret;
+    free (out_head);
     return 1;
   }
 
@@ -1106,7 +2383,7 @@ zlib_decode (void *input, unsigned long input_len,
       in += CHUNK;
       //bytes_left -= CHUNK;
     } else if (bytes_left == 0) {
-      printf ("hmm, shouldnt have come here?\n");
+      /* out of input before the end of the stream: cut short */
       break;
     } else {
       strm.avail_in = bytes_left;
@@ -1131,12 +2408,17 @@ zlib_decode (void *input, unsigned long input_len,
       //printf ("curr size: %lu, in bytes left: %lu, out bytes left: %lu\n",
           //output_bytes, bytes_left, output_bytes_left);
       if (bytes_left && output_bytes_left < CHUNK_2) {
-        unsigned extra = buf_realloc_penalty*CHUNK;
-        unsigned offset = out - out_head;
-        if (!(out_head = realloc (out_head, output_bytes + extra)) ) {
-          printf ("allocing more bytes didnt work");
+        size_t extra = (size_t) buf_realloc_penalty*CHUNK;
+        size_t offset = out - out_head;
+        STATS_START ();
+        if (!(tmp = realloc (out_head, output_bytes + extra)) ) {
+          perror ("zlib decode: cannot realloc output buf: ");
+          (void)inflateEnd(&strm);
           goto decode_error_save;
         }
+        STATS_STOP (ns_alloc);
+        STATS_ADD (reallocs, 1);
+        out_head = tmp;
         output_bytes += extra;
         output_bytes_left += extra;
         out = out_head + offset;
@@ -1145,7 +2427,9 @@ zlib_decode (void *input, unsigned long input_len,
          
       strm.avail_out = CHUNK;
       strm.next_out = out;
+      STATS_START ();
       ret = inflate(&strm, Z_NO_FLUSH);
+      STATS_STOP (ns_pack);
       assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
       switch (ret) {
         case Z_NEED_DICT:
@@ -1154,7 +2438,7 @@ zlib_decode (void *input, unsigned long input_len,
         case Z_MEM_ERROR:
           (void)inflateEnd(&strm);
           //return ret;
-          return 1;
+          goto decode_error_save;
       }
       have = CHUNK - strm.avail_out;
 
@@ -1175,21 +2459,29 @@ zlib_decode (void *input, unsigned long input_len,
 
   /* clean up and return */
   (void)inflateEnd(&strm);
+  if (ret != Z_STREAM_END) {
+    free (out_head);
+    *output_len = 0;
+    return -1;
+  }
 
-  /* prepare stuff to be returned */
-  if (bytes_written < input_len)
-    printf ("in decode: encoding sucks: input was %lu but "
-        "output is %lu\n", input_len, bytes_written);
-
-  if ( !(out_head = realloc (out_head, bytes_written)) )  {
-    perror ("realloc failed: ");
+  /* prepare stuff to be returned; a stream that inflates to less than
+   * its own size is counted as 'expanded' with GOLOMB_STATS */
+  STATS_START ();
+  if ( !(tmp = realloc (out_head, bytes_written ? bytes_written : 1)) ) {
+    perror ("zlib decode: cannot realloc output buf: ");
     goto decode_error_save;
   }
+  STATS_STOP (ns_alloc);
+  out_head = tmp;
   *output = out_head;
   *output_len = bytes_written;
 
-  //return ret == Z_STREAM_END ? Z_OK : Z_DATA_ERROR;
-  return ret == Z_STREAM_END ? 0 : -1;
+  STATS_SET (bytes_in, input_len);
+  STATS_SET (bytes_out, bytes_written);
+  STATS_SET (expanded, bytes_written < input_len);
+  STATS_DONE (GOLOMB_STATS_ZLIB_DECODE);
+  return 0;
 
 decode_error_save:
   if (out_head) free (out_head);
@@ -1197,6 +2489,46 @@ decode_error_save:
   return 1;
 }
 
+/*
+ * The totals for calls of kind 'op' (GOLOMB_STATS_ENCODE and so on)
+ * since the start or the last golomb_stats_reset. Returns 0 on success
+ * and -1 on a bad 'op', or when the instrumentation isn't built in.
+ */
+int
+golomb_stats_get (int op, struct golomb_stats *totals)
+{
+#ifdef GOLOMB_STATS
+  if (op < 0 || op >= GOLOMB_STATS_OPS || !totals) return -1;
+
+  memcpy (totals, &stats_totals[op], sizeof (*totals));
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* zero the totals; only while nothing is being coded */
+void
+golomb_stats_reset (void)
+{
+#ifdef GOLOMB_STATS
+  memset (stats_totals, 0, sizeof (stats_totals));
+#endif
+}
+
+/*
+ * Have 'fn' called with 'arg' after every call counted, from the thread
+ * that made it; NULL turns it off. Only while nothing is being coded.
+ */
+void
+golomb_stats_set_callback (golomb_stats_callback fn, void *arg)
+{
+#ifdef GOLOMB_STATS
+  stats_fn = fn;
+  stats_arg = arg;
+#endif
+}
+
 /* report a zlib or i/o error */
 void zerr(int ret)
 {
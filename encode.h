@@ -10,41 +10,214 @@
 #ifndef __ENCODE_H
 #define __ENCODE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 
 /* natural log of 2 */
 #define LN2 .69314718055994531
 
+/*
+ * Set in the parameter golomb_encode returns when it coded the
+ * complement of a more than half full input; golomb_decode undoes it
+ */
+#define GOLOMB_PARAM_COMPLEMENT (1ULL << 63)
+
+/*
+ * Bit orders within a byte of the input and output: MSB first, as
+ * golomb_encode reads, or LSB first, where bit i is 1 << (i & 7) of
+ * byte i >> 3, which on a little endian machine is also bitmaps kept
+ * as 64 bit words set with 1ull << (i & 63). LSB first outputs carry
+ * GOLOMB_PARAM_LSB in their parameter, which the decoders follow.
+ */
+#define GOLOMB_ORDER_MSB 0
+#define GOLOMB_ORDER_LSB 1
+#define GOLOMB_PARAM_LSB (1ULL << 62)
+
+/* the parameter's flags; what's left is b */
+#define GOLOMB_PARAM_FLAGS (GOLOMB_PARAM_COMPLEMENT | GOLOMB_PARAM_LSB)
+
 int 
-golomb_encode (void *input, unsigned long input_len, 
-    void **output, unsigned long *output_len,
-    unsigned int *golomb_param);
+golomb_encode (const void *input, size_t input_len, 
+    void **output, size_t *output_len,
+    uint64_t *golomb_param);
+
+int 
+golomb_encode_order (const void *input, size_t input_len, int order,
+    void **output, size_t *output_len, uint64_t *golomb_param);
+
+int
+golomb_decode (const void *input, size_t input_len, 
+    uint64_t golomb_param, void **output, 
+    size_t *output_len);
+
+/*
+ * What golomb_decode and golomb_decode_safe return: 0 on success, the
+ * first two as elsewhere, and the rest for input that isn't a whole
+ * golomb_encode output
+ */
+#define GOLOMB_ERR_ARGS -1
+#define GOLOMB_ERR_NOMEM 1
+#define GOLOMB_ERR_TRUNCATED 2      /* ends early or mid code word */
+#define GOLOMB_ERR_CORRUPT 3        /* a code word no encoder writes */
+#define GOLOMB_ERR_TOO_BIG 4        /* decodes to over 'max_output' */
+
+int
+golomb_decode_safe (const void *input, size_t input_len,
+    uint64_t golomb_param, size_t max_output, void **output,
+    size_t *output_len);
+
+/* one golomb_encode output, for the functions that take many */
+struct golomb_stream {
+  const void *data;
+  size_t len;
+  uint64_t golomb_param;
+};
+
+int
+golomb_decode_many (const struct golomb_stream *streams, size_t n,
+    void **outputs, size_t *output_lens);
+
+
+/*
+ * Golomb code kernels over arrays of positive integers, shared by
+ * golomb_encode/golomb_decode and anything else that produces gaps
+ */
+uint64_t
+golomb_optimal_param (uint64_t ones, uint64_t nbits);
+
+uint64_t
+golomb_gaps_bits (const uint64_t *gaps, size_t n, uint64_t b);
 
 int
-golomb_decode (void *input, unsigned long input_len, 
-    unsigned int golomb_param, void **output, 
-    unsigned long *output_len);
+golomb_encode_gaps (const uint64_t *gaps, size_t n, uint64_t b,
+    unsigned char *out, uint64_t *bitpos);
+
+size_t
+golomb_decode_gaps (const unsigned char *in, uint64_t *bitpos,
+    uint64_t endbit, uint64_t b, uint64_t *gaps, size_t n);
 
 
 int
-get_run_length_encoding (unsigned char *in, 
-    unsigned long size,
-    unsigned int **out,
-    unsigned long *outsize);
+get_run_length_encoding (const unsigned char *in, 
+    size_t size,
+    uint64_t **out,
+    size_t *outsize);
 
 int
-get_run_length_decoding (unsigned int *in, 
-    unsigned long size,
+get_run_length_decoding (const uint64_t *in, 
+    size_t size,
     unsigned char **out,
-    unsigned long *outsize);
+    size_t *outsize);
+
+int
+get_run_length_encoding_order (const unsigned char *in, size_t size,
+    int order, uint64_t **out, size_t *outsize);
+
+int
+get_run_length_decoding_order (const uint64_t *in, size_t size,
+    int order, unsigned char **out, size_t *outsize);
+
+size_t
+num_set_bits (const unsigned char *input, size_t size);
+
+void
+apply_run_lengths (const uint64_t *in, size_t n, unsigned char *out,
+    uint64_t *pos);
+
+size_t
+get_set_bit_gaps (const unsigned char *in, size_t size, uint64_t *gaps);
+
+size_t
+get_clear_bit_gaps (const unsigned char *in, size_t size, uint64_t *gaps);
 
 
 int 
-zlib_encode (void *input, unsigned long input_len, 
-    void **output, unsigned long *output_len, int level);
+zlib_encode (const void *input, size_t input_len, 
+    void **output, size_t *output_len, int level);
+
+int
+zlib_decode (const void *input, size_t input_len, 
+    void **output, size_t *output_len);
+
+
+/*
+ * Alternative codecs with self-describing output, and a selector that
+ * picks whichever of them (or Golomb, or the raw input) looks smallest
+ */
+int
+expgolomb_encode (const void *input, size_t input_len,
+    void **output, size_t *output_len);
+
+int
+expgolomb_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len);
+
+int
+eliasfano_encode (const void *input, size_t input_len,
+    void **output, size_t *output_len);
+
+int
+eliasfano_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len);
 
 int
-zlib_decode (void *input, unsigned long input_len, 
-    void **output, unsigned long *output_len);
+eliasfano_select (const void *input, size_t input_len, uint64_t k,
+    uint64_t *position);
+
+/* codec ids, the first byte of auto_encode's output */
+#define AUTO_RAW 0
+#define AUTO_GOLOMB 1
+#define AUTO_EXPGOLOMB 2
+#define AUTO_ELIASFANO 3
+
+int
+auto_encode (const void *input, size_t input_len,
+    void **output, size_t *output_len, int *codec);
+
+int
+auto_decode (const void *input, size_t input_len,
+    void **output, size_t *output_len);
+
+
+/*
+ * Instrumentation, built in only with -DGOLOMB_STATS; otherwise none of
+ * the counting or timing is compiled into the codec and
+ * golomb_stats_get returns -1. Each golomb_encode, zlib_encode and
+ * zlib_decode call that succeeds adds what it did to a running total
+ * for its kind, and is passed to the callback, if one is set, as it
+ * returns.
+ */
+#define GOLOMB_STATS_ENCODE 0         /* golomb_encode */
+#define GOLOMB_STATS_ZLIB_ENCODE 1
+#define GOLOMB_STATS_ZLIB_DECODE 2
+#define GOLOMB_STATS_OPS 3
+
+struct golomb_stats {
+  uint64_t calls;
+  uint64_t bytes_in, bytes_out;
+  uint64_t runs;                /* run lengths Golomb coded */
+  uint64_t b;                   /* the b chosen; the last one in totals */
+  uint64_t complemented;        /* calls that coded the complement */
+  uint64_t reallocs;            /* output buffer growths, zlib only */
+  uint64_t expanded;            /* outputs bigger than their input */
+
+  /* nanoseconds counting set bits and picking b, run length encoding,
+   * packing code words (or deflating and inflating), and in malloc */
+  uint64_t ns_density, ns_rle, ns_pack, ns_alloc;
+};
+
+typedef void (*golomb_stats_callback) (int op, 
+    const struct golomb_stats *call, void *arg);
+
+int
+golomb_stats_get (int op, struct golomb_stats *totals);
+
+void
+golomb_stats_reset (void);
+
+void
+golomb_stats_set_callback (golomb_stats_callback fn, void *arg);
 
 
 extern unsigned char rle_lookup[256][9];
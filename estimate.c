@@ -0,0 +1,285 @@
+/*
+ * Output size estimates without encoding. See estimate.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "encode.h"
+#include "estimate.h"
+#include "pack.h"
+
+/* deflate's longest match, and the most literals and matches zlib
+ * (at the default memLevel) puts in one block before starting the
+ * next with new Huffman tables */
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_BLOCK_SYMBOLS 16383
+
+/* what a dynamic Huffman block header roughly costs, in bits, and the
+ * zlib header and adler32 trailer in bytes */
+#define DEFLATE_BLOCK_HEADER_BITS 400
+#define ZLIB_WRAPPER_BYTES 6
+
+
+/*
+ * The 8 bytes of 'in' from 'i' as a word whose first bit, in 'order',
+ * is bit 63: big endian for MSB first and bit reversed little endian
+ * for LSB first, so either way the set bits come out with clz. Past
+ * 'size' the bytes read as zeros.
+ */
+static inline uint64_t
+load_word (const unsigned char *in, size_t i, size_t size, int order)
+{
+  uint64_t w = 0;
+  size_t k, n = (size - i < 8) ? size - i : 8;
+
+  if (n == 8) {
+    memcpy (&w, in + i, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64 (w);
+#endif
+  } else {
+    for (k = n; k-- > 0; )
+      w = (w << 8) | in[i + k];
+  }
+
+  /* w is little endian now */
+  if (order == GOLOMB_ORDER_LSB) {
+    /* bit j of the word is bit j of the stream; turn it round */
+    w = ((w >> 1) & 0x5555555555555555ULL) |
+      ((w & 0x5555555555555555ULL) << 1);
+    w = ((w >> 2) & 0x3333333333333333ULL) |
+      ((w & 0x3333333333333333ULL) << 2);
+    w = ((w >> 4) & 0x0f0f0f0f0f0f0f0fULL) |
+      ((w & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  }
+  return __builtin_bswap64 (w);
+}
+
+
+/*
+ * The Golomb code bits for one gap, as golomb_gaps_bits counts them.
+ * A 64 bit divide is most of the cost of that, so the quotient comes
+ * from multiplying by 1 / b in a double instead, which is off by at
+ * most one while g fits in the mantissa.
+ */
+static inline uint64_t
+gap_bits (uint64_t g, uint64_t b, double inv_b, int log2_b, uint64_t d)
+{
+  uint64_t q, r;
+
+  if (g <= (1ULL << 52)) {
+    q = (uint64_t) ((double) (g - 1) * inv_b);
+    if (q * b > g - 1)
+      q--;
+    else if ((q + 1) * b <= g - 1)
+      q++;
+  } else {
+    return golomb_code_bits (g, b, log2_b, d);
+  }
+  r = g - q * b;
+
+  return q + 1 + ((r > d) ? log2_b : log2_b - 1);
+}
+
+
+/*
+ * The deflate side: the input bytes go past one at a time, and runs of
+ * the same byte are costed as distance 1 matches after one literal,
+ * everything else as literals, with Huffman costs from the symbol
+ * counts. That's close to what zlib does to sparse bitmaps, and for
+ * dense ones the stored size caps it.
+ */
+struct deflate_model {
+  uint64_t lit[256];
+  uint64_t len[29];           /* matches by length code */
+  uint64_t matches, extra_bits;
+  uint64_t run;               /* of the same byte, so far */
+  unsigned char run_byte;
+};
+
+/* a match length's code (less 257) and, in '*extra', its extra bits */
+static inline int
+length_code (uint64_t len, int *extra)
+{
+  int e;
+
+  *extra = 0;
+  if (len <= 10) return len - 3;
+  if (len == DEFLATE_MAX_MATCH) return 28;
+
+  e = 63 - __builtin_clzll (len - 3) - 2;
+  *extra = e;
+  return 4 + 4 * e + ((len - 3) >> e) - 4;
+}
+
+static inline void
+model_match (struct deflate_model *m, uint64_t len)
+{
+  int extra;
+
+  m->len[length_code (len, &extra)]++;
+  m->extra_bits += extra;
+  m->matches++;
+}
+
+/* a run of 'run' copies of one byte: a literal, then distance 1
+ * matches for the rest if they're long enough to be worth it */
+static inline void
+model_run (struct deflate_model *m)
+{
+  uint64_t run = m->run;
+
+  m->run = 0;
+  if (run < 4) {
+    m->lit[m->run_byte] += run;
+    return;
+  }
+
+  m->lit[m->run_byte]++;
+  run--;
+  for (; run >= DEFLATE_MAX_MATCH; run -= DEFLATE_MAX_MATCH)
+    model_match (m, DEFLATE_MAX_MATCH);
+  if (run >= 3)
+    model_match (m, run);
+  else
+    m->lit[m->run_byte] += run;
+}
+
+static inline void
+model_bytes (struct deflate_model *m, unsigned char c, size_t n)
+{
+  if (c != m->run_byte) {
+    model_run (m);
+    m->run_byte = c;
+  }
+  m->run += n;
+}
+
+static uint64_t
+model_size (struct deflate_model *m, size_t input_len)
+{
+  double bits = 0, total;
+  uint64_t symbols, stored;
+  int i;
+
+  model_run (m);
+
+  /* literals, match lengths and the end of block marker share one
+   * Huffman code */
+  symbols = m->matches + 1;
+  for (i = 0; i < 256; ++i)
+    symbols += m->lit[i];
+  total = symbols;
+
+  for (i = 0; i < 256; ++i)
+    if (m->lit[i])
+      bits -= m->lit[i] * log2 (m->lit[i] / total);
+  for (i = 0; i < 29; ++i)
+    if (m->len[i])
+      bits -= m->len[i] * log2 (m->len[i] / total);
+
+  /* every match has a distance, always the same one, which Huffman
+   * can't code in under a bit */
+  bits += m->matches + m->extra_bits;
+  bits += (double) DEFLATE_BLOCK_HEADER_BITS *
+    (1 + symbols / DEFLATE_BLOCK_SYMBOLS);
+
+  /* whole bit code lengths, and the longer distances zlib finds to
+   * the same literal and run seen before, come to about an eighth
+   * more on random bitmaps */
+  bits *= 9.0 / 8;
+
+  /* zlib falls back to stored blocks, 5 bytes a 64 KB */
+  stored = input_len + 5 * (input_len / 65535 + 1);
+  if ((uint64_t) (bits / 8) < stored)
+    stored = (uint64_t) (bits / 8);
+  return stored + ZLIB_WRAPPER_BYTES;
+}
+
+
+/*
+ * Estimate what golomb_encode_order (input, input_len, order, ...)
+ * and zlib_encode (input, input_len, ..., Z_DEFAULT_COMPRESSION) would
+ * give without doing either. The Golomb size and parameter are exact:
+ * the set bits are counted a word at a time to pick b and the
+ * polarity the way golomb_encode does, and then the code word lengths
+ * of the gaps are summed in a second pass, without the RLE, the
+ * packing or any allocation. The same pass models deflate's
+ * literals and matches over the bytes, which comes within a few tens
+ * of percent of zlib. Returns 0 on success and -1 on bad arguments.
+ */
+int
+golomb_estimate (const void *input, size_t input_len, int order,
+    struct golomb_estimate *est)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  struct deflate_model model;
+  uint64_t w, mask, ones = 0, nbits, b, d, bits = 0, pos, last = 0;
+  size_t i, k;
+  unsigned char flip;
+  double inv_b;
+  int log2_b, bit;
+
+  if (!in || !est) return -1;
+  if (order != GOLOMB_ORDER_MSB && order != GOLOMB_ORDER_LSB) return -1;
+
+  for (i = 0; i + 8 <= input_len; i += 8) {
+    memcpy (&w, in + i, 8);
+    ones += __builtin_popcountll (w);
+  }
+  for (; i < input_len; ++i)
+    ones += __builtin_popcount (in[i]);
+
+  nbits = (uint64_t) input_len * 8;
+  flip = (ones > nbits / 2) ? 255 : 0;
+  est->ones = ones;
+  if (flip)
+    ones = nbits - ones;
+  b = golomb_optimal_param (ones, nbits);
+  log2_b = ceil_log2 (b);
+  d = (1ULL << log2_b) - b;
+  inv_b = 1.0 / b;
+
+  memset (&model, 0, sizeof (model));
+  for (i = 0; i < input_len; i += 8) {
+    w = load_word (in, i, input_len, order);
+
+    /* zero words are the common case for the bitmaps worth coding */
+    if (!w) {
+      model_bytes (&model, 0, (input_len - i < 8) ? input_len - i : 8);
+      if (!flip) continue;
+    } else {
+      for (k = i; k < i + 8 && k < input_len; ++k)
+        model_bytes (&model, in[k], 1);
+    }
+
+    if (flip) {
+      mask = (input_len - i < 8) ? ~0ULL << (64 - 8 * (input_len - i)) :
+        ~0ULL;
+      w = ~w & mask;
+    }
+    while (w) {
+      bit = __builtin_clzll (w);
+      pos = (uint64_t) i * 8 + bit + 1;
+      bits += gap_bits (pos - last, b, inv_b, log2_b, d);
+      last = pos;
+      w &= ~(0x8000000000000000ULL >> bit);
+    }
+  }
+
+  /* the all-ones char run_length_encode appends, and only whole bytes
+   * are kept */
+  bits += gap_bits (nbits + 1 - last, b, inv_b, log2_b, d);
+  bits += 7 * gap_bits (1, b, inv_b, log2_b, d);
+
+  est->golomb_param = (flip ? GOLOMB_PARAM_COMPLEMENT : 0) |
+    ((order == GOLOMB_ORDER_LSB) ? GOLOMB_PARAM_LSB : 0) | b;
+  est->golomb_len = bits >> 3;
+  est->deflate_len = model_size (&model, input_len);
+  return 0;
+}
@@ -0,0 +1,31 @@
+/*
+ * What golomb_encode and zlib_encode would make of an input, without
+ * running either: for deciding per filter whether to ship it Golomb
+ * coded, deflated or raw. The Golomb size is exact, from the lengths
+ * of the code words the gaps would get; the deflate size is a model
+ * of what zlib does with runs of zero bytes and the literals between
+ * them, good to a few tens of percent on bitmaps. No memory is
+ * allocated, and it takes a small fraction of the encode time.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __ESTIMATE_H
+#define __ESTIMATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct golomb_estimate {
+  uint64_t golomb_param;      /* what golomb_encode_order returns */
+  size_t golomb_len;          /* ... and its output size, exactly */
+  size_t deflate_len;         /* zlib_encode's at the default level,
+                                 roughly */
+  uint64_t ones;              /* set bits in the input */
+};
+
+int
+golomb_estimate (const void *input, size_t input_len, int order,
+    struct golomb_estimate *est);
+
+#endif /* __ESTIMATE_H */
@@ -0,0 +1,201 @@
+/*
+ * Golomb-coded sets, built on the Golomb gap coder in encode.c. See
+ * gcs.h for the layout.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "encode.h"
+#include "gcs.h"
+
+/* gaps decoded per call while scanning a block; small enough that a
+ * lookup stops soon after passing the hash it is looking for */
+#define GCS_DECODE_BATCH 8
+
+/*
+ * 64 bit FNV-1a over the key, with a final avalanche step (from
+ * splitmix64) since FNV's low bits are weak and we reduce by modulo
+ */
+static uint64_t
+gcs_hash (const char *key)
+{
+  uint64_t h = 14695981039346656037ULL;
+
+  while (*key) {
+    h ^= (unsigned char) *key++;
+    h *= 1099511628211ULL;
+  }
+
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+static int
+cmp_ull (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+ * Build a set from 'n' NUL-terminated keys with false positive rate
+ * 'fp_rate'. Returns 0 on success, 1 on allocation/coding failure and
+ * -1 on bad arguments, including an fp_rate so small that the hash
+ * range, n / fp_rate, doesn't fit in 64 bits.
+ */
+int
+gcs_build (const char **keys, size_t n, double fp_rate,
+    struct gcs **out)
+{
+  struct gcs *gcs;
+  uint64_t *values = NULL, *gaps = NULL;
+  uint64_t m, prev, bitpos;
+  size_t i, j, k;
+
+  if (!keys || !out || !n || fp_rate <= 0.0 || fp_rate >= 1.0 ||
+      1.0 / fp_rate > (double) (UINT64_MAX / GCS_BLOCK_SIZE))
+    return -1;
+  m = (uint64_t) ceil (1.0 / fp_rate);
+  if (m > UINT64_MAX / GCS_BLOCK_SIZE || m > UINT64_MAX / n)
+    return -1;
+
+  if ( !(gcs = calloc (1, sizeof (struct gcs))) ) {
+    perror ("gcs: cannot malloc set: ");
+    return 1;
+  }
+
+  /* hashes are uniform over n * m values, so the gaps between them
+   * are geometric with mean m; pick b as golomb_encode would for a
+   * bitmap of that density */
+  gcs->range = n * m;
+  gcs->block_range = GCS_BLOCK_SIZE * m;
+  gcs->nblocks = gcs->range / gcs->block_range +
+    (gcs->range % gcs->block_range != 0);
+  gcs->golomb_param = golomb_optimal_param (1, m);
+
+  if ( !(values = malloc (sizeof (uint64_t) * n)) ||
+      !(gaps = malloc (sizeof (uint64_t) * n)) ||
+      !(gcs->block_bitpos = 
+        malloc (sizeof (uint64_t) * (gcs->nblocks + 1))) ) {
+    perror ("gcs: cannot malloc: ");
+    goto build_error;
+  }
+
+  for (i = 0; i < n; ++i)
+    values[i] = gcs_hash (keys[i]) % gcs->range;
+
+  qsort (values, n, sizeof (uint64_t), cmp_ull);
+
+  /* duplicates answer the same queries, drop them */
+  for (i = 1, j = 1; i < n; ++i)
+    if (values[i] != values[j - 1])
+      values[j++] = values[i];
+  gcs->n = j;
+
+  /* gaps restart at each block boundary, so the first value of a
+   * block is coded relative to the start of the block's range */
+  for (i = 0, k = 0; i < gcs->n; ++i) {
+    if (i == 0 || values[i] / gcs->block_range != k) {
+      k = values[i] / gcs->block_range;
+      prev = k * gcs->block_range - 1;
+    }
+    gaps[i] = values[i] - prev;
+    prev = values[i];
+  }
+
+  gcs->data_bits = golomb_gaps_bits (gaps, gcs->n, gcs->golomb_param);
+  if ( !(gcs->data = calloc ((gcs->data_bits + 7) / 8 + 1, 1)) ) {
+    perror ("gcs: cannot malloc data: ");
+    goto build_error;
+  }
+
+  bitpos = 0;
+  for (i = 0, k = 0; k < gcs->nblocks; ++k) {
+    gcs->block_bitpos[k] = bitpos;
+    for (j = i; j < gcs->n && values[j] / gcs->block_range == k; ++j)
+      ;
+    if (golomb_encode_gaps (gaps + i, j - i, gcs->golomb_param,
+          gcs->data, &bitpos) ) {
+      fprintf (stderr, "gcs: golomb coding failed\n");
+      goto build_error;
+    }
+    i = j;
+  }
+  gcs->block_bitpos[gcs->nblocks] = bitpos;
+
+  free (values);
+  free (gaps);
+  *out = gcs;
+  return 0;
+
+build_error:
+  free (values);
+  free (gaps);
+  gcs_free (gcs);
+  return 1;
+}
+
+
+/*
+ * Returns 1 if 'key' is (probably) in the set, 0 if it definitely is
+ * not. Only the one block whose range holds the key's hash is decoded.
+ */
+int
+gcs_contains (const struct gcs *gcs, const char *key)
+{
+  uint64_t gaps[GCS_DECODE_BATCH];
+  uint64_t h, v, bitpos, endbit;
+  size_t i, k, count;
+
+  if (!gcs || !key || !gcs->n) return 0;
+
+  h = gcs_hash (key) % gcs->range;
+  k = h / gcs->block_range;
+
+  v = k * gcs->block_range - 1;
+  bitpos = gcs->block_bitpos[k];
+  endbit = gcs->block_bitpos[k + 1];
+
+  /* decode a few gaps at a time until we pass h or run out of block */
+  while (bitpos < endbit) {
+    count = golomb_decode_gaps (gcs->data, &bitpos, endbit,
+        gcs->golomb_param, gaps, GCS_DECODE_BATCH);
+    for (i = 0; i < count; ++i) {
+      v += gaps[i];
+      if (v >= h)
+        return v == h;
+    }
+  }
+
+  return 0;
+}
+
+
+/* bytes used by the set, index included */
+size_t
+gcs_size (const struct gcs *gcs)
+{
+  if (!gcs) return 0;
+  return (gcs->data_bits + 7) / 8 + 
+    (gcs->nblocks + 1) * sizeof (uint64_t);
+}
+
+void
+gcs_free (struct gcs *gcs)
+{
+  if (!gcs) return;
+  free (gcs->block_bitpos);
+  free (gcs->data);
+  free (gcs);
+}
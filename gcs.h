@@ -0,0 +1,45 @@
+/*
+ * Golomb-coded sets: a compact, static alternative to a Bloom filter.
+ * Keys are hashed into [0, n/fp_rate), sorted, and the gaps between
+ * consecutive hashes are Golomb coded with the kernels in encode.c.
+ * The hash range is cut into blocks expected to hold GCS_BLOCK_SIZE
+ * values each, and an index of where each block's code words start
+ * lets a lookup decode a single block instead of the whole set.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __GCS_H
+#define __GCS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* expected number of hash values per independently decodable block */
+#define GCS_BLOCK_SIZE 64
+
+struct gcs {
+  size_t n;                   /* distinct hash values stored */
+  uint64_t range;             /* hashes are reduced to [0, range) */
+  uint64_t block_range;       /* hash values covered per block */
+  uint64_t golomb_param;
+  size_t nblocks;
+  uint64_t *block_bitpos;     /* nblocks + 1 block start offsets */
+  unsigned char *data;        /* golomb coded gaps */
+  uint64_t data_bits;
+};
+
+int
+gcs_build (const char **keys, size_t n, double fp_rate,
+    struct gcs **out);
+
+int
+gcs_contains (const struct gcs *gcs, const char *key);
+
+size_t
+gcs_size (const struct gcs *gcs);
+
+void
+gcs_free (struct gcs *gcs);
+
+#endif /* __GCS_H */
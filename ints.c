@@ -0,0 +1,337 @@
+/*
+ * Golomb coding of integer arrays. See ints.h for the format.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "encode.h"
+#include "ints.h"
+#include "pack.h"
+
+/* values transformed, coded or decoded at a time */
+#define INTS_BATCH 1024
+
+/* values the parameter search is run over */
+#define INTS_SAMPLE 4096
+
+/* set in the flags byte for 64 bit values */
+#define INTS_WIDE 0x80
+
+/* the largest b; past it the kernels' 1 << ceil (log2 (b)) overflows */
+#define INTS_MAX_PARAM (1ULL << 63)
+
+/* longest quotient a searched b may give the largest value, so that
+ * one outlier the sample missed can't take gigabytes of unary */
+#define INTS_MAX_QUOTIENT (1ULL << 32)
+
+/* the array being coded */
+struct ints_src {
+  const void *values;
+  size_t n;
+  int flags, wide;
+};
+
+
+static inline uint64_t
+ints_get (const struct ints_src *s, size_t i)
+{
+  return s->wide ? ((const uint64_t*) s->values)[i] :
+    ((const uint32_t*) s->values)[i];
+}
+
+/*
+ * The gaps for values 'i' to 'i' + 'k': each value delta and zigzag
+ * coded as the flags say, modulo the width, plus one. A 64 bit value
+ * that comes out all ones makes a gap of 0, which the kernels'
+ * arithmetic, being modulo 2^64 too, codes and decodes as 2^64.
+ */
+static void
+ints_gaps (const struct ints_src *s, size_t i, size_t k, uint64_t *gaps)
+{
+  uint64_t mask = s->wide ? ~0ULL : 0xffffffffULL;
+  int sign = s->wide ? 63 : 31;
+  uint64_t v, cur, prev = 0;
+  size_t j;
+
+  if (i && (s->flags & GOLOMB_INTS_DELTA))
+    prev = ints_get (s, i - 1);
+
+  for (j = 0; j < k; ++j) {
+    v = ints_get (s, i + j);
+    if (s->flags & GOLOMB_INTS_DELTA) {
+      cur = v;
+      v = (v - prev) & mask;
+      prev = cur;
+    }
+    if (s->flags & GOLOMB_INTS_ZIGZAG)
+      v = ((v << 1) ^ -((v >> sign) & 1)) & mask;
+    gaps[j] = v + 1;
+  }
+}
+
+/* bits golomb_encode_gaps takes for the whole array with 'b' */
+static uint64_t
+ints_bits (const struct ints_src *s, uint64_t b)
+{
+  uint64_t gaps[INTS_BATCH], bits = 0;
+  size_t i, k;
+
+  for (i = 0; i < s->n; i += k) {
+    k = (s->n - i < INTS_BATCH) ? s->n - i : INTS_BATCH;
+    ints_gaps (s, i, k, gaps);
+    bits += golomb_gaps_bits (gaps, k, b);
+  }
+  return bits;
+}
+
+/*
+ * The b for geometric gaps with this mean, as golomb_optimal_param
+ * works it out for a bitmap, but with no bitmap length to clamp to
+ */
+static uint64_t
+ints_mean_param (double mean)
+{
+  double b;
+
+  if (mean <= 1.0) return 1;
+
+  b = ceil (-(LN2 / log1p (-1.0 / mean)));
+  if (b < 1.0)
+    return 1;
+  if (b >= (double) INTS_MAX_PARAM)
+    return INTS_MAX_PARAM;
+  return (uint64_t) b;
+}
+
+/*
+ * The b that minimises the coded size of 'gaps', starting from 'b'
+ * and walking downhill with a shrinking step, as block.c does for a
+ * block's gaps
+ */
+static uint64_t
+ints_search_param (const uint64_t *gaps, size_t n, uint64_t b)
+{
+  uint64_t best = b, best_cost, step, cand, cost;
+  int improved, rounds = 0;
+
+  best_cost = golomb_gaps_bits (gaps, n, best);
+  step = best / 4 ? best / 4 : 1;
+
+  while (rounds++ < 64) {
+    improved = 0;
+
+    cand = best + step;
+    if (cand <= INTS_MAX_PARAM &&
+        (cost = golomb_gaps_bits (gaps, n, cand)) < best_cost) {
+      best = cand; best_cost = cost; improved = 1;
+    } else if (best > step) {
+      cand = best - step;
+      if ((cost = golomb_gaps_bits (gaps, n, cand)) < best_cost) {
+        best = cand; best_cost = cost; improved = 1;
+      }
+    }
+
+    if (!improved) {
+      if (step == 1) break;
+      step /= 2;
+    }
+  }
+
+  return best;
+}
+
+/*
+ * Pick b for the array and say how many bits it codes to. One pass
+ * gets the mean and the largest value, the geometric b for that mean
+ * is the starting point, and the search runs over an evenly spread
+ * sample; the sample's b is only kept if it does better over the
+ * whole array, so a skewed sample can't make things worse.
+ */
+static uint64_t
+ints_param (const struct ints_src *s, uint64_t *bits)
+{
+  uint64_t gaps[INTS_BATCH], *sample, b, best, best_bits, max = 0;
+  double sum = 0;
+  size_t i, j, k, nsample;
+
+  if (!s->n) {
+    *bits = 0;
+    return 1;
+  }
+
+  for (i = 0; i < s->n; i += k) {
+    k = (s->n - i < INTS_BATCH) ? s->n - i : INTS_BATCH;
+    ints_gaps (s, i, k, gaps);
+    for (j = 0; j < k; ++j) {
+      sum += gaps[j] ? (double) gaps[j] : 18446744073709551616.0;
+      if (gaps[j] - 1 > max)
+        max = gaps[j] - 1;
+    }
+  }
+
+  b = ints_mean_param (sum / s->n);
+  *bits = ints_bits (s, b);
+
+  nsample = (s->n < INTS_SAMPLE) ? s->n : INTS_SAMPLE;
+  if ( !(sample = malloc (sizeof (uint64_t) * nsample)) )
+    return b;                   /* the search is only a refinement */
+  for (j = 0; j < nsample; ++j)
+    ints_gaps (s, (size_t) ((double) j * s->n / nsample), 1, &sample[j]);
+  best = ints_search_param (sample, nsample, b);
+  free (sample);
+
+  if (best != b && max / best < INTS_MAX_QUOTIENT &&
+      (best_bits = ints_bits (s, best)) < *bits) {
+    *bits = best_bits;
+    return best;
+  }
+  return b;
+}
+
+
+static int
+ints_encode (const struct ints_src *s, void **output, size_t *output_len)
+{
+  uint64_t gaps[INTS_BATCH], b, bits, bitpos;
+  unsigned char *out;
+  size_t i, k, hdr;
+
+  if ((!s->values && s->n) || !output || !output_len ||
+      (s->flags & ~GOLOMB_INTS_FLAGS))
+    return -1;
+
+  b = ints_param (s, &bits);
+
+  /* two varints and the flags byte, then the codes */
+  if ( !(out = calloc (2 * 10 + 1 + (bits >> 3) + 1, 1)) ) {
+    perror ("ints encode: cannot malloc output: ");
+    return 1;
+  }
+  hdr = put_varint (out, s->n);
+  out[hdr++] = s->flags | (s->wide ? INTS_WIDE : 0);
+  hdr += put_varint (out + hdr, b);
+
+  bitpos = (uint64_t) hdr * 8;
+  for (i = 0; i < s->n; i += k) {
+    k = (s->n - i < INTS_BATCH) ? s->n - i : INTS_BATCH;
+    ints_gaps (s, i, k, gaps);
+    golomb_encode_gaps (gaps, k, b, out, &bitpos);
+  }
+
+  *output = out;
+  *output_len = (bitpos + 7) / 8;
+  return 0;
+}
+
+/*
+ * Golomb code the 'n' values, after the transforms in 'flags' (see
+ * ints.h), with a parameter chosen for them. The output says how many
+ * values there are and how they were coded, and is malloc'd. Returns
+ * 0 on success, 1 on allocation failure and -1 on bad arguments.
+ */
+int
+golomb_ints_encode64 (const uint64_t *values, size_t n, int flags,
+    void **output, size_t *output_len)
+{
+  struct ints_src s = { values, n, flags, 1 };
+
+  return ints_encode (&s, output, output_len);
+}
+
+int
+golomb_ints_encode32 (const uint32_t *values, size_t n, int flags,
+    void **output, size_t *output_len)
+{
+  struct ints_src s = { values, n, flags, 0 };
+
+  return ints_encode (&s, output, output_len);
+}
+
+
+static int
+ints_decode (const void *input, size_t input_len, int wide,
+    void **values, size_t *n)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  const unsigned char *end = in + input_len;
+  uint64_t gaps[INTS_BATCH], count, b, v, prev = 0, bitpos, endbit;
+  uint64_t mask = wide ? ~0ULL : 0xffffffffULL;
+  int flags;
+  unsigned char *out;
+  size_t i, j, k, used, hdr;
+
+  if (!in || !values || !n) return -1;
+
+  if ( !(used = get_varint (in, end, &count)) ) return -1;
+  hdr = used;
+  if (hdr >= input_len) return -1;
+  flags = in[hdr++];
+  if ((flags & ~(GOLOMB_INTS_FLAGS | INTS_WIDE)) ||
+      !(flags & INTS_WIDE) != !wide)
+    return -1;
+  if ( !(used = get_varint (in + hdr, end, &b)) || !b ||
+      b > INTS_MAX_PARAM)
+    return -1;
+  hdr += used;
+
+  /* no code word is shorter than a bit */
+  if (count > (uint64_t) (input_len - hdr) * 8) return -1;
+
+  if ( !(out = malloc ((count ? count : 1) * (wide ? 8 : 4))) ) {
+    perror ("ints decode: cannot malloc values: ");
+    return 1;
+  }
+
+  bitpos = (uint64_t) hdr * 8;
+  endbit = (uint64_t) input_len * 8;
+  for (i = 0; i < count; i += k) {
+    k = (count - i < INTS_BATCH) ? count - i : INTS_BATCH;
+    if (golomb_decode_gaps (in, &bitpos, endbit, b, gaps, k) != k)
+      goto decode_error;
+
+    for (j = 0; j < k; ++j) {
+      v = gaps[j] - 1;
+      if (v > mask) goto decode_error;
+      if (flags & GOLOMB_INTS_ZIGZAG)
+        v = ((v >> 1) ^ -(v & 1)) & mask;
+      if (flags & GOLOMB_INTS_DELTA)
+        v = prev = (prev + v) & mask;
+      if (wide)
+        ((uint64_t*) out)[i + j] = v;
+      else
+        ((uint32_t*) out)[i + j] = v;
+    }
+  }
+
+  *values = out;
+  *n = count;
+  return 0;
+
+decode_error:
+  free (out);
+  return -1;
+}
+
+/*
+ * Decode a golomb_ints_encode64 output into a malloc'd array of
+ * '*n' values. Returns 0 on success, 1 on allocation failure and -1
+ * on bad arguments or input that isn't a whole 64 bit encoding.
+ */
+int
+golomb_ints_decode64 (const void *input, size_t input_len,
+    uint64_t **values, size_t *n)
+{
+  return ints_decode (input, input_len, 1, (void**) values, n);
+}
+
+int
+golomb_ints_decode32 (const void *input, size_t input_len,
+    uint32_t **values, size_t *n)
+{
+  return ints_decode (input, input_len, 0, (void**) values, n);
+}
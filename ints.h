@@ -0,0 +1,52 @@
+/*
+ * Golomb coding of arrays of integers rather than bitmaps: sorted id
+ * lists, timestamps, counters. Each value v is coded as the gap v + 1
+ * with the kernels in encode.c, so there is no run length encoding in
+ * the way, and the parameter is picked from the values themselves.
+ * Optionally each value is first replaced by its difference from the
+ * one before (GOLOMB_INTS_DELTA, for sorted or slowly moving data)
+ * and/or zigzag mapped so that small negative numbers code as small
+ * ones (GOLOMB_INTS_ZIGZAG, for signed data; 0, -1, 1, -2, ... go to
+ * 0, 1, 2, 3, ...). Both work modulo 2^32 or 2^64, as the array's
+ * width is, so any array round trips; signed arrays are passed as
+ * their unsigned twins.
+ *
+ * Layout:
+ *
+ *   header   number of values (varint), flags (1), b (varint)
+ *   codes    the Golomb code of each value + 1, padded to a byte
+ *
+ * The flags byte holds the transforms and whether the values are 32
+ * or 64 bits wide; each decoder takes only its own width.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __INTS_H
+#define __INTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* transforms applied before coding, in this order */
+#define GOLOMB_INTS_DELTA 1         /* difference from the last value */
+#define GOLOMB_INTS_ZIGZAG 2        /* signed to unsigned */
+#define GOLOMB_INTS_FLAGS (GOLOMB_INTS_DELTA | GOLOMB_INTS_ZIGZAG)
+
+int
+golomb_ints_encode64 (const uint64_t *values, size_t n, int flags,
+    void **output, size_t *output_len);
+
+int
+golomb_ints_encode32 (const uint32_t *values, size_t n, int flags,
+    void **output, size_t *output_len);
+
+int
+golomb_ints_decode64 (const void *input, size_t input_len,
+    uint64_t **values, size_t *n);
+
+int
+golomb_ints_decode32 (const void *input, size_t input_len,
+    uint32_t **values, size_t *n);
+
+#endif /* __INTS_H */
@@ -0,0 +1,147 @@
+/*
+ * Little endian and varint packing helpers for the self-describing
+ * formats (block.c and friends), and the bit level helpers the Golomb
+ * coders share. Header only; everything is static inline.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __PACK_H
+#define __PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+static inline void
+put_le32 (unsigned char *p, uint32_t v)
+{
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline void
+put_le64 (unsigned char *p, uint64_t v)
+{
+  put_le32 (p, (uint32_t) v);
+  put_le32 (p + 4, (uint32_t) (v >> 32));
+}
+
+static inline uint32_t
+get_le32 (const unsigned char *p)
+{
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | 
+    ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t
+get_le64 (const unsigned char *p)
+{
+  return get_le32 (p) | ((uint64_t) get_le32 (p + 4) << 32);
+}
+
+/* LEB128: 7 bits a byte, high bit set on all but the last */
+static inline size_t
+put_varint (unsigned char *p, uint64_t v)
+{
+  size_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static inline size_t
+varint_len (uint64_t v)
+{
+  size_t n = 1;
+
+  while (v >= 0x80) {
+    v >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+/* returns the bytes used, or 0 if the varint runs past 'end' */
+static inline size_t
+get_varint (const unsigned char *p, const unsigned char *end,
+    uint64_t *v)
+{
+  size_t n = 0;
+  int shift = 0;
+
+  *v = 0;
+  while (p + n < end && shift < 64) {
+    *v |= (uint64_t) (p[n] & 0x7f) << shift;
+    if (!(p[n++] & 0x80))
+      return n;
+    shift += 7;
+  }
+  return 0;
+}
+
+/* ceil (log2 (b)), the bits a long minimal binary remainder takes */
+static inline int
+ceil_log2 (uint64_t b)
+{
+  return (b > 1) ? 64 - __builtin_clzll (b - 1) : 0;
+}
+
+/* the length of gap 'g''s Golomb code word with parameter 'b', given
+ * log2_b = ceil_log2 (b) and d = 2^log2_b - b, as golomb_gaps_bits
+ * counts it */
+static inline uint64_t
+golomb_code_bits (uint64_t g, uint64_t b, int log2_b, uint64_t d)
+{
+  uint64_t q = (g - 1) / b;
+  return q + 1 + ((g - q * b > d) ? log2_b : log2_b - 1);
+}
+
+/*
+ * Returns the 64 bits of 'in' starting at bit 'bitpos', MSB aligned.
+ * Bytes at or past 'endbyte' read as zeros, so callers never touch
+ * memory outside the buffer.
+ */
+static inline uint64_t
+peek_bits64 (const unsigned char *in, uint64_t bitpos, uint64_t endbyte)
+{
+  const unsigned char *p;
+  uint64_t byte = bitpos >> 3;
+  uint64_t w = 0;
+  int i;
+
+  p = in + byte;
+  if (byte + 8 <= endbyte) {
+    w = ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48) |
+      ((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32) |
+      ((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16) |
+      ((uint64_t) p[6] << 8) | (uint64_t) p[7];
+  } else {
+    for (i = 0; i < 8; ++i)
+      w = (w << 8) | ((byte + i < endbyte) ? p[i] : 0);
+  }
+
+  return w << (bitpos & 7);
+}
+
+/* 
+ * The next 'nbits' (1 to 64) bits of 'in', for the rare remainder too
+ * wide to come out of one window
+ */
+static inline uint64_t
+get_bits (const unsigned char *in, uint64_t bitpos, int nbits,
+    uint64_t endbyte)
+{
+  uint64_t hi;
+
+  if (nbits <= 56)
+    return peek_bits64 (in, bitpos, endbyte) >> (64 - nbits);
+
+  hi = peek_bits64 (in, bitpos, endbyte) >> 32;
+  return (hi << (nbits - 32)) | 
+    (peek_bits64 (in, bitpos + 32, endbyte) >> (64 - (nbits - 32)));
+}
+
+#endif /* __PACK_H */
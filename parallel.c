@@ -0,0 +1,570 @@
+/*
+ * Multi-threaded decoding of golomb_encode outputs, and deflate across
+ * threads. See parallel.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "encode.h"
+#include "parallel.h"
+#include "pack.h"
+
+/* gaps decoded at a time */
+#define PARALLEL_BATCH 1024
+
+/* code word boundaries a speculative decode remembers to be matched up
+ * with; a decode that hasn't fallen into step by then is redone */
+#define PARALLEL_SYNC 1024
+
+/* the fewest input bytes worth giving a thread */
+#define PARALLEL_MIN_CHUNK 1024
+
+/* the furthest a bit can be set, as for golomb_decode: a batch of gaps
+ * under it adds up without overflowing */
+#define PARALLEL_LIMIT (1ULL << 52)
+
+/* input deflated as one piece by zlib_encode_parallel, and how much of
+ * the input before it primes the window */
+#define DEFLATE_CHUNK ((size_t) 128 << 10)
+#define DEFLATE_DICT 32768
+
+/* a code word boundary, and what was decoded up to it */
+struct boundary {
+  uint64_t bit;                 /* bit offset in the input */
+  uint64_t pos;                 /* the gaps added up */
+  uint64_t words;               /* code words */
+};
+
+/* one thread's share of the input */
+struct chunk {
+  const unsigned char *in;
+  uint64_t endbit, b, d;
+  int log2_b;
+  uint64_t start, end;          /* the bits it was cut at */
+
+  /* the speculative decode from 'start': the first boundaries it went
+   * through, with positions relative to 'start', and the first one at
+   * or past 'end'; 'err' if it read something no true decode could */
+  struct boundary sync[PARALLEL_SYNC];
+  size_t nsync;
+  struct boundary exit;
+  int err;
+
+  /* the gaps it decoded, kept so the true ones needn't be decoded
+   * again; 'skip' of them came before it fell into step */
+  uint64_t *gaps;
+  size_t ngaps, room, skip;
+
+  /* the true decode: the first code word boundary at or past 'start',
+   * the position there, and the gaps decoded from there before falling
+   * into step with the speculative decode */
+  uint64_t entry, pos;
+  uint64_t head[PARALLEL_SYNC];
+  size_t nhead;
+
+  /* the output bytes it sets bits in; the first and last may be
+   * shared with its neighbours */
+  unsigned char *out;
+  uint64_t first, last;
+  size_t outsize;
+  int complement;
+  int lsb;                      /* bits go in LSB first */
+};
+
+
+/* room for 'n' more gaps; the first guess is what a chunk of geometric
+ * gaps, at about log2 (b) + 1 bits each, holds */
+static int
+reserve_gaps (struct chunk *c, size_t n)
+{
+  uint64_t *tmp;
+  size_t room;
+
+  if (c->ngaps + n <= c->room) return 0;
+
+  room = c->room ? c->room * 2 :
+    (c->end - c->start) / (c->log2_b + 1) + PARALLEL_BATCH;
+  while (room < c->ngaps + n)
+    room *= 2;
+  if ( !(tmp = realloc (c->gaps, sizeof (uint64_t) * room)) ) {
+    perror ("parallel decode: cannot realloc gaps: ");
+    return GOLOMB_ERR_NOMEM;
+  }
+  c->gaps = tmp;
+  c->room = room;
+  return 0;
+}
+
+/*
+ * Decode from boundary 'at' up to the first boundary at or past
+ * 'end', moving 'at' there and keeping the gaps. Up to 'nsync' of the
+ * boundaries on the way are stored in 'sync', and '*stored' says how
+ * many were. Each batch is checked the way golomb_decode checks them:
+ * a gap of zero is corrupt and one past PARALLEL_LIMIT too big.
+ * Returns 0, or the GOLOMB_ERR_ code.
+ */
+static int
+scan (struct chunk *c, struct boundary *at, uint64_t end,
+    struct boundary *sync, size_t nsync, size_t *stored)
+{
+  uint64_t *gaps, bit, hi, lo;
+  size_t n, i;
+  int ret;
+
+  *stored = 0;
+  while (at->bit < end) {
+    /* decoded straight into where they're kept */
+    if ( (ret = reserve_gaps (c, PARALLEL_BATCH)) ) return ret;
+    gaps = c->gaps + c->ngaps;
+    bit = at->bit;
+    n = golomb_decode_gaps (c->in, &bit, c->endbit, c->b, gaps,
+        PARALLEL_BATCH);
+    if (!n) {
+      /* only a cut short code word was left */
+      at->bit = bit;
+      break;
+    }
+
+    for (i = 0, hi = 0, lo = ~0ULL; i < n; ++i) {
+      hi = (gaps[i] > hi) ? gaps[i] : hi;
+      lo = (gaps[i] < lo) ? gaps[i] : lo;
+    }
+    if (!lo) return GOLOMB_ERR_CORRUPT;
+    if (hi > PARALLEL_LIMIT) return GOLOMB_ERR_TOO_BIG;
+
+    /* boundaries only matter while they're being stored and at the
+     * end; in between the batch is simply added up */
+    if (bit < end && *stored == nsync) {
+      for (i = 0; i < n; ++i)
+        at->pos += gaps[i];
+      at->bit = bit;
+    } else {
+      for (i = 0; i < n && at->bit < end; ++i) {
+        at->bit += golomb_code_bits (gaps[i], c->b, c->log2_b, c->d);
+        at->pos += gaps[i];
+        if (*stored < nsync) {
+          sync[*stored] = *at;
+          sync[(*stored)++].words += i + 1;
+        }
+      }
+      /* all of it: the same place, unless a cut short code word at
+       * the end of the input was skipped */
+      if (i == n)
+        at->bit = bit;
+      n = i;
+    }
+
+    c->ngaps += n;
+    at->words += n;
+    if (at->pos > PARALLEL_LIMIT) return GOLOMB_ERR_TOO_BIG;
+  }
+
+  return 0;
+}
+
+static void *
+speculate (void *arg)
+{
+  struct chunk *c = (struct chunk*) arg;
+  size_t stored;
+
+  c->exit.bit = c->start;
+  c->exit.pos = c->exit.words = 0;
+  c->sync[0] = c->exit;
+  c->err = scan (c, &c->exit, c->end, c->sync + 1, PARALLEL_SYNC - 1,
+      &stored);
+  c->nsync = 1 + stored;
+  return NULL;
+}
+
+/*
+ * Chunk c's entry boundary is 'at', as the true decode of the chunk
+ * before found it. Decode from there until that lands on a boundary
+ * the speculative decode went through; past that both decoded the
+ * same code words, so its gaps and exit are the true ones. A chunk
+ * whose speculative decode went wrong, or never falls into step, is
+ * decoded again here. Leaves 'at' at the exit, for the next chunk.
+ * Returns 0, or the GOLOMB_ERR_ code.
+ */
+static int
+resync (struct chunk *c, struct boundary *at)
+{
+  struct boundary cur = { at->bit, at->pos, 0 };
+  uint64_t bit, gap;
+  size_t j = 0, stored;
+  int ret;
+
+  c->entry = at->bit;
+  c->pos = at->pos;
+  c->nhead = 0;
+  if (c->err == GOLOMB_ERR_NOMEM) return c->err;
+
+  while (!c->err && cur.bit < c->end && c->nhead < PARALLEL_SYNC) {
+    while (j < c->nsync && c->sync[j].bit < cur.bit)
+      ++j;
+    if (j == c->nsync)
+      break;
+    if (c->sync[j].bit == cur.bit) {
+      c->skip = c->sync[j].words;
+      at->bit = c->exit.bit;
+      at->pos = cur.pos + c->exit.pos - c->sync[j].pos;
+      return (at->pos > PARALLEL_LIMIT) ? GOLOMB_ERR_TOO_BIG : 0;
+    }
+
+    bit = cur.bit;
+    if (!golomb_decode_gaps (c->in, &bit, c->endbit, c->b, &gap, 1)) {
+      cur.bit = bit;
+      break;
+    }
+    if (!gap) return GOLOMB_ERR_CORRUPT;
+    cur.bit = bit;
+    cur.pos += gap;
+    if (gap > PARALLEL_LIMIT || cur.pos > PARALLEL_LIMIT)
+      return GOLOMB_ERR_TOO_BIG;
+    c->head[c->nhead++] = gap;
+  }
+
+  /* never fell into step: decode the rest of the chunk here */
+  c->ngaps = c->skip = 0;
+  if ( (ret = scan (c, &cur, c->end, NULL, 0, &stored)) ) return ret;
+  at->bit = cur.bit;
+  at->pos = cur.pos;
+  return 0;
+}
+
+/* set the bit at 'p' (1 based), atomically in the bytes shared with
+ * the neighbouring chunks */
+static inline void
+apply_bit (struct chunk *c, uint64_t p, int x)
+{
+  uint64_t byte = (p - 1) >> 3;
+  unsigned char mask = 1 << (((p - 1) & 7) ^ x);
+
+  if (byte > c->outsize)
+    return;
+  if (byte == c->first || byte == c->last)
+    __atomic_fetch_or (&c->out[byte], mask, __ATOMIC_RELAXED);
+  else
+    c->out[byte] |= mask;
+}
+
+/* set the chunk's bits, then flip the bytes only it set bits in if
+ * the complement was coded */
+static void *
+apply (void *arg)
+{
+  struct chunk *c = (struct chunk*) arg;
+  uint64_t p = c->pos, byte;
+  size_t i;
+  int x = c->lsb ? 0 : 7;
+
+  for (i = 0; i < c->nhead; ++i)
+    apply_bit (c, p += c->head[i], x);
+  for (i = c->skip; i < c->ngaps; ++i)
+    apply_bit (c, p += c->gaps[i], x);
+
+  if (c->complement)
+    for (byte = c->first + 1; byte < c->last && byte < c->outsize; ++byte)
+      c->out[byte] = ~c->out[byte];
+  return NULL;
+}
+
+/* run 'fn' on every chunk, the first one in this thread; chunks no
+ * thread can be had for are run here too */
+static void
+run_chunks (struct chunk *chunks, size_t n, void *(*fn) (void *))
+{
+  pthread_t *threads;
+  size_t t, started = 1;
+
+  if ( (threads = malloc (sizeof (pthread_t) * n)) )
+    for (; started < n; ++started)
+      if (pthread_create (&threads[started], NULL, fn, &chunks[started]))
+        break;
+
+  for (t = started; t < n; ++t)
+    fn (&chunks[t]);
+  fn (&chunks[0]);
+  for (t = 1; t < started; ++t)
+    pthread_join (threads[t], NULL);
+  free (threads);
+}
+
+static void
+free_chunks (struct chunk *chunks, size_t n)
+{
+  size_t t;
+
+  for (t = 0; t < n; ++t)
+    free (chunks[t].gaps);
+  free (chunks);
+}
+
+
+/*
+ * Decode a golomb_encode output with up to 'nthreads' threads. Takes
+ * and returns the same as golomb_decode: 0 on success, or one of the
+ * GOLOMB_ERR_ codes, with nothing left allocated. Inputs too small to
+ * be worth splitting are handed to golomb_decode.
+ */
+int
+golomb_decode_parallel (const void *input, size_t input_len,
+    uint64_t golomb_param, int nthreads, void **out, size_t *outsize)
+{
+  struct chunk *chunks;
+  struct boundary at;
+  unsigned char *buf;
+  uint64_t b, byte, next;
+  size_t n, t;
+  int ret;
+
+  b = golomb_param & ~GOLOMB_PARAM_FLAGS;
+  if (!input || !b || !out || !outsize) return GOLOMB_ERR_ARGS;
+
+  n = (nthreads > 1) ? (size_t) nthreads : 1;
+  if (n > input_len / PARALLEL_MIN_CHUNK)
+    n = input_len / PARALLEL_MIN_CHUNK;
+  if (n <= 1)
+    return golomb_decode (input, input_len, golomb_param, out, outsize);
+
+  if ( !(chunks = calloc (n, sizeof (*chunks))) ) {
+    perror ("parallel decode: cannot malloc chunks: ");
+    return GOLOMB_ERR_NOMEM;
+  }
+  for (t = 0; t < n; ++t) {
+    chunks[t].in = (const unsigned char*) input;
+    chunks[t].endbit = (uint64_t) input_len * 8;
+    chunks[t].b = b;
+    chunks[t].log2_b = ceil_log2 (b);
+    chunks[t].d = (1ULL << chunks[t].log2_b) - b;
+    chunks[t].start = (uint64_t) (input_len / n * t) * 8;
+    chunks[t].end = (t == n - 1) ? chunks[t].endbit :
+      (uint64_t) (input_len / n * (t + 1)) * 8;
+  }
+
+  run_chunks (chunks, n, speculate);
+
+  /* the first chunk's decode started on a true boundary; each one
+   * after that is matched up with the one before */
+  if ( (ret = chunks[0].err) ) {
+    free_chunks (chunks, n);
+    return ret;
+  }
+  at = chunks[0].exit;
+  for (t = 1; t < n; ++t) {
+    if ( (ret = resync (&chunks[t], &at)) ) {
+      free_chunks (chunks, n);
+      return ret;
+    }
+  }
+
+  /* the last bit set is in the all-ones char the RLE added */
+  *outsize = at.pos ? (at.pos - 1) >> 3 : 0;
+  if ( !(buf = calloc (*outsize + 1, 1)) ) {
+    perror ("parallel decode: cannot malloc output buf: ");
+    free_chunks (chunks, n);
+    return GOLOMB_ERR_NOMEM;
+  }
+
+  for (t = 0; t < n; ++t) {
+    chunks[t].out = buf;
+    chunks[t].outsize = *outsize;
+    chunks[t].complement = !!(golomb_param & GOLOMB_PARAM_COMPLEMENT);
+    chunks[t].lsb = !!(golomb_param & GOLOMB_PARAM_LSB);
+    chunks[t].first = chunks[t].pos >> 3;
+    chunks[t].last = ((t == n - 1) ? at.pos : chunks[t + 1].pos);
+    chunks[t].last = chunks[t].last ? (chunks[t].last - 1) >> 3 : 0;
+  }
+
+  run_chunks (chunks, n, apply);
+
+  /* the bytes chunks share are flipped once all their bits are in */
+  if (golomb_param & GOLOMB_PARAM_COMPLEMENT) {
+    for (t = 0, next = 0; t < 2 * n; ++t) {
+      byte = (t & 1) ? chunks[t / 2].last : chunks[t / 2].first;
+      if (byte < next) continue;
+      if (byte < *outsize)
+        buf[byte] = ~buf[byte];
+      next = byte + 1;
+    }
+  }
+
+  free_chunks (chunks, n);
+  *out = buf;
+  return 0;
+}
+
+
+/* the pieces zlib_encode_parallel's threads take turns at */
+struct deflate_job {
+  const unsigned char *in;
+  size_t len, npieces;
+  int level;
+  size_t next;                  /* the next piece to take */
+  unsigned char **outs;
+  size_t *out_lens;
+  uLong *adlers;
+  int *done;
+};
+
+/* deflate the job's pieces until there are none left, each as raw
+ * deflate data that ends on a byte boundary (or ends the stream, for
+ * the last piece) */
+static void *
+deflate_worker (void *arg)
+{
+  struct deflate_job *job = (struct deflate_job*) arg;
+  z_stream strm;
+  size_t i, start, n, dict, bound;
+  int last, ret;
+
+  memset (&strm, 0, sizeof (strm));
+  if (deflateInit2 (&strm, job->level, Z_DEFLATED, -15, 8, 
+        Z_DEFAULT_STRATEGY) != Z_OK)
+    return NULL;
+
+  while ( (i = __atomic_fetch_add (&job->next, 1, __ATOMIC_RELAXED)) <
+      job->npieces) {
+    start = i * DEFLATE_CHUNK;
+    n = (job->len - start < DEFLATE_CHUNK) ? job->len - start : 
+      DEFLATE_CHUNK;
+    last = (i == job->npieces - 1);
+
+    /* matches can reach back into the piece before, as they would in
+     * one stream */
+    deflateReset (&strm);
+    dict = (start < DEFLATE_DICT) ? start : DEFLATE_DICT;
+    if (dict && deflateSetDictionary (&strm, job->in + start - dict, 
+          dict) != Z_OK)
+      break;
+
+    /* room for the sync flush's empty stored block too */
+    bound = deflateBound (&strm, n) + 16;
+    if ( !(job->outs[i] = malloc (bound)) ) {
+      perror ("parallel deflate: cannot malloc piece: ");
+      break;
+    }
+    strm.next_in = (Bytef*) job->in + start;
+    strm.avail_in = n;
+    strm.next_out = job->outs[i];
+    strm.avail_out = bound;
+    ret = deflate (&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+    if (last ? ret != Z_STREAM_END : (ret != Z_OK || strm.avail_in))
+      break;
+
+    job->out_lens[i] = bound - strm.avail_out;
+    job->adlers[i] = adler32 (adler32 (0L, Z_NULL, 0), job->in + start, n);
+    job->done[i] = 1;
+  }
+
+  deflateEnd (&strm);
+  return NULL;
+}
+
+
+/*
+ * zlib_encode with the deflating split across 'nthreads' threads,
+ * pigz style: the input is cut into 128 KB pieces, each deflated on
+ * its own with the 32 KB before it as a preset dictionary, and the
+ * pieces are joined behind one zlib header, with the Adler-32 of the
+ * whole input after them. The output is a single zlib stream that
+ * zlib_decode reads, a little bigger than zlib_encode's. Returns 0 on
+ * success and 1 on failure, like zlib_encode, which small inputs are
+ * handed to.
+ */
+int
+zlib_encode_parallel (const void *input, size_t input_len,
+    void **output, size_t *output_len, int level, int nthreads)
+{
+  struct deflate_job job;
+  pthread_t *threads;
+  unsigned char *out;
+  size_t i, n, total, started = 0;
+  unsigned header, flags;
+  uLong adler;
+  int ret = 1;
+
+  n = (nthreads > 1) ? (size_t) nthreads : 1;
+  if (n == 1 || input_len <= DEFLATE_CHUNK)
+    return zlib_encode (input, input_len, output, output_len, level);
+
+  memset (&job, 0, sizeof (job));
+  job.in = (const unsigned char*) input;
+  job.len = input_len;
+  job.level = level;
+  job.npieces = (input_len + DEFLATE_CHUNK - 1) / DEFLATE_CHUNK;
+  if (n > job.npieces)
+    n = job.npieces;
+
+  job.outs = calloc (job.npieces, sizeof (*job.outs));
+  job.out_lens = calloc (job.npieces, sizeof (*job.out_lens));
+  job.adlers = calloc (job.npieces, sizeof (*job.adlers));
+  job.done = calloc (job.npieces, sizeof (*job.done));
+  threads = malloc (sizeof (pthread_t) * n);
+  if (!job.outs || !job.out_lens || !job.adlers || !job.done || !threads) {
+    perror ("parallel deflate: cannot malloc pieces: ");
+    goto done;
+  }
+
+  for (; started < n - 1; ++started)
+    if (pthread_create (&threads[started], NULL, deflate_worker, &job))
+      break;
+  deflate_worker (&job);
+  for (i = 0; i < started; ++i)
+    pthread_join (threads[i], NULL);
+
+  for (i = 0, total = 0; i < job.npieces; ++i) {
+    if (!job.done[i]) {
+      fprintf (stderr, "parallel deflate: piece %zu failed\n", i);
+      goto done;
+    }
+    total += job.out_lens[i];
+  }
+
+  /* the header deflate would write for this level, and the checksum
+   * of the pieces put together */
+  if ( !(out = malloc (2 + total + 4)) ) {
+    perror ("parallel deflate: cannot malloc output: ");
+    goto done;
+  }
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+  flags = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+  header = (0x78 << 8) | (flags << 6);
+  header += 31 - header % 31;
+  out[0] = header >> 8;
+  out[1] = header & 0xff;
+
+  adler = job.adlers[0];
+  for (i = 0, total = 2; i < job.npieces; ++i) {
+    memcpy (out + total, job.outs[i], job.out_lens[i]);
+    total += job.out_lens[i];
+    if (i)
+      adler = adler32_combine (adler, job.adlers[i], 
+          (i == job.npieces - 1) ? input_len - i * DEFLATE_CHUNK : 
+          DEFLATE_CHUNK);
+  }
+  for (i = 0; i < 4; ++i)
+    out[total++] = adler >> (24 - 8 * i);
+
+  *output = out;
+  *output_len = total;
+  ret = 0;
+
+done:
+  if (job.outs)
+    for (i = 0; i < job.npieces; ++i)
+      free (job.outs[i]);
+  free (job.outs);
+  free (job.out_lens);
+  free (job.adlers);
+  free (job.done);
+  free (threads);
+  return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ * Multi-threaded decoding of golomb_encode outputs, which have no
+ * index to split them at. golomb_decode_parallel cuts the bitstream
+ * into one chunk per thread at arbitrary bit offsets, and each thread
+ * decodes its chunk speculatively from the cut, not knowing where a
+ * code word really starts there. A misaligned Golomb decode falls
+ * into step with the true code word boundaries within a few words, so
+ * once the previous chunk says where its last code word really ends,
+ * the speculative decode is matched up with it and the gaps it found
+ * past that point stand, so they are only decoded once. The bits are
+ * then set by all the threads at once.
+ *
+ * The output is the same as golomb_decode's, and input golomb_decode
+ * refuses is refused with the same GOLOMB_ERR_ code.
+ *
+ * zlib_encode_parallel does zlib_encode's deflating on several threads,
+ * a piece of the input each, and joins the pieces into one zlib
+ * stream.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __PARALLEL_H
+#define __PARALLEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+int
+golomb_decode_parallel (const void *input, size_t input_len,
+    uint64_t golomb_param, int nthreads, void **out, size_t *outsize);
+
+int
+zlib_encode_parallel (const void *input, size_t input_len,
+    void **output, size_t *output_len, int level, int nthreads);
+
+#endif /* __PARALLEL_H */
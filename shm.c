@@ -0,0 +1,422 @@
+/*
+ * Block-encoded filters in POSIX shared memory. See shm.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "block.h"
+#include "shm.h"
+#include "pack.h"
+
+/* header fields past the magic and version */
+#define SHM_CAPACITY 8
+#define SHM_GENERATION 16
+#define SHM_SLOTS 24          /* per slot: sequence count, length */
+
+/* what shm_query is asked */
+#define SHM_DECODE_BLOCK 0
+#define SHM_TEST_BIT 1
+#define SHM_RANK 2
+
+
+static uint64_t *
+shm_field (const struct golomb_shm *shm, size_t off)
+{
+  return (uint64_t*) (shm->base + off);
+}
+
+static uint64_t *
+slot_seq (const struct golomb_shm *shm, int slot)
+{
+  return shm_field (shm, SHM_SLOTS + slot * 16);
+}
+
+static uint64_t *
+slot_len (const struct golomb_shm *shm, int slot)
+{
+  return shm_field (shm, SHM_SLOTS + slot * 16 + 8);
+}
+
+static unsigned char *
+slot_data (const struct golomb_shm *shm, int slot)
+{
+  return shm->base + GOLOMB_SHM_HEADER_SIZE + slot * shm->capacity;
+}
+
+
+/*
+ * Map 'fd', of 'size' bytes, into 'shm'. Returns 0 on success and 1
+ * if the mapping failed.
+ */
+static int
+shm_map (struct golomb_shm *shm, int fd, size_t size, int writable)
+{
+  void *base;
+
+  base = mmap (NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+      MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    perror ("shm: cannot mmap segment: ");
+    return 1;
+  }
+
+  memset (shm, 0, sizeof (*shm));
+  shm->base = base;
+  shm->size = size;
+  shm->writable = writable;
+  return 0;
+}
+
+
+/*
+ * Create the segment 'name' (as for shm_open, "/something") with two
+ * slots of 'capacity' bytes, and map it for publishing. An existing
+ * segment of the same capacity is taken over as it is, so readers
+ * attached to it carry on; anything else there is wiped. Returns 0 on
+ * success, 1 if the segment couldn't be set up and -1 on bad
+ * arguments.
+ */
+int
+golomb_shm_create (struct golomb_shm *shm, const char *name,
+    size_t capacity)
+{
+  struct stat st;
+  size_t size;
+  int fd;
+
+  if (!shm || !name || capacity < GOLOMB_BLOCK_HEADER_SIZE) return -1;
+  if (capacity > (SIZE_MAX - GOLOMB_SHM_HEADER_SIZE) / 2) return -1;
+  capacity = (capacity + 7) & ~(size_t) 7;
+  size = GOLOMB_SHM_HEADER_SIZE + 2 * capacity;
+
+  if ((fd = shm_open (name, O_CREAT | O_RDWR, 0644)) < 0) {
+    perror ("shm: cannot create segment: ");
+    return 1;
+  }
+  if (fstat (fd, &st) || ((size_t) st.st_size != size &&
+        ftruncate (fd, size))) {
+    perror ("shm: cannot size segment: ");
+    close (fd);
+    return 1;
+  }
+  if (shm_map (shm, fd, size, 1)) {
+    close (fd);
+    return 1;
+  }
+  close (fd);
+
+  shm->capacity = capacity;
+  if (memcmp (shm->base, GOLOMB_SHM_MAGIC, 4) ||
+      *(uint32_t*) (shm->base + 4) != GOLOMB_SHM_VERSION ||
+      *shm_field (shm, SHM_CAPACITY) != capacity) {
+    memset (shm->base, 0, GOLOMB_SHM_HEADER_SIZE);
+    *shm_field (shm, SHM_CAPACITY) = capacity;
+    *(uint32_t*) (shm->base + 4) = GOLOMB_SHM_VERSION;
+    memcpy (shm->base, GOLOMB_SHM_MAGIC, 4);
+  }
+  return 0;
+}
+
+
+/*
+ * Attach to the segment 'name' read only, for querying. Returns 0 on
+ * success, 1 if it couldn't be opened or mapped and -1 on bad
+ * arguments or if it isn't a segment golomb_shm_create made.
+ */
+int
+golomb_shm_open (struct golomb_shm *shm, const char *name)
+{
+  struct stat st;
+  uint64_t capacity;
+  int fd;
+
+  if (!shm || !name) return -1;
+
+  if ((fd = shm_open (name, O_RDONLY, 0)) < 0) {
+    perror ("shm: cannot open segment: ");
+    return 1;
+  }
+  if (fstat (fd, &st)) {
+    perror ("shm: cannot stat segment: ");
+    close (fd);
+    return 1;
+  }
+  if ((size_t) st.st_size < GOLOMB_SHM_HEADER_SIZE) {
+    close (fd);
+    return -1;
+  }
+  if (shm_map (shm, fd, st.st_size, 0)) {
+    close (fd);
+    return 1;
+  }
+  close (fd);
+
+  capacity = *shm_field (shm, SHM_CAPACITY);
+  if (memcmp (shm->base, GOLOMB_SHM_MAGIC, 4) ||
+      *(uint32_t*) (shm->base + 4) != GOLOMB_SHM_VERSION ||
+      capacity > (shm->size - GOLOMB_SHM_HEADER_SIZE) / 2 ||
+      capacity < (shm->size - GOLOMB_SHM_HEADER_SIZE) / 2) {
+    golomb_shm_close (shm);
+    return -1;
+  }
+  shm->capacity = capacity;
+  return 0;
+}
+
+
+/*
+ * Unmap the segment and free the reader's copies. The segment itself
+ * stays until golomb_shm_unlink.
+ */
+void
+golomb_shm_close (struct golomb_shm *shm)
+{
+  if (!shm) return;
+
+  if (shm->base)
+    munmap (shm->base, shm->size);
+  free (shm->meta);
+  free (shm->block);
+  memset (shm, 0, sizeof (*shm));
+}
+
+
+int
+golomb_shm_unlink (const char *name)
+{
+  if (!name) return -1;
+  return shm_unlink (name) ? 1 : 0;
+}
+
+
+/*
+ * Copy a golomb_block_encode_hybrid output into the slot readers
+ * aren't using and make it the current version. Returns 0 on success
+ * and -1 on bad arguments: a handle from golomb_shm_open, an input
+ * golomb_block_info turns down or one bigger than a slot.
+ */
+int
+golomb_shm_publish (struct golomb_shm *shm, const void *encoded,
+    size_t encoded_len)
+{
+  struct golomb_block_info info;
+  uint64_t gen, seq;
+  int slot;
+
+  if (!shm || !shm->writable) return -1;
+  if (golomb_block_info (encoded, encoded_len, &info) ||
+      encoded_len > shm->capacity)
+    return -1;
+
+  /* there's one publisher, so nobody else moves these */
+  gen = __atomic_load_n (shm_field (shm, SHM_GENERATION), __ATOMIC_RELAXED);
+  slot = (gen + 1) & 1;
+  seq = __atomic_load_n (slot_seq (shm, slot), __ATOMIC_RELAXED);
+
+  /* odd for as long as the slot is in pieces (it already is if a
+   * publisher died halfway through); the fence keeps the copy from
+   * being seen before the count */
+  seq = (seq + 1) | 1;
+  __atomic_store_n (slot_seq (shm, slot), seq, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  memcpy (slot_data (shm, slot), encoded, encoded_len);
+  __atomic_store_n (slot_len (shm, slot), encoded_len, __ATOMIC_RELAXED);
+
+  __atomic_store_n (slot_seq (shm, slot), seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n (shm_field (shm, SHM_GENERATION), gen + 1,
+      __ATOMIC_RELEASE);
+  return 0;
+}
+
+
+/*
+ * The version currently published, 0 if none has been yet.
+ */
+uint64_t
+golomb_shm_generation (const struct golomb_shm *shm)
+{
+  if (!shm || !shm->base) return 0;
+  return __atomic_load_n (shm_field (shm, SHM_GENERATION),
+      __ATOMIC_ACQUIRE);
+}
+
+
+/* whether the slot's count is still 'seq' after the reads before */
+static int
+slot_unchanged (const struct golomb_shm *shm, int slot, uint64_t seq)
+{
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  return __atomic_load_n (slot_seq (shm, slot), __ATOMIC_RELAXED) == seq;
+}
+
+
+/*
+ * Copy the header, index and ranks of what's in 'slot' out of the
+ * segment and check them, pointing the info's payload back into the
+ * slot. The slot may change under us, so everything read is bounded
+ * by the slot and the header is read twice to make sure the copy is
+ * the size the header says. Returns 0 if the copy is good, 1 on
+ * allocation failure and -1 if it isn't (a torn read, if the count
+ * moved, or a corrupt slot if it didn't).
+ */
+static int
+shm_snapshot (struct golomb_shm *shm, int slot)
+{
+  unsigned char header[GOLOMB_BLOCK_HEADER_SIZE], *data, *tmp;
+  struct golomb_block_info info;
+  uint64_t len, meta_len, nblocks;
+
+  data = slot_data (shm, slot);
+  len = __atomic_load_n (slot_len (shm, slot), __ATOMIC_RELAXED);
+  if (len > shm->capacity || len < GOLOMB_BLOCK_HEADER_SIZE) return -1;
+
+  memcpy (header, data, GOLOMB_BLOCK_HEADER_SIZE);
+  nblocks = get_le32 (header + 20);
+  meta_len = GOLOMB_BLOCK_HEADER_SIZE + (nblocks + 1) * 8 *
+    ((header[5] & GOLOMB_BLOCK_FLAG_RANK) ? 2 : 1);
+  if (meta_len > len) return -1;
+
+  if (meta_len > shm->meta_room) {
+    if ( !(tmp = realloc (shm->meta, meta_len)) ) {
+      perror ("shm: cannot malloc index: ");
+      return 1;
+    }
+    shm->meta = tmp;
+    shm->meta_room = meta_len;
+  }
+  memcpy (shm->meta, data, meta_len);
+  if (memcmp (shm->meta, header, GOLOMB_BLOCK_HEADER_SIZE)) return -1;
+
+  /* only the header, index and ranks are read, all inside the copy */
+  if (golomb_block_info (shm->meta, len, &info)) return -1;
+  info.payload = data + meta_len;
+
+  if ( !(tmp = realloc (shm->block, info.block_size)) ) {
+    perror ("shm: cannot malloc block: ");
+    return 1;
+  }
+  shm->block = tmp;
+  shm->info = info;
+  return 0;
+}
+
+
+/*
+ * Answer 'op' against the current version, starting over whenever the
+ * publisher overtakes the read. '*generation' gets the version the
+ * answer is from.
+ */
+static int
+shm_query (struct golomb_shm *shm, int op, uint64_t arg,
+    unsigned char *out, uint64_t *result, uint64_t *generation)
+{
+  struct golomb_block_info *info = &shm->info;
+  uint64_t gen, seq, block_bits;
+  int slot, ret;
+
+  if (!shm->base || shm->writable) return -1;
+
+  for (;;) {
+    gen = __atomic_load_n (shm_field (shm, SHM_GENERATION),
+        __ATOMIC_ACQUIRE);
+    if (!gen) return -1;
+    slot = gen & 1;
+    seq = __atomic_load_n (slot_seq (shm, slot), __ATOMIC_ACQUIRE);
+
+    /* the publisher is two versions on and rewriting this one */
+    if (seq & 1) {
+      sched_yield ();
+      continue;
+    }
+
+    if (gen != shm->generation || seq != shm->seq) {
+      shm->generation = 0;
+      ret = shm_snapshot (shm, slot);
+      if (!slot_unchanged (shm, slot, seq)) continue;
+      if (ret) return ret;
+      shm->generation = gen;
+      shm->seq = seq;
+    }
+
+    block_bits = (uint64_t) info->block_size * 8;
+    switch (op) {
+    case SHM_DECODE_BLOCK:
+      ret = golomb_block_decode_block (info, arg, out);
+      break;
+    case SHM_TEST_BIT:
+      if (arg >= info->input_len * 8) {
+        ret = -1;
+        break;
+      }
+      ret = golomb_block_decode_block (info, arg / block_bits, shm->block);
+      if (!ret)
+        *result = !!(shm->block[(arg % block_bits) / 8] &
+            (0x80 >> (arg % 8)));
+      break;
+    default:
+      ret = golomb_block_rank (info, arg, result);
+      break;
+    }
+
+    if (slot_unchanged (shm, slot, seq)) break;
+  }
+
+  if (generation)
+    *generation = gen;
+  return ret;
+}
+
+
+/*
+ * Decode block 'block' of the current version into 'out' (see
+ * golomb_block_decode_block), and say which version in '*generation'
+ * if it isn't NULL. Returns 0 on success and -1 on bad arguments, if
+ * nothing has been published or the block is corrupt.
+ */
+int
+golomb_shm_decode_block (struct golomb_shm *shm, size_t block,
+    unsigned char *out, uint64_t *generation)
+{
+  if (!shm || !out) return -1;
+  return shm_query (shm, SHM_DECODE_BLOCK, block, out, NULL, generation);
+}
+
+
+/*
+ * Whether bit 'pos' (MSB first) of the current version is set.
+ * Returns 0 on success, 1 on allocation failure and -1 on bad
+ * arguments, if nothing has been published or the block is corrupt.
+ */
+int
+golomb_shm_test_bit (struct golomb_shm *shm, uint64_t pos, int *bit)
+{
+  uint64_t set;
+  int ret;
+
+  if (!shm || !bit) return -1;
+  if ( !(ret = shm_query (shm, SHM_TEST_BIT, pos, NULL, &set, NULL)) )
+    *bit = set;
+  return ret;
+}
+
+
+/*
+ * golomb_block_rank on the current version, which needs to have been
+ * encoded with GOLOMB_BLOCK_RANK.
+ */
+int
+golomb_shm_rank (struct golomb_shm *shm, uint64_t pos, uint64_t *rank)
+{
+  if (!shm || !rank) return -1;
+  return shm_query (shm, SHM_RANK, pos, NULL, rank, NULL);
+}
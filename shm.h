@@ -0,0 +1,86 @@
+/*
+ * Block-encoded filters published in POSIX shared memory, so that many
+ * reader processes on a host query one copy in place instead of each
+ * receiving and decoding its own. The segment holds two slots, each
+ * big enough for a golomb_block_encode_hybrid output; the publisher
+ * copies a new version into the slot readers aren't using and then
+ * flips the generation counter, so a swap is one atomic store and
+ * readers never wait on it.
+ *
+ * Each slot has a sequence count, odd while the publisher is writing
+ * it. A reader notes the count, decodes its block straight out of the
+ * segment and checks the count again, starting over if it moved (the
+ * publisher got round to its slot again mid-query, which takes two
+ * swaps). The block index is copied out once per version and checked
+ * like golomb_block_info does, so a torn read can give a wrong answer
+ * to be thrown away but never a read outside the slot.
+ *
+ * Layout (host byte order; a segment never leaves its host): a 64 byte
+ * header, "GSHM", version (4), slot capacity (8), generation (8), and
+ * per slot a sequence count (8) and the length of what it holds (8);
+ * then the two slots. Generation 0 means nothing has been published
+ * yet, and generation g is in slot g % 2.
+ *
+ * One publisher per segment. A reader handle is for one thread.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __SHM_H
+#define __SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "block.h"
+
+#define GOLOMB_SHM_MAGIC "GSHM"
+#define GOLOMB_SHM_VERSION 1
+#define GOLOMB_SHM_HEADER_SIZE 64
+
+struct golomb_shm {
+  unsigned char *base;        /* the mapping */
+  size_t size;
+  uint64_t capacity;          /* bytes per slot */
+  int writable;               /* a publisher's handle */
+
+  /* a reader's copy of the current version's header and index, and
+   * the generation and sequence count it was taken at */
+  uint64_t generation, seq;
+  unsigned char *meta;
+  size_t meta_room;
+  struct golomb_block_info info;
+  unsigned char *block;       /* one decoded block */
+};
+
+int
+golomb_shm_create (struct golomb_shm *shm, const char *name,
+    size_t capacity);
+
+int
+golomb_shm_open (struct golomb_shm *shm, const char *name);
+
+void
+golomb_shm_close (struct golomb_shm *shm);
+
+int
+golomb_shm_unlink (const char *name);
+
+int
+golomb_shm_publish (struct golomb_shm *shm, const void *encoded,
+    size_t encoded_len);
+
+uint64_t
+golomb_shm_generation (const struct golomb_shm *shm);
+
+int
+golomb_shm_decode_block (struct golomb_shm *shm, size_t block,
+    unsigned char *out, uint64_t *generation);
+
+int
+golomb_shm_test_bit (struct golomb_shm *shm, uint64_t pos, int *bit);
+
+int
+golomb_shm_rank (struct golomb_shm *shm, uint64_t pos, uint64_t *rank);
+
+#endif /* __SHM_H */
@@ -0,0 +1,304 @@
+/*
+ * Set similarity between Golomb coded bitmaps, from their gap streams.
+ * See similarity.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "similarity.h"
+
+/* gaps decoded at a time by a cursor */
+#define SIM_DECODE_BATCH 256
+
+/* the all-ones char golomb_encode's RLE appends puts up to this many
+ * positions past the end of the input; the final code word may have
+ * been dropped, so it can be fewer */
+#define SIM_SENTINEL 8
+
+/* walks the 1-based set bit positions of one stream */
+struct gap_cursor {
+  const unsigned char *in;
+  uint64_t bitpos, endbit, b;
+  uint64_t gaps[SIM_DECODE_BATCH];
+  size_t n, i;
+  uint64_t pos;                   /* the position just read */
+  uint64_t count;                 /* positions read so far */
+  uint64_t tail[SIM_SENTINEL];    /* the last SIM_SENTINEL of them */
+};
+
+/* positions decoded out of a stream in one go, the sentinel dropped */
+struct positions {
+  uint64_t *pos;
+  uint64_t n;
+  uint64_t nbits;
+  int complement;
+};
+
+
+static int
+cursor_init (struct gap_cursor *c, const struct golomb_stream *s)
+{
+  c->b = s->golomb_param & ~GOLOMB_PARAM_FLAGS;
+  if (!s->data || !c->b) return -1;
+
+  c->in = (const unsigned char*) s->data;
+  c->bitpos = 0;
+  c->endbit = (uint64_t) s->len * 8;
+  c->n = c->i = 0;
+  c->pos = c->count = 0;
+  return 0;
+}
+
+static inline int
+cursor_next (struct gap_cursor *c)
+{
+  if (c->i == c->n) {
+    c->n = golomb_decode_gaps (c->in, &c->bitpos, c->endbit, c->b,
+        c->gaps, SIM_DECODE_BATCH);
+    c->i = 0;
+    if (!c->n) return 0;
+  }
+
+  c->pos += c->gaps[c->i++];
+  c->tail[c->count++ % SIM_SENTINEL] = c->pos;
+  return 1;
+}
+
+/* the input size in bits, worked out the way golomb_decode does */
+static uint64_t
+cursor_nbits (const struct gap_cursor *c)
+{
+  if (!c->count) return 0;
+  return ((c->tail[(c->count - 1) % SIM_SENTINEL] - 1) >> 3) * 8;
+}
+
+/* how many of the last 'count' positions in 'tail' are past 'nbits' */
+static uint64_t
+past_end (const uint64_t *tail, uint64_t count, uint64_t nbits)
+{
+  uint64_t i, n = 0;
+
+  for (i = 0; i < count && i < SIM_SENTINEL; ++i)
+    n += tail[i] > nbits;
+  return n;
+}
+
+
+/*
+ * Fill in 'sim' from what the streams hold: 'sa' and 'sb' positions,
+ * 'sab' of them shared. A complemented stream holds the clear bits, so
+ * its set is everything else.
+ */
+static void
+similarity_from_counts (struct golomb_similarity *sim, uint64_t nbits,
+    uint64_t sa, int ca, uint64_t sb, int cb, uint64_t sab)
+{
+  sim->nbits = nbits;
+  sim->a = ca ? nbits - sa : sa;
+  sim->b = cb ? nbits - sb : sb;
+
+  if (!ca && !cb)
+    sim->both = sab;
+  else if (ca && !cb)
+    sim->both = sb - sab;
+  else if (!ca && cb)
+    sim->both = sa - sab;
+  else
+    sim->both = nbits - sa - sb + sab;
+
+  sim->either = sim->a + sim->b - sim->both;
+  sim->differ = sim->either - sim->both;
+}
+
+
+/*
+ * The number of set bits in the input a golomb_encode output came
+ * from, without decoding it to a bitmap. Returns 0 on success and -1
+ * on bad arguments.
+ */
+int
+golomb_cardinality (const void *input, size_t input_len,
+    uint64_t golomb_param, uint64_t *count)
+{
+  struct golomb_stream s = { input, input_len, golomb_param };
+  struct gap_cursor c;
+  uint64_t nbits, n;
+
+  if (!count || cursor_init (&c, &s)) return -1;
+
+  while (cursor_next (&c))
+    ;
+
+  nbits = cursor_nbits (&c);
+  n = c.count - past_end (c.tail, c.count, nbits);
+  *count = (golomb_param & GOLOMB_PARAM_COMPLEMENT) ? nbits - n : n;
+  return 0;
+}
+
+
+/*
+ * Compare two golomb_encode outputs by merging their gap streams.
+ * Returns 0 on success and -1 on bad arguments, including inputs of
+ * different sizes or bit orders.
+ */
+int
+golomb_compare (const struct golomb_stream *a,
+    const struct golomb_stream *b, struct golomb_similarity *sim)
+{
+  struct gap_cursor ca, cb;
+  uint64_t both = 0, both_tail[SIM_SENTINEL], nbits;
+  int ha, hb;
+
+  if (!a || !b || !sim) return -1;
+  if ((a->golomb_param ^ b->golomb_param) & GOLOMB_PARAM_LSB) return -1;
+  if (cursor_init (&ca, a) || cursor_init (&cb, b)) return -1;
+
+  ha = cursor_next (&ca);
+  hb = cursor_next (&cb);
+  while (ha && hb) {
+    if (ca.pos == cb.pos) {
+      both_tail[both++ % SIM_SENTINEL] = ca.pos;
+      ha = cursor_next (&ca);
+      hb = cursor_next (&cb);
+    } else if (ca.pos < cb.pos) {
+      ha = cursor_next (&ca);
+    } else {
+      hb = cursor_next (&cb);
+    }
+  }
+  while (ha)
+    ha = cursor_next (&ca);
+  while (hb)
+    hb = cursor_next (&cb);
+
+  nbits = cursor_nbits (&ca);
+  if (nbits != cursor_nbits (&cb)) return -1;
+
+  /* the sentinels are the last positions of both, and shared */
+  similarity_from_counts (sim, nbits,
+      ca.count - past_end (ca.tail, ca.count, nbits),
+      !!(a->golomb_param & GOLOMB_PARAM_COMPLEMENT),
+      cb.count - past_end (cb.tail, cb.count, nbits),
+      !!(b->golomb_param & GOLOMB_PARAM_COMPLEMENT),
+      both - past_end (both_tail, both, nbits));
+  return 0;
+}
+
+
+static int
+decode_positions (const struct golomb_stream *s, struct positions *p)
+{
+  struct gap_cursor c;
+  uint64_t size = 1024, *tmp;
+
+  if (cursor_init (&c, s)) return -1;
+
+  if ( !(p->pos = malloc (sizeof (uint64_t) * size)) ) {
+    perror ("compare all: cannot malloc positions: ");
+    return 1;
+  }
+
+  while (cursor_next (&c)) {
+    if (c.count > size) {
+      size *= 2;
+      if ( !(tmp = realloc (p->pos, sizeof (uint64_t) * size)) ) {
+        perror ("compare all: cannot realloc positions: ");
+        free (p->pos);
+        p->pos = NULL;
+        return 1;
+      }
+      p->pos = tmp;
+    }
+    p->pos[c.count - 1] = c.pos;
+  }
+
+  p->nbits = cursor_nbits (&c);
+  p->n = c.count;
+  while (p->n && p->pos[p->n - 1] > p->nbits)
+    p->n--;
+  p->complement = !!(s->golomb_param & GOLOMB_PARAM_COMPLEMENT);
+  return 0;
+}
+
+/* the number of values two sorted arrays share */
+static uint64_t
+count_common (const uint64_t *a, uint64_t na, const uint64_t *b,
+    uint64_t nb)
+{
+  uint64_t i = 0, j = 0, common = 0, x, y;
+
+  /* no branches to mispredict: a match moves both on, otherwise the
+   * smaller one moves */
+  while (i < na && j < nb) {
+    x = a[i];
+    y = b[j];
+    common += x == y;
+    i += x <= y;
+    j += y <= x;
+  }
+  return common;
+}
+
+
+/*
+ * Compare every pair of 'n' streams, decoding each stream once.
+ * 'sims' gets n * n entries: sims[i * n + j] compares stream i (as A)
+ * with stream j (as B). Returns 0 on success, 1 on allocation failure
+ * and -1 on bad arguments, including inputs of different sizes or
+ * bit orders.
+ */
+int
+golomb_compare_all (const struct golomb_stream *streams, size_t n,
+    struct golomb_similarity *sims)
+{
+  struct positions *p;
+  struct golomb_similarity *s, *t;
+  size_t i, j;
+  int ret = 0;
+
+  if (!streams || !sims) return -1;
+  if (!n) return 0;
+  for (i = 1; i < n; ++i)
+    if ((streams[i].golomb_param ^ streams[0].golomb_param) & 
+        GOLOMB_PARAM_LSB)
+      return -1;
+
+  if ( !(p = calloc (n, sizeof (*p))) ) {
+    perror ("compare all: cannot malloc streams: ");
+    return 1;
+  }
+
+  for (i = 0; i < n; ++i) {
+    if ( (ret = decode_positions (&streams[i], &p[i])) )
+      goto done;
+    if (p[i].nbits != p[0].nbits) {
+      ret = -1;
+      goto done;
+    }
+  }
+
+  for (i = 0; i < n; ++i) {
+    for (j = i; j < n; ++j) {
+      s = &sims[i * n + j];
+      similarity_from_counts (s, p[i].nbits, p[i].n, p[i].complement,
+          p[j].n, p[j].complement, (i == j) ? p[i].n :
+          count_common (p[i].pos, p[i].n, p[j].pos, p[j].n));
+
+      t = &sims[j * n + i];
+      *t = *s;
+      t->a = s->b;
+      t->b = s->a;
+    }
+  }
+
+done:
+  for (i = 0; i < n; ++i)
+    free (p[i].pos);
+  free (p);
+  return ret;
+}
@@ -0,0 +1,49 @@
+/*
+ * Set similarity between golomb_encode outputs, computed from the
+ * Golomb coded gaps without decoding to bitmaps: the gap streams of
+ * two filters are walked in step, like the merge in merge sort,
+ * counting the positions they share. golomb_compare_all decodes each
+ * stream's positions once and merges every pair from those.
+ *
+ * Both inputs must have been the same size; complemented streams (see
+ * GOLOMB_PARAM_COMPLEMENT) are handled by counting.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __SIMILARITY_H
+#define __SIMILARITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "encode.h"
+
+struct golomb_similarity {
+  uint64_t nbits;             /* size of either input in bits */
+  uint64_t a, b;              /* |A| and |B| */
+  uint64_t both;              /* |A & B| */
+  uint64_t either;            /* |A | B| */
+  uint64_t differ;            /* |A ^ B|, the Hamming distance */
+};
+
+int
+golomb_cardinality (const void *input, size_t input_len,
+    uint64_t golomb_param, uint64_t *count);
+
+int
+golomb_compare (const struct golomb_stream *a,
+    const struct golomb_stream *b, struct golomb_similarity *sim);
+
+int
+golomb_compare_all (const struct golomb_stream *streams, size_t n,
+    struct golomb_similarity *sims);
+
+/* |A & B| / |A | B|, and 1 for two empty sets */
+static inline double
+golomb_jaccard (const struct golomb_similarity *sim)
+{
+  return sim->either ? (double) sim->both / sim->either : 1.0;
+}
+
+#endif /* __SIMILARITY_H */
@@ -0,0 +1,228 @@
+/*
+ * Incremental decoding of golomb_encode outputs. See stream.h.
+ *
+ * Released under GPLv2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "encode.h"
+#include "stream.h"
+#include "pack.h"
+
+
+/*
+ * Get 'dec' ready for a golomb_encode output coded with
+ * 'golomb_param'. Returns 0 on success and -1 on bad arguments.
+ */
+int
+golomb_decoder_init (struct golomb_decoder *dec, uint64_t golomb_param)
+{
+  if (!dec) return -1;
+
+  memset (dec, 0, sizeof (*dec));
+  dec->b = golomb_param & ~GOLOMB_PARAM_FLAGS;
+  if (!dec->b) return -1;
+
+  dec->log2_b = ceil_log2 (dec->b);
+  dec->d = (1ULL << dec->log2_b) - dec->b;
+  dec->long_min = dec->d ? dec->d << (65 - dec->log2_b) : 0;
+  dec->flip = (golomb_param & GOLOMB_PARAM_COMPLEMENT) ? 255 : 0;
+  dec->bit_xor = (golomb_param & GOLOMB_PARAM_LSB) ? 0 : 7;
+  return 0;
+}
+
+/* the next bit of input, the held ones first; -1 when there are none */
+static inline int
+next_bit (struct golomb_decoder *dec, const unsigned char *in,
+    uint64_t *bit, uint64_t endbit)
+{
+  if (dec->nheld) {
+    dec->nheld--;
+    return (dec->held >> dec->nheld) & 1;
+  }
+  if (*bit == endbit) return -1;
+  ++*bit;
+  return (in[(*bit - 1) >> 3] >> (7 - ((*bit - 1) & 7))) & 1;
+}
+
+/*
+ * Read a code word starting at 'bit' from the 64 bit window, as
+ * golomb_decode_gaps does. Returns 0, having used nothing, if it
+ * doesn't fit in the window or runs past 'endbit'.
+ */
+static inline int
+window_word (struct golomb_decoder *dec, const unsigned char *in,
+    uint64_t *bit, uint64_t endbit, uint64_t *gap)
+{
+  uint64_t w, x = 0, len, mask;
+  int ones, long_code;
+
+  w = peek_bits64 (in, *bit, (endbit + 7) >> 3);
+  ones = (~w) ? __builtin_clzll (~w) : 64;
+  if (ones + 1 + dec->log2_b > 57) return 0;
+
+  len = ones + 1;
+  if (dec->log2_b) {
+    w <<= ones + 1;
+    long_code = w >= dec->long_min;
+    w >>= 64 - dec->log2_b;
+    mask = -(uint64_t) long_code;
+    x = ((w - dec->d) & mask) | ((w >> 1) & ~mask);
+    len += dec->log2_b - 1 + long_code;
+  }
+
+  if (*bit + len > endbit) return 0;
+  *bit += len;
+  *gap = x + 1 + ones * dec->b;
+  return 1;
+}
+
+/*
+ * Carry on with the code word in progress a bit at a time, for one
+ * that straddles fragments. Returns 1 with its gap once it's complete,
+ * and 0 if the input ran out first.
+ */
+static inline int
+bitwise_word (struct golomb_decoder *dec, const unsigned char *in,
+    uint64_t *bit, uint64_t endbit, uint64_t *gap)
+{
+  int v;
+
+  if (!dec->partial) {
+    dec->partial = 1;
+    dec->q = dec->x = 0;
+    dec->rem_bits = -1;
+  }
+
+  /* the unary part; long runs of ones go a byte at a time */
+  while (dec->rem_bits < 0) {
+    if (!dec->nheld && !(*bit & 7) && *bit + 8 <= endbit &&
+        in[*bit >> 3] == 255) {
+      dec->q += 8;
+      *bit += 8;
+      continue;
+    }
+    if ((v = next_bit (dec, in, bit, endbit)) < 0) return 0;
+    if (v)
+      dec->q++;
+    else
+      dec->rem_bits = 0;
+  }
+
+  /* log2 (b) - 1 bits of remainder, and one more if those are at
+   * least d */
+  while (dec->rem_bits < dec->log2_b - 1 ||
+      (dec->rem_bits == dec->log2_b - 1 && dec->x >= dec->d)) {
+    if ((v = next_bit (dec, in, bit, endbit)) < 0) return 0;
+    dec->x = (dec->x << 1) | v;
+    dec->rem_bits++;
+  }
+
+  if (dec->rem_bits == dec->log2_b)
+    dec->x -= dec->d;
+  *gap = dec->x + 1 + dec->q * dec->b;
+  dec->partial = 0;
+  return 1;
+}
+
+
+/*
+ * Decode the next 'input_len' bytes of the stream, writing the output
+ * bytes they complete to 'output', up to 'output_len' of them. Sets
+ * '*consumed' to the input bytes taken and '*produced' to the output
+ * bytes written. Input is only left over when the output fills up;
+ * pass it in again (with more after it, or none) once there's room.
+ * Returns 0 on success and -1 on bad arguments.
+ *
+ * Bits are set straight into 'output', which is zeroed a little ahead
+ * of them, so a code word costs no more than in golomb_decode; the
+ * byte the last bit went into isn't complete, and is kept for the
+ * next call.
+ */
+int
+golomb_decoder_feed (struct golomb_decoder *dec, const void *input,
+    size_t input_len, size_t *consumed, void *output, size_t output_len,
+    size_t *produced)
+{
+  const unsigned char *in = (const unsigned char*) input;
+  unsigned char *out = (unsigned char*) output;
+  uint64_t bit = 0, endbit = (uint64_t) input_len * 8, gap, p, idx;
+  uint64_t base, pos, zeroed;
+  unsigned char scratch;
+  size_t i, room = output_len;
+  int full = 0;
+
+  if (!dec || !dec->b || (!in && input_len) || !consumed ||
+      (!out && output_len) || !produced)
+    return -1;
+
+  /* with no room, input can still be taken up to the next complete
+   * byte */
+  if (!room) {
+    out = &scratch;
+    room = 1;
+  }
+
+  /* out[0] is output byte 'done', the one being filled */
+  base = dec->done;
+  pos = dec->pos;
+  out[0] = dec->cur;
+  zeroed = 1;
+
+  p = pos;
+  if (!dec->pending)
+    goto next;
+
+  for (;;) {
+    idx = ((p - 1) >> 3) - base;
+    if (idx >= room) {
+      full = 1;
+      break;
+    }
+    if (idx >= zeroed) {
+      i = (idx + 64 < room) ? idx + 64 : room;
+      memset (out + zeroed, 0, i - zeroed);
+      zeroed = i;
+    }
+    out[idx] |= 1 << (((p - 1) & 7) ^ dec->bit_xor);
+    pos = p;
+
+next:
+    if (dec->partial || dec->nheld ||
+        !window_word (dec, in, &bit, endbit, &gap)) {
+      if (!bitwise_word (dec, in, &bit, endbit, &gap))
+        break;
+    }
+    p = pos + gap;
+  }
+
+  /* everything before the byte of the last bit set is complete, or all
+   * of the output if the next bit is past it */
+  if (full) {
+    memset (out + zeroed, 0, room - zeroed);
+    *produced = output_len;
+    dec->cur = output_len ? 0 : out[0];
+    dec->pos = p;
+  } else {
+    *produced = pos ? ((pos - 1) >> 3) - base : 0;
+    dec->cur = out[*produced];
+    dec->pos = pos;
+  }
+  dec->pending = full;
+  dec->done = base + *produced;
+
+  if (dec->flip)
+    for (i = 0; i < *produced; ++i)
+      out[i] = ~out[i];
+
+  /* a byte partly used is taken, and the rest of its bits held */
+  if (bit & 7) {
+    dec->nheld = 8 - (bit & 7);
+    dec->held = in[bit >> 3] & ((1 << dec->nheld) - 1);
+  }
+  *consumed = (bit + 7) >> 3;
+  return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Incremental decoding of golomb_encode outputs, for input that
+ * arrives a piece at a time (off a socket, say) rather than all at
+ * once. The decoder is fed the input in fragments of any size, split
+ * anywhere, even in the middle of a code word, and writes whatever
+ * output the fragment completes into a buffer of the caller's. All it
+ * keeps between calls is the code word it was in the middle of, a few
+ * bits of input and the output byte being filled.
+ *
+ * Once the last fragment has gone in, the output is complete and the
+ * same as golomb_decode's.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct golomb_decoder {
+  uint64_t b, d, long_min;
+  int log2_b;
+  unsigned char flip;         /* 255 if the complement was coded */
+  int bit_xor;                /* 7 for MSB first output, 0 for LSB */
+
+  /* the code word being read a bit at a time, when one ran off the
+   * end of a fragment: 'rem_bits' is -1 while in the unary part */
+  int partial;
+  uint64_t q, x;
+  int rem_bits;
+
+  /* bits of the last fragment's last byte not used yet, MSB first */
+  unsigned char held;
+  int nheld;
+
+  uint64_t pos;               /* position of the last bit decoded */
+  int pending;                /* ... which didn't fit in the output */
+  uint64_t done;              /* output bytes written */
+  unsigned char cur;          /* the bits of the next one so far */
+};
+
+int
+golomb_decoder_init (struct golomb_decoder *dec, uint64_t golomb_param);
+
+int
+golomb_decoder_feed (struct golomb_decoder *dec, const void *input,
+    size_t input_len, size_t *consumed, void *output, size_t output_len,
+    size_t *produced);
+
+#endif /* __STREAM_H */
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "encode.h"
+#include "archive.h"
+#include "test_util.h"
+
+#define NFILTERS 300
+#define MAXSZ (16 * 1024)
+
+/* filter i: its own size and density, and a seed to make it again */
+static size_t
+make_filter (unsigned char *buf, int i)
+{
+  size_t len = (i % 7 == 0) ? 0 : 1 + (i * 977) % MAXSZ;
+
+  srand (i + 1);
+  fill_random (buf, len, 5 + (i * 37) % 995);
+  return len;
+}
+
+/* every third filter decodes to what make_filter gives */
+static int
+check_archive (const char *path, int nfilters, const char *what)
+{
+  struct golomb_archive a;
+  const struct golomb_archive_entry *e;
+  unsigned char *want = malloc (MAXSZ);
+  char name[32];
+  void *out;
+  size_t outsize, len;
+  int i;
+
+  if (golomb_archive_open (&a, path) || a.n != nfilters) {
+    printf ("%s: cannot open archive\n", what);
+    return 1;
+  }
+  for (i = nfilters - 1; i >= 0; i -= 3) {
+    snprintf (name, sizeof (name), "filter-%d", i);
+    len = make_filter (want, i);
+    if ( !(e = golomb_archive_find (&a, name)) || e->id != 1000 + i ||
+        golomb_archive_find_id (&a, 1000 + i) != e ||
+        golomb_archive_decode (&a, e, &out, &outsize) ||
+        outsize != len || memcmp (out, want, len)) {
+      printf ("%s: %s mismatches\n", what, name);
+      return 1;
+    }
+    free (out);
+  }
+  if (golomb_archive_find (&a, "filter-") || golomb_archive_find (&a, "") ||
+      golomb_archive_find_id (&a, 1)) {
+    printf ("%s: found a filter that isn't there\n", what);
+    return 1;
+  }
+  printf ("%s: %d filters in %zu bytes, ok\n", what, nfilters, a.size);
+
+  golomb_archive_close (&a);
+  free (want);
+  return 0;
+}
+
+int main ()
+{
+  struct golomb_archive_writer w;
+  struct golomb_archive a;
+  const struct golomb_archive_entry *e;
+  unsigned char *buf = malloc (MAXSZ);
+  char path[64], name[32];
+  void *enc, *out;
+  size_t len, enc_len, outsize;
+  uint64_t param;
+  FILE *f;
+  int i;
+
+  snprintf (path, sizeof (path), "/tmp/golomb_test_%d.garc", (int) getpid ());
+
+  /* some added encoded, some as bitmaps */
+  if (golomb_archive_create (&w, path)) {
+    printf ("cannot create %s\n", path);
+    return 1;
+  }
+  for (i = 0; i < NFILTERS / 2; ++i) {
+    snprintf (name, sizeof (name), "filter-%d", i);
+    len = make_filter (buf, i);
+    if (i % 2) {
+      if (golomb_archive_add_bitmap (&w, name, 1000 + i, buf, len)) {
+        printf ("adding %s failed\n", name);
+        return 1;
+      }
+      continue;
+    }
+    if (golomb_encode (buf, len, &enc, &enc_len, &param) ||
+        golomb_archive_add (&w, name, 1000 + i, enc, enc_len, param, len)) {
+      printf ("adding %s failed\n", name);
+      return 1;
+    }
+    free (enc);
+  }
+  if (golomb_archive_finish (&w) ||
+      check_archive (path, NFILTERS / 2, "created"))
+    return 1;
+
+  /* appending keeps the old ones, and a name added again shadows the
+   * older filter of that name */
+  if (golomb_archive_append (&w, path) || w.n != NFILTERS / 2) {
+    printf ("cannot append to %s\n", path);
+    return 1;
+  }
+  for (i = NFILTERS / 2; i < NFILTERS; ++i) {
+    snprintf (name, sizeof (name), "filter-%d", i);
+    len = make_filter (buf, i);
+    if (golomb_archive_add_bitmap (&w, name, 1000 + i, buf, len)) {
+      printf ("adding %s failed\n", name);
+      return 1;
+    }
+  }
+  if (golomb_archive_finish (&w) ||
+      check_archive (path, NFILTERS, "appended"))
+    return 1;
+
+  memset (buf, 0xff, 100);
+  if (golomb_archive_append (&w, path) ||
+      golomb_archive_add_bitmap (&w, "filter-1", 5, buf, 100) ||
+      golomb_archive_finish (&w) ||
+      golomb_archive_open (&a, path) ||
+      !(e = golomb_archive_find (&a, "filter-1")) || e->id != 5 ||
+      golomb_archive_decode (&a, e, &out, &outsize) || outsize != 100 ||
+      memcmp (out, buf, 100)) {
+    printf ("shadowing filter mismatches\n");
+    return 1;
+  }
+  free (out);
+
+  /* a flipped bit in a filter fails its checksum */
+  e = golomb_archive_find (&a, "filter-20");
+  len = e->offset + e->length / 2;
+  golomb_archive_close (&a);
+  f = fopen (path, "r+b");
+  fseek (f, len, SEEK_SET);
+  i = fgetc (f);
+  fseek (f, len, SEEK_SET);
+  fputc (i ^ 4, f);
+  fclose (f);
+  if (golomb_archive_open (&a, path) ||
+      golomb_archive_decode (&a, golomb_archive_find (&a, "filter-20"),
+        &out, &outsize) != -1) {
+    printf ("corrupt filter decoded\n");
+    return 1;
+  }
+  golomb_archive_close (&a);
+
+  /* and a cut off file isn't an archive */
+  if (truncate (path, len) || golomb_archive_open (&a, path) != -1 ||
+      golomb_archive_append (&w, path) != -1) {
+    printf ("truncated archive opened\n");
+    return 1;
+  }
+
+  unlink (path);
+  free (buf);
+  return 0;
+}
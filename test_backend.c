@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "backend.h"
+#include "test_util.h"
+
+#define INPUTSZ (256 * 1024)
+
+int main ()
+{
+  /* sparse, dense, incompressible, and one that repeats */
+  int densities[] = { 10, 800, 500, 100 };
+  const struct compress_backend *be;
+  unsigned char *input, *enc, *dec;
+  size_t len, enc_len, dec_len, j, n;
+  int i;
+
+  if (!compress_backend_find ("zlib") || compress_backend_find ("none") ||
+      compress_backend_get (0) != compress_backend_find ("zlib")) {
+    printf ("backend lookup failed\n");
+    return 1;
+  }
+
+  srand (1);
+  input = malloc (INPUTSZ);
+  dec = malloc (INPUTSZ);
+
+  for (n = 0; (be = compress_backend_get (n)); ++n) {
+    for (i = 0; i < sizeof (densities) / sizeof (densities[0]); ++i) {
+      len = INPUTSZ - i * 1001;
+      fill_random (input, len, densities[i]);
+      if (i == 3)
+        for (j = 1000; j < len; ++j)
+          input[j] = input[j % 1000];
+
+      enc = malloc (be->bound (len));
+      if (be->encode (input, len, enc, be->bound (len), &enc_len,
+            be->default_level) ||
+          be->decode (enc, enc_len, dec, INPUTSZ, &dec_len) ||
+          dec_len != len || memcmp (dec, input, len)) {
+        printf ("%s, density %d: round trip failed\n", be->name,
+            densities[i]);
+        return 1;
+      }
+
+      /* too little room is an error, not an overrun */
+      if (!be->decode (enc, enc_len, dec, len / 2, &dec_len)) {
+        printf ("%s, density %d: short output accepted\n", be->name,
+            densities[i]);
+        return 1;
+      }
+
+      printf ("%s, density %d/1000: %zu -> %zu bytes, ok\n", be->name,
+          densities[i], len, enc_len);
+      free (enc);
+    }
+  }
+
+  free (input);
+  free (dec);
+  return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+#include "batch.h"
+
+#define NINPUTS 500
+#define MAXSZ 8192
+
+int main ()
+{
+  struct golomb_buffer inputs[NINPUTS];
+  size_t offsets[NINPUTS + 1], arena_len, ge_size, gd_size, len, i, k;
+  uint64_t params[NINPUTS], param;
+  unsigned char *buf;
+  void *arena, *ge, *gd;
+  int permille, nthreads, kernel;
+
+  srand (1);
+
+  /* 1 to 8 KB filters of every density, and a few corner cases */
+  for (i = 0; i < NINPUTS; ++i) {
+    len = (i == 0) ? 0 : 1 + rand () % MAXSZ;
+    permille = rand () % 1001;
+    buf = malloc (len ? len : 1);
+    for (k = 0; k < len; ++k)
+      buf[k] = (rand () % 1000 < permille) ? rand () | rand () : 
+        rand () & rand () & rand ();
+    if (i == 1) memset (buf, 0, len);
+    if (i == 2) memset (buf, 255, len);
+    /* runs long enough for code words of hundreds of bits */
+    if (i == 3 || i == 4) memset (buf + len / 4, i == 3 ? 0 : 255, len / 2);
+    inputs[i].data = buf;
+    inputs[i].len = len;
+  }
+
+  /* the scalar kernel, then the vector one if this CPU has it */
+  for (kernel = GOLOMB_BATCH_SCALAR; kernel <= GOLOMB_BATCH_AVX512; ++kernel)
+  for (nthreads = 1; nthreads <= 4; nthreads += 3) {
+    if (kernel != golomb_encode_batch_kernel (kernel ? GOLOMB_BATCH_AUTO :
+          GOLOMB_BATCH_SCALAR))
+      break;
+    if (golomb_encode_batch (inputs, NINPUTS, nthreads, &arena, 
+          &arena_len, offsets, params)) {
+      printf ("batch encoding failed\n");
+      return 1;
+    }
+
+    /* every output matches golomb_encode byte for byte */
+    for (i = 0; i < NINPUTS; ++i) {
+      if (golomb_encode (inputs[i].data, inputs[i].len, &ge, &ge_size,
+            &param) ||
+          param != params[i] || ge_size != offsets[i + 1] - offsets[i] ||
+          memcmp (ge, (unsigned char*) arena + offsets[i], ge_size)) {
+        printf ("kernel %d, %d threads: output %zu mismatches\n", kernel,
+            nthreads, i);
+        return 1;
+      }
+      free (ge);
+    }
+
+    if (golomb_decode ((unsigned char*) arena + offsets[7], 
+          offsets[8] - offsets[7], params[7], &gd, &gd_size) ||
+        gd_size != inputs[7].len || memcmp (gd, inputs[7].data, gd_size)) {
+      printf ("kernel %d, %d threads: output 7 does not decode\n", kernel,
+          nthreads);
+      return 1;
+    }
+    free (gd);
+
+    printf ("batch of %d, kernel %d with %d threads: %zu bytes\n", NINPUTS,
+        kernel, nthreads, arena_len);
+    free (arena);
+  }
+
+  /* an empty batch */
+  if (golomb_encode_batch (inputs, 0, 4, &arena, &arena_len, offsets, 
+        params) || arena_len || offsets[0]) {
+    printf ("empty batch failed\n");
+    return 1;
+  }
+  free (arena);
+
+  for (i = 0; i < NINPUTS; ++i)
+    free ((void*) inputs[i].data);
+
+  return 0;
+}
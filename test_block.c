@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+#include "block.h"
+#include "pack.h"
+
+#define INPUTSZ (64 * 1024)
+#define BLOCKSZ 4096
+
+/*
+ * A filter partitioned by key prefix: each 4 KB region gets its own
+ * density, anywhere from nearly empty to ten times denser than its
+ * neighbours
+ */
+static void
+fill_clustered (unsigned char *buf, size_t size)
+{
+  size_t i;
+  int k, permille = 5;
+
+  for (i = 0; i < size; ++i) {
+    if (i % BLOCKSZ == 0)
+      permille = (rand () % 2) ? 5 + rand () % 10 : 100 + rand () % 150;
+    buf[i] = 0;
+    for (k = 0; k < 8; ++k)
+      if (rand () % 1000 < permille)
+        buf[i] |= 1 << k;
+  }
+}
+
+int main ()
+{
+  struct golomb_block_info info;
+  unsigned char *input, *block;
+  void *be, *bd, *ge;
+  size_t be_size, bd_size, ge_size, k;
+  uint64_t golomb_param;
+
+  srand (1);
+  input = malloc (INPUTSZ);
+  fill_clustered (input, INPUTSZ);
+
+  if (golomb_block_encode (input, INPUTSZ, BLOCKSZ, &be, &be_size)) {
+    printf ("block encoding failed\n");
+    return 1;
+  }
+  if (golomb_encode (input, INPUTSZ, &ge, &ge_size, &golomb_param)) {
+    printf ("golomb encoding failed\n");
+    return 1;
+  }
+  printf ("clustered input: %d bytes, one b: %zu bytes, b per block: "
+      "%zu bytes\n", INPUTSZ, ge_size, be_size);
+
+  if (golomb_block_decode (be, be_size, &bd, &bd_size) ||
+      bd_size != INPUTSZ || memcmp (bd, input, INPUTSZ)) {
+    printf ("block decoding mismatches\n");
+    return 1;
+  }
+
+  /* every block decodes on its own too */
+  if (golomb_block_info (be, be_size, &info)) {
+    printf ("bad block header\n");
+    return 1;
+  }
+  block = malloc (BLOCKSZ);
+  for (k = 0; k < info.nblocks; ++k) {
+    if (golomb_block_decode_block (&info, k, block) ||
+        memcmp (block, input + k * BLOCKSZ, BLOCKSZ)) {
+      printf ("block %zu mismatches\n", k);
+      return 1;
+    }
+  }
+  free (block);
+  free (ge);
+
+  /* the complement of the filter codes to about the same size: the
+   * dense blocks code their clear bits */
+  {
+    unsigned char *inverted = malloc (INPUTSZ);
+    void *ie, *id;
+    size_t ie_size, id_size;
+
+    for (k = 0; k < INPUTSZ; ++k)
+      inverted[k] = ~input[k];
+    if (golomb_block_encode (inverted, INPUTSZ, BLOCKSZ, &ie, &ie_size) ||
+        golomb_block_decode (ie, ie_size, &id, &id_size) ||
+        id_size != INPUTSZ || memcmp (id, inverted, INPUTSZ)) {
+      printf ("inverted input mismatches\n");
+      return 1;
+    }
+    printf ("inverted input: %zu bytes\n", ie_size);
+    if (ie_size > be_size + info.nblocks) {
+      printf ("inverted input codes larger than the original\n");
+      return 1;
+    }
+    free (inverted);
+    free (ie);
+    free (id);
+  }
+
+  /* mixed regions: sparse, coin-flip random, a repeating pattern and
+   * saturated; each gets its own codec and nothing expands by more
+   * than a byte a block */
+  {
+    static const int want[3][4] = {
+      { GOLOMB_BLOCK_GOLOMB, GOLOMB_BLOCK_RAW, GOLOMB_BLOCK_GOLOMB,
+        GOLOMB_BLOCK_COMPLEMENT },
+      { GOLOMB_BLOCK_GOLOMB, GOLOMB_BLOCK_RAW, GOLOMB_BLOCK_DEFLATE,
+        GOLOMB_BLOCK_COMPLEMENT },
+      { -1, GOLOMB_BLOCK_RAW, GOLOMB_BLOCK_DEFLATE, -1 },
+    };
+    unsigned char *mixed = malloc (4 * BLOCKSZ);
+    void *me, *md;
+    size_t me_size, md_size;
+    int bias, type;
+
+    fill_clustered (mixed, BLOCKSZ);
+    for (k = BLOCKSZ; k < 2 * BLOCKSZ; ++k)
+      mixed[k] = rand ();
+    for (k = 2 * BLOCKSZ; k < 3 * BLOCKSZ; ++k)
+      mixed[k] = (k % 24 == 0) ? 0x81 : (k % 24 == 7) ? 0x10 : 0;
+    memset (mixed + 3 * BLOCKSZ, 255, BLOCKSZ);
+
+    for (bias = GOLOMB_BLOCK_FAST; bias <= GOLOMB_BLOCK_SMALLEST; ++bias) {
+      if (golomb_block_encode_hybrid (mixed, 4 * BLOCKSZ, BLOCKSZ, bias,
+            &me, &me_size) ||
+          golomb_block_decode (me, me_size, &md, &md_size) ||
+          md_size != 4 * BLOCKSZ || memcmp (md, mixed, md_size) ||
+          golomb_block_info (me, me_size, &info)) {
+        printf ("hybrid bias %d mismatches\n", bias);
+        return 1;
+      }
+      printf ("hybrid bias %d: %d -> %zu bytes, blocks", bias, 
+          4 * BLOCKSZ, me_size);
+      for (k = 0; k < 4; ++k) {
+        type = info.payload[get_le64 (info.index + k * 8)];
+        printf (" %d", type);
+        if (want[bias][k] >= 0 && type != want[bias][k]) {
+          printf ("\nblock %zu coded as %d, expected %d\n", k, type,
+              want[bias][k]);
+          return 1;
+        }
+      }
+      printf ("\n");
+      free (me);
+      free (md);
+    }
+
+    for (k = 0; k < 4 * BLOCKSZ; ++k)
+      mixed[k] = rand ();
+    if (golomb_block_encode_hybrid (mixed, 4 * BLOCKSZ, BLOCKSZ, 
+          GOLOMB_BLOCK_SMALLEST, &me, &me_size) ||
+        me_size > GOLOMB_BLOCK_HEADER_SIZE + 5 * 8 + 4 + 4 * BLOCKSZ) {
+      printf ("random input expanded to %zu bytes\n", me_size);
+      return 1;
+    }
+    free (me);
+    free (mixed);
+  }
+
+  /* rank and select against a bit by bit count, with a saturated
+   * block and a short last block in the mix */
+  {
+    unsigned char *bits = malloc (INPUTSZ);
+    void *re;
+    size_t re_size, len = INPUTSZ - 100;
+    uint64_t pos, rank, got, count;
+
+    memcpy (bits, input, len);
+    for (k = BLOCKSZ; k < 2 * BLOCKSZ; ++k)
+      bits[k] = ~bits[k];
+
+    if (golomb_block_encode_hybrid (bits, len, BLOCKSZ, 
+          GOLOMB_BLOCK_BALANCED | GOLOMB_BLOCK_RANK, &re, &re_size) ||
+        golomb_block_info (re, re_size, &info) ||
+        golomb_block_cardinality (&info, &count) ||
+        count != num_set_bits (bits, len)) {
+      printf ("rank index cardinality mismatches\n");
+      return 1;
+    }
+    printf ("rank index: %zu set bits, %zu bytes\n", (size_t) count, 
+        re_size);
+
+    for (pos = 0, rank = 0; pos <= len * 8; ++pos) {
+      if (pos % 997 == 0 || pos % (BLOCKSZ * 8) < 9 || pos == len * 8) {
+        if (golomb_block_rank (&info, pos, &got) || got != rank) {
+          printf ("rank of bit %zu mismatches\n", (size_t) pos);
+          return 1;
+        }
+      }
+      if (pos < len * 8 && (bits[pos / 8] & (0x80 >> (pos % 8)))) {
+        if (rank % 61 == 0 || rank == count - 1) {
+          if (golomb_block_select (&info, rank, &got) || got != pos) {
+            printf ("select of bit %zu mismatches\n", (size_t) rank);
+            return 1;
+          }
+        }
+        rank++;
+      }
+    }
+    if (!golomb_block_select (&info, count, &got) ||
+        !golomb_block_rank (&info, len * 8 + 1, &got)) {
+      printf ("rank or select out of range succeeded\n");
+      return 1;
+    }
+
+    /* without the index the queries say so */
+    free (re);
+    if (golomb_block_encode (bits, len, BLOCKSZ, &re, &re_size) ||
+        golomb_block_info (re, re_size, &info) ||
+        golomb_block_rank (&info, 0, &got) != -1) {
+      printf ("rank without an index succeeded\n");
+      return 1;
+    }
+    free (re);
+    free (bits);
+  }
+
+  /* bits set in place match setting them before encoding, with the
+   * rank index kept up; a few land in a saturated block and in the
+   * short last one */
+  {
+    unsigned char *bits = malloc (INPUTSZ);
+    uint64_t positions[300], count, got;
+    void *se, *sd;
+    size_t se_size, sd_size, len = INPUTSZ - 100, i;
+
+    memcpy (bits, input, len);
+    for (k = BLOCKSZ; k < 2 * BLOCKSZ; ++k)
+      bits[k] = 0xff;
+    if (golomb_block_encode_slack (bits, len, BLOCKSZ, 
+          GOLOMB_BLOCK_BALANCED | GOLOMB_BLOCK_RANK, 64, &se, &se_size)) {
+      printf ("encoding with slack failed\n");
+      return 1;
+    }
+
+    for (i = 0; i < 300; ++i) {
+      positions[i] = (i % 5 == 0) ? (uint64_t) BLOCKSZ * 8 + rand () % 999 :
+        (i % 7 == 0) ? len * 8 - 1 - rand () % 500 : 
+        (uint64_t) rand () % (len * 8);
+      bits[positions[i] / 8] |= 0x80 >> (positions[i] % 8);
+    }
+    if (golomb_block_set_bits (se, se_size, positions, 300) ||
+        golomb_block_decode (se, se_size, &sd, &sd_size) ||
+        sd_size != len || memcmp (sd, bits, len)) {
+      printf ("set bits in place mismatches\n");
+      return 1;
+    }
+    if (golomb_block_info (se, se_size, &info) ||
+        golomb_block_cardinality (&info, &count) ||
+        count != num_set_bits (bits, len) ||
+        golomb_block_rank (&info, len * 8 - 4000, &got) ||
+        got != num_set_bits (bits, len - 500)) {
+      printf ("rank index not kept up by set bits\n");
+      return 1;
+    }
+    printf ("set bits in place: 300 bits, %zu bytes with slack\n", se_size);
+    free (sd);
+
+    /* with little slack an empty block soon runs out of room, and
+     * the bits before it stay set */
+    free (se);
+    memset (bits, 0, len);
+    if (golomb_block_encode_slack (bits, len, BLOCKSZ, GOLOMB_BLOCK_FAST,
+          32, &se, &se_size)) {
+      printf ("encoding an empty input failed\n");
+      return 1;
+    }
+    for (i = 0; i < 300; ++i)
+      positions[i] = (i < 10) ? i * 997 : 
+        (uint64_t) BLOCKSZ * 8 * 3 + i * 61;
+    if (golomb_block_set_bits (se, se_size, positions, 300) != 
+          GOLOMB_BLOCK_FULL ||
+        golomb_block_decode (se, se_size, &sd, &sd_size) ||
+        ((unsigned char*) sd)[0] != 0x80 || num_set_bits (sd, len) != 10) {
+      printf ("full block not reported\n");
+      return 1;
+    }
+    positions[0] = len * 8;
+    if (golomb_block_set_bits (se, se_size, positions, 1) != -1) {
+      printf ("set bit past the end succeeded\n");
+      return 1;
+    }
+    free (sd);
+    free (se);
+    free (bits);
+  }
+
+  /* a short last block, and an empty input */
+  free (be);
+  free (bd);
+  if (golomb_block_encode (input, INPUTSZ - 100, BLOCKSZ, &be, &be_size) ||
+      golomb_block_decode (be, be_size, &bd, &bd_size) ||
+      bd_size != INPUTSZ - 100 || memcmp (bd, input, INPUTSZ - 100)) {
+    printf ("short last block mismatches\n");
+    return 1;
+  }
+  free (be);
+  free (bd);
+  if (golomb_block_encode (input, 0, BLOCKSZ, &be, &be_size) ||
+      golomb_block_decode (be, be_size, &bd, &bd_size) || bd_size) {
+    printf ("empty input mismatches\n");
+    return 1;
+  }
+  free (be);
+  free (bd);
+  free (input);
+
+  return 0;
+}
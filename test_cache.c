@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "block.h"
+#include "cache.h"
+#include "test_util.h"
+
+#define INPUTSZ (256 * 1024)
+#define BLOCKSZ 4096
+#define NBLOCKS (INPUTSZ / BLOCKSZ)
+#define NTHREADS 4
+#define QUERIES 20000
+
+static struct golomb_cache cache;
+static struct golomb_block_info info;
+static unsigned char *input;
+
+/*
+ * Query bits with a skew towards the first few blocks, the way a hot
+ * set of keys would, and check them against the bitmap.
+ */
+static void *
+query_worker (void *arg)
+{
+  unsigned int seed = (unsigned int) (size_t) arg;
+  uint64_t pos;
+  size_t i, *failed = arg;
+  int bit;
+
+  for (i = 0; i < QUERIES; ++i) {
+    pos = (rand_r (&seed) % 4) ?
+      (uint64_t) rand_r (&seed) % (8 * BLOCKSZ * 8) :
+      (uint64_t) rand_r (&seed) % (INPUTSZ * 8);
+    if (golomb_cache_test_bit (&cache, 7, &info, pos, &bit) ||
+        bit != !!(input[pos / 8] & (0x80 >> (pos % 8)))) {
+      *failed = 1;
+      break;
+    }
+  }
+  return NULL;
+}
+
+/* the swap test: readers look up whichever filter is current, and
+ * each block they get has to be that block of one of the two */
+static const struct golomb_block_info *current;
+static const unsigned char *swap_inputs[2];
+static int swapping;
+
+static void *
+swap_reader (void *arg)
+{
+  struct golomb_cache_entry *e;
+  const unsigned char *data;
+  unsigned int seed = 7;
+  size_t k, *failed = arg;
+
+  while (__atomic_load_n (&swapping, __ATOMIC_RELAXED)) {
+    k = rand_r (&seed) % NBLOCKS;
+    if (golomb_cache_get (&cache, 9,
+          __atomic_load_n (&current, __ATOMIC_ACQUIRE), k, &data, &e))
+      continue;
+    if (memcmp (data, swap_inputs[0] + k * BLOCKSZ, BLOCKSZ) &&
+        memcmp (data, swap_inputs[1] + k * BLOCKSZ, BLOCKSZ))
+      *failed = 1;
+    golomb_cache_put (&cache, e);
+  }
+  return NULL;
+}
+
+int main ()
+{
+  struct golomb_cache_stats st;
+  struct golomb_cache_entry *e1, *e2;
+  const unsigned char *d1, *d2;
+  pthread_t threads[NTHREADS];
+  size_t results[NTHREADS], budget, i;
+  void *enc;
+  size_t enc_size;
+
+  srand (1);
+  input = malloc (INPUTSZ);
+  fill_random (input, INPUTSZ, 50);
+  if (golomb_block_encode (input, INPUTSZ, BLOCKSZ, &enc, &enc_size) ||
+      golomb_block_info (enc, enc_size, &info)) {
+    printf ("encoding failed\n");
+    return 1;
+  }
+
+  /* room for a quarter of the blocks, twice the hot ones */
+  budget = NBLOCKS / 4 * (BLOCKSZ + 128);
+  if (golomb_cache_init (&cache, budget, 4)) {
+    printf ("cache init failed\n");
+    return 1;
+  }
+
+  /* a second get is a hit on the same bytes, and a pinned block
+   * outlives its filter being dropped */
+  if (golomb_cache_get (&cache, 1, &info, 3, &d1, &e1) ||
+      golomb_cache_get (&cache, 1, &info, 3, &d2, &e2) || d1 != d2 ||
+      memcmp (d1, input + 3 * BLOCKSZ, BLOCKSZ)) {
+    printf ("get mismatches\n");
+    return 1;
+  }
+  golomb_cache_invalidate (&cache, 1);
+  golomb_cache_get_stats (&cache, &st);
+  if (st.hits != 1 || st.misses != 1 || st.entries || st.bytes ||
+      memcmp (d2, input + 3 * BLOCKSZ, BLOCKSZ)) {
+    printf ("invalidate misbehaves\n");
+    return 1;
+  }
+  golomb_cache_put (&cache, e1);
+  golomb_cache_put (&cache, e2);
+  if (!golomb_cache_get (&cache, 1, &info, NBLOCKS, &d1, &e1)) {
+    printf ("block past the end succeeded\n");
+    return 1;
+  }
+
+  /* threads querying at once */
+  for (i = 0; i < NTHREADS; ++i) {
+    results[i] = 0;
+    if (pthread_create (&threads[i], NULL, query_worker, &results[i])) {
+      printf ("cannot start thread\n");
+      return 1;
+    }
+  }
+  for (i = 0; i < NTHREADS; ++i) {
+    pthread_join (threads[i], NULL);
+    if (results[i]) {
+      printf ("thread %zu: query mismatches\n", i);
+      return 1;
+    }
+  }
+
+  golomb_cache_get_stats (&cache, &st);
+  printf ("%d queries: %zu hits, %zu misses, %zu evictions, %zu blocks "
+      "in %zu of %zu bytes\n", NTHREADS * QUERIES, (size_t) st.hits,
+      (size_t) st.misses, (size_t) st.evictions, (size_t) st.entries,
+      (size_t) st.bytes, budget);
+  if (st.hits + st.misses != NTHREADS * QUERIES + 2 ||
+      st.hits < st.misses || !st.evictions || st.bytes > budget ||
+      st.entries > st.misses - st.evictions - 1) {
+    printf ("counters wrong\n");
+    return 1;
+  }
+
+  /* a filter changed and invalidated over and over while readers
+   * are missing on it, so that decodes are under way across the
+   * invalidations; blocks decoded then are handed out but not kept */
+  {
+    struct golomb_block_info info2;
+    struct golomb_cache_entry *e;
+    const unsigned char *data;
+    unsigned char *input2;
+    void *enc2;
+    size_t enc2_size, k;
+    int round;
+
+    input2 = malloc (INPUTSZ);
+    fill_random (input2, INPUTSZ, 200);
+    if (golomb_block_encode (input2, INPUTSZ, BLOCKSZ, &enc2, &enc2_size) ||
+        golomb_block_info (enc2, enc2_size, &info2)) {
+      printf ("encoding failed\n");
+      return 1;
+    }
+    swap_inputs[0] = input;
+    swap_inputs[1] = input2;
+
+    current = &info;
+    swapping = 1;
+    for (i = 0; i < NTHREADS; ++i) {
+      results[i] = 0;
+      if (pthread_create (&threads[i], NULL, swap_reader, &results[i])) {
+        printf ("cannot start thread\n");
+        return 1;
+      }
+    }
+    for (round = 0; round < 200; ++round) {
+      __atomic_store_n (&current, (round & 1) ? &info : &info2,
+          __ATOMIC_RELEASE);
+      golomb_cache_invalidate (&cache, 9);
+    }
+    __atomic_store_n (&swapping, 0, __ATOMIC_RELAXED);
+    for (i = 0; i < NTHREADS; ++i) {
+      pthread_join (threads[i], NULL);
+      if (results[i]) {
+        printf ("thread %zu: block of neither filter\n", i);
+        return 1;
+      }
+    }
+
+    /* with no lookups of the old one left, the new one is all there
+     * is once it's invalidated */
+    current = &info2;
+    golomb_cache_invalidate (&cache, 9);
+    for (k = 0; k < NBLOCKS; ++k) {
+      if (golomb_cache_get (&cache, 9, &info2, k, &data, &e) ||
+          memcmp (data, input2 + k * BLOCKSZ, BLOCKSZ)) {
+        printf ("stale block served after invalidate\n");
+        return 1;
+      }
+      golomb_cache_put (&cache, e);
+    }
+    printf ("200 invalidations under %d readers ok\n", NTHREADS);
+
+    free (enc2);
+    free (input2);
+  }
+
+  golomb_cache_destroy (&cache);
+  free (enc);
+  free (input);
+  return 0;
+}
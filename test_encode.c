@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "encode.h"
+#include "pack.h"
 
 #define INPUTSZ 5
 
@@ -14,14 +16,14 @@ char *hex2bin[] = {
 
 int main ()
 {
-    unsigned int *out;
-    unsigned long outsize;
+    uint64_t *out;
+    size_t outsize;
     unsigned char *decoded;
     unsigned char *ge, *gd;
-    unsigned long ge_size, gd_size;
-    unsigned int golomb_param;
-    unsigned long decoded_size;
-    unsigned char input[] = { 1, 5, 4, 5 };
+    size_t ge_size, gd_size;
+    uint64_t golomb_param;
+    size_t decoded_size;
+    unsigned char input[INPUTSZ] = { 1, 5, 4, 5 };
     //unsigned char str[] = {0, 0, 0, 0, 8, 2, 20, 128, 30};
     //unsigned char input[INPUTSZ];
     int i;
@@ -38,10 +40,10 @@ int main ()
         printf ("returned false\n");
     } else {
 
-        printf ("encoded size: %lu\nrun-lengths: ", outsize);
+        printf ("encoded size: %zu\nrun-lengths: ", outsize);
         for (i = 0; i < outsize; ++i) {
             //printf ("%s ", hex2bin[out[i]]);
-            printf ("%d ", out[i]);
+            printf ("%llu ", (unsigned long long) out[i]);
         }
         printf ("\n");
 
@@ -51,19 +53,22 @@ int main ()
         printf ("decoding failure\n");
     } else {
         /*
-           printf ("decoded size: %lu\nunsigned chars: ", decoded_size);
+           printf ("decoded size: %zu\nunsigned chars: ", decoded_size);
            for (i = 0; i < decoded_size; ++i) 
            printf ("%d ", decoded[i]);
            printf ("\n");
          */
+        free (decoded);
     }
+    free (out);
 
     //printf ("testing golomb encoding\n");
     if (golomb_encode (input, inputsz, (void*)&ge, &ge_size, &golomb_param) ) {
         printf ("golomb encoding failed\n");
     } else {
 
-        printf ("ge param: %d, ge chars: ", golomb_param);
+        printf ("ge param: %llu, ge chars: ", 
+            (unsigned long long) golomb_param);
 
         for (i = 0; i < ge_size; ++i) 
             printf ("%s %s ",  hex2bin[ge[i] >> 4], hex2bin[ge[i] & 0x0f]);
@@ -81,9 +86,333 @@ int main ()
                     goto print_on_error;
                 }
             }
+            free (gd);
+        }
+        free (ge);
+    }
+
+    /* gaps and parameters past 32 bits go through the kernels intact */
+    {
+        uint64_t wide[] = { 1, 5000000000ULL, 3, 1ULL << 40, 77 };
+        uint64_t back[5];
+        uint64_t b = 3000000000ULL, bits, pos = 0;
+        unsigned char *buf;
+
+        bits = golomb_gaps_bits (wide, 5, b);
+        buf = calloc (bits / 8 + 1, 1);
+        golomb_encode_gaps (wide, 5, b, buf, &pos);
+
+        pos = 0;
+        if (golomb_decode_gaps (buf, &pos, bits, b, back, 5) != 5 ||
+            memcmp (wide, back, sizeof (wide))) {
+            printf ("64 bit gaps mismatch\n");
+            return 1;
+        }
+        free (buf);
+    }
+
+    /* the alternative codecs and the selector round trip a bitmap
+     * with clustered set bits, and select finds every set bit */
+    {
+        unsigned char bitmap[4096];
+        void *enc, *dec;
+        size_t enc_size, dec_size, j;
+        uint64_t k = 0, pos;
+        int codec;
+
+        for (j = 0; j < sizeof (bitmap); ++j)
+            bitmap[j] = ((j / 512) % 2 && rand () % 4 == 0) ? rand () : 0;
+
+        if (expgolomb_encode (bitmap, sizeof (bitmap), &enc, &enc_size) ||
+            expgolomb_decode (enc, enc_size, &dec, &dec_size) ||
+            dec_size != sizeof (bitmap) || memcmp (dec, bitmap, dec_size)) {
+            printf ("exp-golomb round trip failed\n");
+            return 1;
+        }
+        printf ("exp-golomb: %zu -> %zu bytes\n", sizeof (bitmap), enc_size);
+        free (enc);
+        free (dec);
+
+        if (eliasfano_encode (bitmap, sizeof (bitmap), &enc, &enc_size) ||
+            eliasfano_decode (enc, enc_size, &dec, &dec_size) ||
+            dec_size != sizeof (bitmap) || memcmp (dec, bitmap, dec_size)) {
+            printf ("elias-fano round trip failed\n");
+            return 1;
+        }
+        printf ("elias-fano: %zu -> %zu bytes\n", sizeof (bitmap), enc_size);
+
+        for (j = 0; j < sizeof (bitmap) * 8; ++j) {
+            if (!(bitmap[j / 8] & (0x80 >> (j % 8))))
+                continue;
+            if (eliasfano_select (enc, enc_size, k++, &pos) || pos != j) {
+                printf ("elias-fano select mismatches at bit %zu\n", j);
+                return 1;
+            }
+        }
+        if (!eliasfano_select (enc, enc_size, k, &pos)) {
+            printf ("elias-fano select past the last bit\n");
+            return 1;
+        }
+
+        /* a sample pointing past the high bits is refused instead of
+         * followed */
+        {
+            unsigned char *bad = malloc (enc_size);
+            size_t hdr = varint_len (sizeof (bitmap)) + varint_len (k) + 1;
+
+            memcpy (bad, enc, enc_size);
+            put_le64 (bad + hdr, 1ULL << 40);
+            put_le64 (bad + hdr + 8, ~0ULL);
+            if (!eliasfano_select (bad, enc_size, 0, &pos) ||
+                !eliasfano_select (bad, enc_size, 256, &pos)) {
+                printf ("elias-fano select followed a corrupt sample\n");
+                return 1;
+            }
+            free (bad);
+        }
+        free (enc);
+        free (dec);
+
+        if (auto_encode (bitmap, sizeof (bitmap), &enc, &enc_size, &codec) ||
+            auto_decode (enc, enc_size, &dec, &dec_size) ||
+            dec_size != sizeof (bitmap) || memcmp (dec, bitmap, dec_size)) {
+            printf ("auto round trip failed\n");
+            return 1;
+        }
+        printf ("auto: codec %d, %zu -> %zu bytes\n", codec, 
+            sizeof (bitmap), enc_size);
+        free (enc);
+        free (dec);
+
+        /* a saturated bitmap codes its few clear bits, so it shrinks
+         * like a sparse one instead of growing */
+        for (j = 0; j < sizeof (bitmap); ++j)
+            bitmap[j] = (rand () % 64) ? 255 : 255 ^ (1 << (rand () % 8));
+
+        if (golomb_encode (bitmap, sizeof (bitmap), &enc, &enc_size, 
+                &golomb_param) ||
+            !(golomb_param & GOLOMB_PARAM_COMPLEMENT) ||
+            golomb_decode (enc, enc_size, golomb_param, &dec, &dec_size) ||
+            dec_size != sizeof (bitmap) || memcmp (dec, bitmap, dec_size)) {
+            printf ("dense golomb round trip failed\n");
+            return 1;
+        }
+        printf ("dense golomb: %zu -> %zu bytes\n", sizeof (bitmap), 
+            enc_size);
+        if (enc_size >= sizeof (bitmap) / 4) {
+            printf ("dense golomb did not shrink\n");
+            return 1;
+        }
+        free (enc);
+        free (dec);
+
+        memset (bitmap, 255, sizeof (bitmap));
+        if (golomb_encode (bitmap, sizeof (bitmap), &enc, &enc_size, 
+                &golomb_param) ||
+            golomb_decode (enc, enc_size, golomb_param, &dec, &dec_size) ||
+            dec_size != sizeof (bitmap) || memcmp (dec, bitmap, dec_size) ||
+            enc_size > 16) {
+            printf ("all ones golomb round trip failed\n");
+            return 1;
+        }
+        free (enc);
+        free (dec);
+    }
+
+    /* the interleaved decoder gives what golomb_decode does, with
+     * more streams than lanes, of every size and density */
+    {
+        struct golomb_stream streams[37];
+        void *outs[37], *enc, *dec;
+        size_t lens[37], enc_size, dec_size, j, k;
+        unsigned char *bitmap;
+        uint64_t param;
+
+        for (j = 0; j < 37; ++j) {
+            lens[j] = (j * 997) % 5000;
+            bitmap = malloc (lens[j] + 1);
+            for (k = 0; k < lens[j]; ++k)
+                bitmap[k] = (rand () % 37 < j) ? rand () : 0;
+            if (golomb_encode (bitmap, lens[j], &enc, &enc_size, &param)) {
+                printf ("golomb encoding failed\n");
+                return 1;
+            }
+            streams[j].data = enc;
+            streams[j].len = enc_size;
+            streams[j].golomb_param = param;
+            free (bitmap);
+        }
 
+        if (golomb_decode_many (streams, 37, outs, lens)) {
+            printf ("golomb decode many failed\n");
+            return 1;
+        }
+        for (j = 0; j < 37; ++j) {
+            if (golomb_decode (streams[j].data, streams[j].len, 
+                    streams[j].golomb_param, &dec, &dec_size) ||
+                dec_size != lens[j] || memcmp (dec, outs[j], dec_size)) {
+                printf ("golomb decode many mismatches on stream %zu\n", j);
+                return 1;
+            }
+            free (dec);
+            free (outs[j]);
+            free ((void*) streams[j].data);
         }
     }
+
+    /* the safe decoder gives what golomb_decode does on whole streams,
+     * and on cut or damaged ones errors out without reading or writing
+     * out of bounds */
+    {
+        /* one code word whose gap overflows to zero */
+        unsigned char wrap[9] = { 0xf0, 0, 0, 0, 0, 0, 0, 0, 0x80 };
+        unsigned char *bitmap;
+        void *enc, *dec;
+        size_t enc_size, dec_size, len = 20000, j, caught = 0;
+        uint64_t param;
+
+        bitmap = malloc (len);
+        for (j = 0; j < len; ++j)
+            bitmap[j] = (rand () % 8 == 0) ? 1 << (rand () % 8) : 0;
+        if (golomb_encode (bitmap, len, &enc, &enc_size, &param) ||
+            golomb_decode_safe (enc, enc_size, param, len, &dec, 
+                &dec_size) ||
+            dec_size != len || memcmp (dec, bitmap, len)) {
+            printf ("safe decode mismatches\n");
+            return 1;
+        }
+        free (dec);
+
+        if (golomb_decode_safe (enc, enc_size, param, len - 1, &dec, 
+                &dec_size) != GOLOMB_ERR_TOO_BIG ||
+            golomb_decode_safe (enc, 0, param, len, &dec, 
+                &dec_size) != GOLOMB_ERR_TRUNCATED ||
+            golomb_decode_safe (wrap, sizeof (wrap), (1ULL << 62) - 1, 
+                len, &dec, &dec_size) != GOLOMB_ERR_CORRUPT ||
+            golomb_decode (wrap, sizeof (wrap), (1ULL << 62) - 1, 
+                &dec, &dec_size) != GOLOMB_ERR_CORRUPT) {
+            printf ("safe decode error codes wrong\n");
+            return 1;
+        }
+
+        /* there's no checksum, so the odd cut can look whole */
+        for (j = 1; j < enc_size; ++j) {
+            if (golomb_decode_safe (enc, j, param, len, &dec, &dec_size))
+                caught++;
+            else
+                free (dec);
+        }
+        if (caught < (enc_size - 1) * 9 / 10) {
+            printf ("safe decode caught %zu of %zu cuts\n", caught, 
+                enc_size - 1);
+            return 1;
+        }
+
+        free (enc);
+        free (bitmap);
+    }
+
+    /* a bitmap of 64 bit words coded LSB first is the same stream as
+     * its bytes bit reversed coded MSB first, and every decoder puts
+     * it back as words */
+    {
+        uint64_t words[512], *rle;
+        unsigned char rev[sizeof (words)], *bytes;
+        void *enc, *enc_rev, *dec, *outs[2];
+        size_t enc_size, rev_size, dec_size, rle_size, lens[2], j;
+        struct golomb_stream two[2];
+        uint64_t param, rev_param;
+        int k;
+
+        memset (words, 0, sizeof (words));
+        for (j = 0; j < 3000; ++j) {
+            k = rand () % (sizeof (words) * 8);
+            words[k / 64] |= 1ULL << (k & 63);
+        }
+        bytes = (unsigned char*) words;
+        for (j = 0; j < sizeof (words); ++j) {
+            rev[j] = 0;
+            for (k = 0; k < 8; ++k)
+                if (bytes[j] & (1 << k))
+                    rev[j] |= 0x80 >> k;
+        }
+
+        if (golomb_encode_order (words, sizeof (words), GOLOMB_ORDER_LSB,
+                &enc, &enc_size, &param) ||
+            golomb_encode (rev, sizeof (rev), &enc_rev, &rev_size, 
+                &rev_param) ||
+            !(param & GOLOMB_PARAM_LSB) || 
+            (param & ~GOLOMB_PARAM_LSB) != rev_param ||
+            enc_size != rev_size || memcmp (enc, enc_rev, enc_size)) {
+            printf ("LSB first encode mismatches\n");
+            return 1;
+        }
+
+        two[0].data = two[1].data = enc;
+        two[0].len = two[1].len = enc_size;
+        two[0].golomb_param = two[1].golomb_param = param;
+        if (golomb_decode (enc, enc_size, param, &dec, &dec_size) ||
+            dec_size != sizeof (words) || memcmp (dec, words, dec_size) ||
+            golomb_decode_many (two, 2, outs, lens) ||
+            lens[1] != sizeof (words) || memcmp (outs[1], words, lens[1])) {
+            printf ("LSB first decode mismatches\n");
+            return 1;
+        }
+        free (dec);
+        free (outs[0]);
+        free (outs[1]);
+
+        if (golomb_decode_safe (enc, enc_size, param, sizeof (words), 
+                &dec, &dec_size) ||
+            dec_size != sizeof (words) || memcmp (dec, words, dec_size)) {
+            printf ("LSB first safe decode mismatches\n");
+            return 1;
+        }
+        free (dec);
+
+        if (get_run_length_encoding_order (bytes, sizeof (words), 
+                GOLOMB_ORDER_LSB, &rle, &rle_size) ||
+            get_run_length_decoding_order (rle, rle_size, GOLOMB_ORDER_LSB,
+                (unsigned char**) &dec, &dec_size) ||
+            dec_size != sizeof (words) || memcmp (dec, words, dec_size)) {
+            printf ("LSB first RLE mismatches\n");
+            return 1;
+        }
+        free (rle);
+        free (dec);
+        free (enc);
+        free (enc_rev);
+    }
+
+    /* zlib: empty input is a whole stream, input that doesn't
+     * compress grows the output, and a cut short stream is refused */
+    {
+        static unsigned char noise[3 * 8192 + 17];
+        void *ze, *zd;
+        size_t ze_size, zd_size;
+
+        for (i = 0; i < sizeof (noise); ++i)
+            noise[i] = rand ();
+        if (zlib_encode (noise, 0, &ze, &ze_size, 6) ||
+            zlib_decode (ze, ze_size, &zd, &zd_size) || zd_size) {
+            printf ("zlib empty input fails\n");
+            return 1;
+        }
+        free (ze);
+        free (zd);
+        if (zlib_encode (noise, sizeof (noise), &ze, &ze_size, 9) ||
+            zlib_decode (ze, ze_size, &zd, &zd_size) ||
+            zd_size != sizeof (noise) || memcmp (zd, noise, zd_size)) {
+            printf ("zlib incompressible input fails\n");
+            return 1;
+        }
+        free (zd);
+        if (zlib_decode (ze, ze_size - 5, &zd, &zd_size) != -1) {
+            printf ("zlib truncated stream decoded\n");
+            return 1;
+        }
+        free (ze);
+    }
     return 0;
 
 print_on_error:
@@ -96,7 +425,7 @@ print_on_error:
     for (i = 0; i < gd_size; ++i) 
         printf ("%d ", gd[i]);
     printf ("\n");
-    return 0;
+    return 1;
 }
 
 
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "encode.h"
+#include "estimate.h"
+#include "test_util.h"
+
+#define INPUTSZ (64 * 1024)
+
+/* the estimate of 'len' bytes against the real encodes */
+static int
+check (const unsigned char *input, size_t len, int order, int deflate)
+{
+  struct golomb_estimate est;
+  uint64_t param;
+  void *out;
+  size_t out_len;
+  double ratio;
+
+  if (golomb_estimate (input, len, order, &est)) {
+    printf ("%zu bytes: estimate failed\n", len);
+    return 1;
+  }
+  if (golomb_encode_order (input, len, order, &out, &out_len, &param)) {
+    printf ("%zu bytes: encode failed\n", len);
+    return 1;
+  }
+  free (out);
+  if (est.golomb_len != out_len || est.golomb_param != param) {
+    printf ("%zu bytes, order %d: estimated %zu bytes, param %llx; "
+        "encoded %zu, param %llx\n", len, order, est.golomb_len,
+        (unsigned long long) est.golomb_param, out_len,
+        (unsigned long long) param);
+    return 1;
+  }
+  if (!deflate) return 0;
+
+  if (zlib_encode (input, len, &out, &out_len, Z_DEFAULT_COMPRESSION)) {
+    printf ("%zu bytes: zlib failed\n", len);
+    return 1;
+  }
+  free (out);
+  ratio = (double) est.deflate_len / out_len;
+  printf ("%zu bytes, %llu set: golomb %zu, deflate %zu (estimated %zu, "
+      "%.2f)\n", len, (unsigned long long) est.ones, est.golomb_len,
+      out_len, est.deflate_len, ratio);
+  if (ratio < 0.65 || ratio > 1.35) {
+    printf ("deflate estimate too far out\n");
+    return 1;
+  }
+  return 0;
+}
+
+int main ()
+{
+  static const int densities[] = { 1, 5, 30, 100, 300, 500, 700, 950, 999 };
+  struct golomb_estimate est;
+  unsigned char *input;
+  size_t i, len;
+  int order;
+
+  srand (1);
+  input = malloc (INPUTSZ);
+
+  for (i = 0; i < sizeof (densities) / sizeof (densities[0]); ++i) {
+    fill_random (input, INPUTSZ, densities[i]);
+    if (check (input, INPUTSZ, GOLOMB_ORDER_MSB, 1) ||
+        check (input, INPUTSZ, GOLOMB_ORDER_LSB, 0))
+      return 1;
+
+    /* tails that aren't a whole word */
+    for (len = 1; len < 24; ++len)
+      for (order = GOLOMB_ORDER_MSB; order <= GOLOMB_ORDER_LSB; ++order)
+        if (check (input + 3, len, order, 0) ||
+            check (input, INPUTSZ - len, order, 0))
+          return 1;
+  }
+
+  /* all clear, all set, a single bit at either end */
+  memset (input, 0, INPUTSZ);
+  if (check (input, INPUTSZ, GOLOMB_ORDER_MSB, 1)) return 1;
+  input[0] = 0x80;
+  input[INPUTSZ - 1] = 0x01;
+  if (check (input, INPUTSZ, GOLOMB_ORDER_MSB, 0) ||
+      check (input, INPUTSZ, GOLOMB_ORDER_LSB, 0))
+    return 1;
+  memset (input, 0xff, INPUTSZ);
+  if (check (input, INPUTSZ, GOLOMB_ORDER_MSB, 1) ||
+      check (input, 13, GOLOMB_ORDER_LSB, 0))
+    return 1;
+
+  if (golomb_estimate (input, 0, GOLOMB_ORDER_MSB, &est) ||
+      est.golomb_len != 1 || est.ones) {
+    printf ("empty input misestimated\n");
+    return 1;
+  }
+  if (golomb_estimate (NULL, 1, GOLOMB_ORDER_MSB, &est) != -1 ||
+      golomb_estimate (input, 1, 7, &est) != -1) {
+    printf ("bad arguments accepted\n");
+    return 1;
+  }
+
+  free (input);
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "gcs.h"
+
+#define NKEYS 20000
+#define NPROBES 1000000
+#define FP_RATE (1.0 / 1024)
+
+int main ()
+{
+  struct gcs *gcs;
+  char **keys;
+  char probe[32];
+  unsigned long i, fp = 0;
+  double fp_seen;
+
+  keys = malloc (sizeof (char*) * NKEYS);
+  for (i = 0; i < NKEYS; ++i) {
+    keys[i] = malloc (32);
+    sprintf (keys[i], "key-%lu", i);
+  }
+
+  if (gcs_build ((const char**) keys, NKEYS, FP_RATE, &gcs)) {
+    printf ("gcs build failed\n");
+    return 1;
+  }
+
+  /* an optimal Bloom filter needs 1.44 log2(1/fp) bits per key */
+  printf ("gcs: %zu keys, b = %llu, %zu bytes (%.2f bits/key, "
+      "bloom filter: %.2f)\n",
+      gcs->n, (unsigned long long) gcs->golomb_param, gcs_size (gcs),
+      8.0 * gcs_size (gcs) / NKEYS, 1.44 * log2 (1.0 / FP_RATE));
+
+  for (i = 0; i < NKEYS; ++i) {
+    if (!gcs_contains (gcs, keys[i])) {
+      printf ("false negative on %s\n", keys[i]);
+      return 1;
+    }
+  }
+
+  for (i = 0; i < NPROBES; ++i) {
+    sprintf (probe, "absent-%lu", i);
+    fp += gcs_contains (gcs, probe);
+  }
+  fp_seen = (double) fp / NPROBES;
+  printf ("false positive rate: %f (target %f)\n", fp_seen, FP_RATE);
+
+  if (fp_seen > 1.5 * FP_RATE) {
+    printf ("false positive rate too high\n");
+    return 1;
+  }
+
+  gcs_free (gcs);
+
+  /* a rate so small that n / fp_rate, or the block range, wraps */
+  if (gcs_build ((const char**) keys, 16, ldexp (1.0, -60), &gcs) != -1 ||
+      gcs_build ((const char**) keys, NKEYS, ldexp (1.0, -50), &gcs) != -1) {
+    printf ("gcs build took an fp rate too small for the hash range\n");
+    return 1;
+  }
+
+  for (i = 0; i < NKEYS; ++i)
+    free (keys[i]);
+  free (keys);
+  return 0;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ints.h"
+
+#define NVALUES 100000
+
+static uint64_t
+rand64 (void)
+{
+  return ((uint64_t) rand () << 42) ^ ((uint64_t) rand () << 21) ^ rand ();
+}
+
+/* round trip 'n' 64 bit values; the coded size in '*len' */
+static int
+check64 (const char *what, const uint64_t *values, size_t n, int flags,
+    size_t *len)
+{
+  uint64_t *back;
+  void *enc;
+  size_t enc_len, m;
+
+  if (golomb_ints_encode64 (values, n, flags, &enc, &enc_len)) {
+    printf ("%s: encode failed\n", what);
+    return 1;
+  }
+  if (golomb_ints_decode64 (enc, enc_len, &back, &m) || m != n ||
+      (n && memcmp (back, values, n * sizeof (*values)))) {
+    printf ("%s: values don't round trip\n", what);
+    return 1;
+  }
+  free (back);
+
+  /* short of a byte, it must fail rather than make values up */
+  if (enc_len > 1 && !golomb_ints_decode64 (enc, enc_len - 1, &back, &m) &&
+      m == n) {
+    printf ("%s: truncated input decoded\n", what);
+    return 1;
+  }
+
+  free (enc);
+  if (len) *len = enc_len;
+  if (n)
+    printf ("%s: %zu values in %zu bytes, %.2f bits each\n", what, n,
+        enc_len, 8.0 * enc_len / n);
+  return 0;
+}
+
+static int
+check32 (const char *what, const uint32_t *values, size_t n, int flags,
+    size_t *len)
+{
+  uint32_t *back;
+  uint64_t *wide;
+  void *enc;
+  size_t enc_len, m;
+
+  if (golomb_ints_encode32 (values, n, flags, &enc, &enc_len)) {
+    printf ("%s: encode failed\n", what);
+    return 1;
+  }
+  if (golomb_ints_decode32 (enc, enc_len, &back, &m) || m != n ||
+      (n && memcmp (back, values, n * sizeof (*values)))) {
+    printf ("%s: values don't round trip\n", what);
+    return 1;
+  }
+  free (back);
+  if (golomb_ints_decode64 (enc, enc_len, &wide, &m) != -1) {
+    printf ("%s: decoded at the wrong width\n", what);
+    return 1;
+  }
+
+  free (enc);
+  if (len) *len = enc_len;
+  printf ("%s: %zu values in %zu bytes, %.2f bits each\n", what, n,
+      enc_len, 8.0 * enc_len / n);
+  return 0;
+}
+
+int main ()
+{
+  static const uint64_t extremes[] = {
+    0, ~0ULL, 1, ~0ULL - 1, 1ULL << 63, (1ULL << 63) - 1, 0, 0, ~0ULL
+  };
+  uint64_t *v64, x;
+  uint32_t *v32;
+  size_t i, len;
+  void *enc;
+  int flags;
+
+  srand (1);
+  v64 = malloc (NVALUES * sizeof (*v64));
+  v32 = malloc (NVALUES * sizeof (*v32));
+
+  /* a posting list: ids about 16 apart, which the deltas should code
+   * in not much more than log2 (16) + 1.5 bits */
+  for (i = 0, x = 0; i < NVALUES; ++i)
+    v64[i] = x += 1 + rand () % 31;
+  if (check64 ("sorted ids", v64, NVALUES, GOLOMB_INTS_DELTA, &len))
+    return 1;
+  if (len * 8 > NVALUES * 6.5) {
+    printf ("sorted ids coded too big\n");
+    return 1;
+  }
+
+  /* timestamps: a random walk either way, in 32 bits, wrapping */
+  for (i = 0, x = 0xfffff000; i < NVALUES; ++i)
+    v32[i] = x += rand () % 201 - 100;
+  if (check32 ("random walk", v32, NVALUES,
+          GOLOMB_INTS_DELTA | GOLOMB_INTS_ZIGZAG, &len))
+    return 1;
+  if (len * 8 > NVALUES * 9.5) {
+    printf ("random walk coded too big\n");
+    return 1;
+  }
+
+  /* counters that are mostly small, with the odd huge outlier: one b
+   * has to be big enough for the outliers' unary to stay short, so
+   * this only has to stay under the raw size */
+  for (i = 0; i < NVALUES; ++i)
+    v64[i] = (i % 9973) ? (uint64_t) (rand () % 8) : rand64 () << 20;
+  if (check64 ("outliers", v64, NVALUES, 0, &len))
+    return 1;
+  if (len * 8 > NVALUES * 64) {
+    printf ("outliers coded too big\n");
+    return 1;
+  }
+
+  /* uniform values: can't compress, but mustn't blow up */
+  for (i = 0; i < NVALUES; ++i)
+    v32[i] = rand () % 100000;
+  if (check32 ("uniform", v32, NVALUES, 0, &len))
+    return 1;
+  if (len * 8 > NVALUES * 19) {
+    printf ("uniform coded too big\n");
+    return 1;
+  }
+
+  /* the ends of the range, with every combination of transforms */
+  for (flags = 0; flags <= GOLOMB_INTS_FLAGS; ++flags)
+    if (check64 ("extremes", extremes,
+            sizeof (extremes) / sizeof (extremes[0]), flags, NULL) ||
+        check64 ("one value", extremes + 1, 1, flags, NULL) ||
+        check64 ("no values", extremes, 0, flags, NULL))
+      return 1;
+  for (i = 0; i < NVALUES; ++i)
+    v64[i] = rand64 () ^ (rand64 () << 32);
+  for (flags = 0; flags <= GOLOMB_INTS_FLAGS; ++flags)
+    if (check64 ("random 64 bit", v64, 1000, flags, NULL))
+      return 1;
+
+  if (golomb_ints_encode64 (v64, 10, 4, &enc, &len) != -1 ||
+      golomb_ints_encode64 (NULL, 10, 0, &enc, &len) != -1 ||
+      golomb_ints_decode64 ("", 0, &v64, &len) != -1) {
+    printf ("bad arguments accepted\n");
+    return 1;
+  }
+
+  free (v64);
+  free (v32);
+  return 0;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "encode.h"
+#include "parallel.h"
+#include "test_util.h"
+
+#define INPUTSZ (1 << 20)
+
+int main ()
+{
+  /* sparse, medium, dense enough to be complemented, and one with
+   * runs longer than a thread's share of the coded input */
+  int densities[] = { 1, 20, 150, 700, 300 };
+  unsigned char *input;
+  void *ge, *gd, *pd;
+  size_t ge_size, gd_size, pd_size, len, j;
+  uint64_t param;
+  int i, nthreads, order;
+
+  srand (1);
+  input = malloc (INPUTSZ);
+
+  for (i = 0; i < sizeof (densities) / sizeof (densities[0]); ++i) {
+    len = INPUTSZ - i * 37;
+    fill_random (input, len, densities[i]);
+    if (i == 4)
+      memset (input + len / 4, 0, len / 2);
+
+    /* odd ones LSB first */
+    order = (i & 1) ? GOLOMB_ORDER_LSB : GOLOMB_ORDER_MSB;
+    if (golomb_encode_order (input, len, order, &ge, &ge_size, &param) ||
+        golomb_decode (ge, ge_size, param, &gd, &gd_size)) {
+      printf ("density %d: encoding failed\n", densities[i]);
+      return 1;
+    }
+
+    /* every split gives what golomb_decode does */
+    for (nthreads = 1; nthreads <= 64; nthreads = nthreads * 2 + 1) {
+      if (golomb_decode_parallel (ge, ge_size, param, nthreads, &pd,
+            &pd_size) ||
+          pd_size != gd_size || pd_size != len || 
+          memcmp (pd, gd, pd_size)) {
+        printf ("density %d, %d threads: mismatch\n", densities[i],
+            nthreads);
+        return 1;
+      }
+      free (pd);
+    }
+    printf ("density %d/1000: %zu -> %zu bytes, parallel decode ok\n",
+        densities[i], len, ge_size);
+
+    free (ge);
+    free (gd);
+  }
+
+  /* gaps that add up past 2^64 make a stream of valid code words
+   * that golomb_decode refuses; split up, wherever they fall, the
+   * parallel decode has to refuse it too rather than write past its
+   * output */
+  for (i = 0; i < 2; ++i) {
+    uint64_t gaps[3000], b = 1ULL << 60, bitpos = 0, ret;
+    unsigned char *enc;
+
+    for (j = 0; j < 3000; ++j)
+      gaps[j] = 1;
+    j = i ? 1500 : 0;
+    gaps[j] = 1ULL << 62;
+    gaps[j + 1] = -(1ULL << 62) + 100;
+
+    enc = calloc ((golomb_gaps_bits (gaps, 3000, b) >> 3) + 1, 1);
+    golomb_encode_gaps (gaps, 3000, b, enc, &bitpos);
+    ret = golomb_decode (enc, bitpos >> 3, b, &gd, &gd_size);
+    for (nthreads = 2; nthreads <= 16; nthreads *= 2) {
+      if (!ret ||
+          golomb_decode_parallel (enc, bitpos >> 3, b, nthreads, &pd,
+            &pd_size) != ret) {
+        printf ("overflowing gaps at %zu, %d threads: not refused\n", j,
+            nthreads);
+        return 1;
+      }
+    }
+    free (enc);
+  }
+  printf ("overflowing gaps refused\n");
+
+  /* deflate across threads gives a zlib stream that inflates back to
+   * the input, for inputs ending mid-piece and ones that repeat across
+   * pieces */
+  for (i = 0; i < 3; ++i) {
+    static const int levels[] = { Z_DEFAULT_COMPRESSION, 1, 9 };
+    void *ze, *zp, *zd;
+    size_t ze_size, zp_size, zd_size;
+
+    len = INPUTSZ - i * 70001;
+    fill_random (input, len, densities[i]);
+    if (i == 2)
+      for (j = 4096; j < len; ++j)
+        input[j] = input[j % 4096];
+
+    if (zlib_encode (input, len, &ze, &ze_size, levels[i])) {
+      printf ("deflate %d: zlib_encode failed\n", i);
+      return 1;
+    }
+    for (nthreads = 1; nthreads <= 16; nthreads = nthreads * 2 + 1) {
+      if (zlib_encode_parallel (input, len, &zp, &zp_size, levels[i],
+            nthreads) ||
+          zlib_decode (zp, zp_size, &zd, &zd_size) ||
+          zd_size != len || memcmp (zd, input, len)) {
+        printf ("deflate %d, %d threads: mismatch\n", i, nthreads);
+        return 1;
+      }
+      free (zp);
+      free (zd);
+    }
+    printf ("deflate level %d: %zu -> %zu bytes, parallel %zu, ok\n",
+        levels[i], len, ze_size, zp_size);
+    free (ze);
+  }
+
+  free (input);
+  return 0;
+}
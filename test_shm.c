@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "encode.h"
+#include "block.h"
+#include "shm.h"
+#include "test_util.h"
+
+#define INPUTSZ (64 * 1024)
+#define BLOCKSZ 4096
+#define VERSIONS 200
+
+/*
+ * Query blocks of whatever version is current while the parent keeps
+ * swapping two in; every answer has to be all of one or the other.
+ */
+static int
+reader (const char *name, unsigned char *versions[2])
+{
+  struct golomb_shm shm;
+  unsigned char out[BLOCKSZ];
+  uint64_t gen, last = 0;
+  size_t k, queries = 0;
+
+  if (golomb_shm_open (&shm, name)) {
+    printf ("reader: cannot attach\n");
+    return 1;
+  }
+  while (last < VERSIONS) {
+    k = rand () % (INPUTSZ / BLOCKSZ);
+    if (golomb_shm_decode_block (&shm, k, out, &gen)) {
+      printf ("reader: decode failed\n");
+      return 1;
+    }
+    if (gen < last || memcmp (out, versions[gen & 1] + k * BLOCKSZ,
+          BLOCKSZ)) {
+      printf ("reader: block %zu of generation %zu torn\n", k,
+          (size_t) gen);
+      return 1;
+    }
+    last = gen;
+    queries++;
+  }
+  printf ("reader: %zu queries, ok\n", queries);
+  golomb_shm_close (&shm);
+  return 0;
+}
+
+int main ()
+{
+  struct golomb_shm pub, rd;
+  unsigned char *versions[2];
+  void *enc[2];
+  size_t enc_size[2];
+  char name[64];
+  uint64_t pos, rank, got;
+  int i, bit, status;
+  pid_t pid;
+
+  srand (1);
+  snprintf (name, sizeof (name), "/golomb_test_%d", (int) getpid ());
+
+  for (i = 0; i < 2; ++i) {
+    versions[i] = malloc (INPUTSZ);
+    fill_random (versions[i], INPUTSZ, i ? 300 : 20);
+    if (golomb_block_encode_hybrid (versions[i], INPUTSZ, BLOCKSZ,
+          GOLOMB_BLOCK_BALANCED | GOLOMB_BLOCK_RANK, &enc[i], &enc_size[i])) {
+      printf ("encoding failed\n");
+      return 1;
+    }
+  }
+
+  if (golomb_shm_create (&pub, name, INPUTSZ + 4096) ||
+      golomb_shm_open (&rd, name)) {
+    printf ("cannot set up segment %s\n", name);
+    return 1;
+  }
+
+  /* nothing there yet, and a reader can't publish */
+  if (golomb_shm_generation (&rd) || !golomb_shm_test_bit (&rd, 0, &bit) ||
+      !golomb_shm_publish (&rd, enc[0], enc_size[0]) ||
+      !golomb_shm_publish (&pub, versions[0], INPUTSZ)) {
+    printf ("empty segment misbehaves\n");
+    return 1;
+  }
+
+  /* queries in place against the bitmap */
+  if (golomb_shm_publish (&pub, enc[0], enc_size[0]) ||
+      golomb_shm_generation (&rd) != 1) {
+    printf ("publish failed\n");
+    return 1;
+  }
+  for (pos = 0, rank = 0; pos < INPUTSZ * 8; ++pos) {
+    if (pos % 1009 == 0) {
+      if (golomb_shm_test_bit (&rd, pos, &bit) ||
+          bit != !!(versions[0][pos / 8] & (0x80 >> (pos % 8))) ||
+          golomb_shm_rank (&rd, pos, &got) || got != rank) {
+        printf ("query of bit %zu mismatches\n", (size_t) pos);
+        return 1;
+      }
+    }
+    rank += !!(versions[0][pos / 8] & (0x80 >> (pos % 8)));
+  }
+  if (!golomb_shm_test_bit (&rd, INPUTSZ * 8, &bit)) {
+    printf ("bit past the end succeeded\n");
+    return 1;
+  }
+  printf ("in place queries: %zu + %zu bytes published, ok\n", enc_size[0],
+      enc_size[1]);
+
+  /* swaps under a reader in another process */
+  fflush (stdout);
+  if ((pid = fork ()) == 0)
+    exit (reader (name, versions));
+  for (i = 2; i <= VERSIONS; ++i) {
+    if (golomb_shm_publish (&pub, enc[i & 1], enc_size[i & 1])) {
+      printf ("publish %d failed\n", i);
+      return 1;
+    }
+    usleep (100);
+  }
+  if (waitpid (pid, &status, 0) != pid || !WIFEXITED (status) ||
+      WEXITSTATUS (status)) {
+    printf ("reader failed\n");
+    return 1;
+  }
+
+  /* this handle took the latest version too */
+  if (golomb_shm_test_bit (&rd, 12345, &bit) ||
+      bit != !!(versions[0][12345 / 8] & (0x80 >> (12345 % 8)))) {
+    printf ("reader missed the swap\n");
+    return 1;
+  }
+
+  golomb_shm_close (&rd);
+  golomb_shm_close (&pub);
+  golomb_shm_unlink (name);
+  for (i = 0; i < 2; ++i) {
+    free (versions[i]);
+    free (enc[i]);
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+#include "similarity.h"
+
+#define NFILTERS 12
+#define FILTERSZ 2048
+
+/* the same counts, the slow way */
+static void
+bitmap_similarity (const unsigned char *a, const unsigned char *b,
+    size_t size, struct golomb_similarity *sim)
+{
+  size_t i;
+
+  memset (sim, 0, sizeof (*sim));
+  sim->nbits = size * 8;
+  for (i = 0; i < size; ++i) {
+    sim->a += __builtin_popcount (a[i]);
+    sim->b += __builtin_popcount (b[i]);
+    sim->both += __builtin_popcount (a[i] & b[i]);
+    sim->either += __builtin_popcount (a[i] | b[i]);
+    sim->differ += __builtin_popcount (a[i] ^ b[i]);
+  }
+}
+
+int main ()
+{
+  unsigned char *filters[NFILTERS];
+  struct golomb_stream streams[NFILTERS];
+  struct golomb_similarity *all, pair, want;
+  void *enc;
+  size_t enc_size, i, j, k;
+  uint64_t param, count;
+  int permille;
+
+  srand (1);
+
+  /* filters from nearly empty to nearly full (the full ones are coded
+   * as their complement), and one with a zero tail */
+  for (i = 0; i < NFILTERS; ++i) {
+    permille = (i < NFILTERS / 2) ? 5 + i * 20 : 900 + i * 5;
+    filters[i] = malloc (FILTERSZ);
+    for (k = 0; k < FILTERSZ; ++k) {
+      filters[i][k] = 0;
+      for (j = 0; j < 8; ++j)
+        if (rand () % 1000 < permille)
+          filters[i][k] |= 0x80 >> j;
+    }
+    if (i == 1)
+      memset (filters[i] + FILTERSZ / 2, 0, FILTERSZ / 2);
+
+    if (golomb_encode (filters[i], FILTERSZ, &enc, &enc_size, &param)) {
+      printf ("golomb encoding failed\n");
+      return 1;
+    }
+    streams[i].data = enc;
+    streams[i].len = enc_size;
+    streams[i].golomb_param = param;
+
+    bitmap_similarity (filters[i], filters[i], FILTERSZ, &want);
+    if (golomb_cardinality (enc, enc_size, param, &count) ||
+        count != want.a) {
+      printf ("cardinality of filter %zu mismatches\n", i);
+      return 1;
+    }
+  }
+
+  all = malloc (sizeof (*all) * NFILTERS * NFILTERS);
+  if (golomb_compare_all (streams, NFILTERS, all)) {
+    printf ("compare all failed\n");
+    return 1;
+  }
+
+  for (i = 0; i < NFILTERS; ++i) {
+    for (j = 0; j < NFILTERS; ++j) {
+      bitmap_similarity (filters[i], filters[j], FILTERSZ, &want);
+      if (golomb_compare (&streams[i], &streams[j], &pair) ||
+          memcmp (&pair, &want, sizeof (want)) ||
+          memcmp (&all[i * NFILTERS + j], &want, sizeof (want))) {
+        printf ("filters %zu and %zu: |A&B| %llu, expected %llu\n", i, j,
+            (unsigned long long) pair.both, 
+            (unsigned long long) want.both);
+        return 1;
+      }
+    }
+  }
+  printf ("%d filters, jaccard(0, 1) = %.3f, hamming(0, 11) = %llu\n",
+      NFILTERS, golomb_jaccard (&all[1]), 
+      (unsigned long long) all[NFILTERS - 1].differ);
+
+  /* filters of different sizes don't compare */
+  if (golomb_encode (filters[0], FILTERSZ / 2, &enc, &enc_size, &param)) {
+    printf ("golomb encoding failed\n");
+    return 1;
+  }
+  free ((void*) streams[0].data);
+  streams[0].data = enc;
+  streams[0].len = enc_size;
+  streams[0].golomb_param = param;
+  if (golomb_compare (&streams[0], &streams[1], &pair) != -1 ||
+      golomb_compare_all (streams, NFILTERS, all) != -1) {
+    printf ("filters of different sizes compared\n");
+    return 1;
+  }
+
+  for (i = 0; i < NFILTERS; ++i) {
+    free (filters[i]);
+    free ((void*) streams[i].data);
+  }
+  free (all);
+
+  return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+#include "test_util.h"
+
+#define INPUTSZ (64 * 1024)
+
+/* what the callback saw */
+static struct golomb_stats seen[GOLOMB_STATS_OPS];
+static int seen_calls;
+
+static void
+record (int op, const struct golomb_stats *call, void *arg)
+{
+  if (arg != (void*) seen) return;
+  seen[op] = *call;
+  seen_calls++;
+}
+
+int main ()
+{
+  int densities[] = { 10, 100, 900 };
+  struct golomb_stats st;
+  unsigned char *input;
+  void *ge, *ze, *zd;
+  size_t ge_size, ze_size, zd_size, in_total = 0, out_total = 0;
+  uint64_t param;
+  int i, n = sizeof (densities) / sizeof (densities[0]);
+
+  srand (1);
+  input = malloc (INPUTSZ);
+  golomb_stats_reset ();
+  golomb_stats_set_callback (record, seen);
+
+  for (i = 0; i < n; ++i) {
+    fill_random (input, INPUTSZ, densities[i]);
+    if (golomb_encode (input, INPUTSZ, &ge, &ge_size, &param)) {
+      printf ("density %d: encoding failed\n", densities[i]);
+      return 1;
+    }
+
+    /* the call's own counters */
+    if (seen_calls != i + 1 || seen[GOLOMB_STATS_ENCODE].calls != 1 ||
+        seen[GOLOMB_STATS_ENCODE].bytes_in != INPUTSZ ||
+        seen[GOLOMB_STATS_ENCODE].bytes_out != ge_size ||
+        seen[GOLOMB_STATS_ENCODE].b != (param & ~GOLOMB_PARAM_COMPLEMENT) ||
+        seen[GOLOMB_STATS_ENCODE].complemented !=
+          !!(param & GOLOMB_PARAM_COMPLEMENT) ||
+        seen[GOLOMB_STATS_ENCODE].runs < 2) {
+      printf ("density %d: callback counters wrong\n", densities[i]);
+      return 1;
+    }
+    printf ("density %d/1000: %zu runs, b = %llu, density %llu ns, "
+        "rle %llu ns, pack %llu ns, alloc %llu ns\n", densities[i],
+        (size_t) seen[GOLOMB_STATS_ENCODE].runs,
+        (unsigned long long) seen[GOLOMB_STATS_ENCODE].b,
+        (unsigned long long) seen[GOLOMB_STATS_ENCODE].ns_density,
+        (unsigned long long) seen[GOLOMB_STATS_ENCODE].ns_rle,
+        (unsigned long long) seen[GOLOMB_STATS_ENCODE].ns_pack,
+        (unsigned long long) seen[GOLOMB_STATS_ENCODE].ns_alloc);
+
+    in_total += INPUTSZ;
+    out_total += ge_size;
+    free (ge);
+  }
+
+  /* the totals add the calls up */
+  if (golomb_stats_get (GOLOMB_STATS_ENCODE, &st) || st.calls != n ||
+      st.bytes_in != in_total || st.bytes_out != out_total ||
+      st.complemented != 1 || st.b != seen[GOLOMB_STATS_ENCODE].b) {
+    printf ("golomb_encode totals wrong\n");
+    return 1;
+  }
+
+  /* random bytes don't deflate, so the output has to grow */
+  for (i = 0; i < INPUTSZ; ++i)
+    input[i] = rand ();
+  if (zlib_encode (input, INPUTSZ, &ze, &ze_size, 6) ||
+      zlib_decode (ze, ze_size, &zd, &zd_size) || zd_size != INPUTSZ) {
+    printf ("zlib round trip failed\n");
+    return 1;
+  }
+  if (golomb_stats_get (GOLOMB_STATS_ZLIB_ENCODE, &st) || st.calls != 1 ||
+      st.bytes_in != INPUTSZ || st.bytes_out != ze_size ||
+      !st.reallocs || !st.expanded || !st.ns_pack) {
+    printf ("zlib_encode totals wrong\n");
+    return 1;
+  }
+  if (golomb_stats_get (GOLOMB_STATS_ZLIB_DECODE, &st) || st.calls != 1 ||
+      st.bytes_in != ze_size || st.bytes_out != INPUTSZ) {
+    printf ("zlib_decode totals wrong\n");
+    return 1;
+  }
+  printf ("zlib: %zu -> %zu bytes, %llu reallocs, ok\n", (size_t) INPUTSZ,
+      ze_size, (unsigned long long) seen[GOLOMB_STATS_ZLIB_ENCODE].reallocs);
+
+  /* and reset clears them */
+  golomb_stats_set_callback (NULL, NULL);
+  golomb_stats_reset ();
+  if (golomb_stats_get (GOLOMB_STATS_ENCODE, &st) || st.calls ||
+      golomb_stats_get (GOLOMB_STATS_OPS, &st) != -1) {
+    printf ("reset failed\n");
+    return 1;
+  }
+
+  free (ze);
+  free (zd);
+  free (input);
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+#include "stream.h"
+#include "test_util.h"
+
+#define INPUTSZ (256 * 1024)
+
+/* feed 'in' to a decoder in pieces of up to 'maxfrag' bytes, with up
+ * to 'maxout' bytes of room each time; 0 means a random size */
+static int
+stream_decode (const unsigned char *in, size_t len, uint64_t param,
+    size_t maxfrag, size_t maxout, unsigned char *out, size_t cap,
+    size_t *outsize)
+{
+  struct golomb_decoder dec;
+  size_t off = 0, got = 0, frag, room, used, made;
+
+  if (golomb_decoder_init (&dec, param)) return 1;
+
+  for (;;) {
+    frag = maxfrag ? maxfrag : 1 + rand () % 3000;
+    if (frag > len - off) frag = len - off;
+    room = maxout ? maxout : 1 + rand () % 5000;
+    if (room > cap - got) room = cap - got;
+
+    if (golomb_decoder_feed (&dec, in + off, frag, &used, out + got,
+          room, &made))
+      return 1;
+    off += used;
+    got += made;
+    if (off == len && !made) break;
+  }
+
+  *outsize = got;
+  return 0;
+}
+
+int main ()
+{
+  /* sparse, medium, dense enough to be complemented, and one with
+   * runs of hundreds of thousands of bits */
+  int densities[] = { 1, 30, 200, 800, 300 };
+  unsigned char *input, *out;
+  void *ge;
+  size_t ge_size, out_size, len;
+  uint64_t param;
+  int i, order;
+
+  srand (1);
+  input = malloc (INPUTSZ);
+  out = malloc (INPUTSZ);
+
+  for (i = 0; i < sizeof (densities) / sizeof (densities[0]); ++i) {
+    len = INPUTSZ - i * 13;
+    fill_random (input, len, densities[i]);
+    if (i == 4)
+      memset (input + len / 4, 0, len / 2);
+
+    /* odd ones LSB first */
+    order = (i & 1) ? GOLOMB_ORDER_LSB : GOLOMB_ORDER_MSB;
+    if (golomb_encode_order (input, len, order, &ge, &ge_size, &param)) {
+      printf ("density %d: encoding failed\n", densities[i]);
+      return 1;
+    }
+
+    /* random splits, whole network packets, and a byte at a time in
+     * and out */
+    if (stream_decode (ge, ge_size, param, 0, 0, out, INPUTSZ, 
+          &out_size) || out_size != len || memcmp (out, input, len)) {
+      printf ("density %d: random fragments mismatch\n", densities[i]);
+      return 1;
+    }
+    if (stream_decode (ge, ge_size, param, 1460, INPUTSZ, out, INPUTSZ, 
+          &out_size) || out_size != len || memcmp (out, input, len)) {
+      printf ("density %d: packets mismatch\n", densities[i]);
+      return 1;
+    }
+    if (stream_decode (ge, ge_size < 20000 ? ge_size : 20000, param, 1, 
+          1, out, INPUTSZ, &out_size) || 
+        memcmp (out, input, out_size)) {
+      printf ("density %d: single bytes mismatch\n", densities[i]);
+      return 1;
+    }
+    printf ("density %d/1000: %zu -> %zu bytes, stream decode ok\n",
+        densities[i], len, ge_size);
+
+    free (ge);
+  }
+
+  free (input);
+  free (out);
+  return 0;
+}
@@ -0,0 +1,28 @@
+/*
+ * Fixtures shared by the tests and the benchmark. Header only.
+ *
+ * Released under GPLv2
+ */
+
+#ifndef __TEST_UTIL_H
+#define __TEST_UTIL_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+/* random bitmap with about 'permille' / 1000 of its bits set */
+static inline void
+fill_random (unsigned char *buf, size_t size, int permille)
+{
+  size_t i;
+  int k;
+
+  for (i = 0; i < size; ++i) {
+    buf[i] = 0;
+    for (k = 0; k < 8; ++k)
+      if (rand () % 1000 < permille)
+        buf[i] |= 1 << k;
+  }
+}
+
+#endif /* __TEST_UTIL_H */